@@ -0,0 +1,170 @@
+#include "Analysis.hpp"
+#include <cstring>
+
+bool opcode_valid(unsigned short opcode)
+{
+    switch (opcode & 0xF000)
+    {
+    case 0x0000:
+	return opcode == 0x00E0 || opcode == 0x00EE;
+    case 0x5000:
+    case 0x9000:
+	// the interpreter ignores the low nibble
+	return true;
+    case 0x8000:
+	return (opcode & 0x000F) <= 0x7 || (opcode & 0x000F) == 0xE;
+    case 0xE000:
+	return (opcode & 0x00FF) == 0x9E || (opcode & 0x00FF) == 0xA1;
+    case 0xF000:
+	switch (opcode & 0x00FF)
+	{
+	case 0x07: case 0x0A: case 0x15: case 0x18: case 0x1E:
+	case 0x29: case 0x33: case 0x55: case 0x65:
+	    return true;
+	}
+	return false;
+    }
+    return true;
+}
+
+bool opcode_stores(unsigned short opcode)
+{
+    return (opcode & 0xF0FF) == 0xF033 || (opcode & 0xF0FF) == 0xF055;
+}
+
+bool opcode_ends_block(unsigned short opcode)
+{
+    switch (opcode & 0xF000)
+    {
+    case 0x0000:
+	return opcode == 0x00EE;
+    case 0x1000: case 0x2000: case 0x3000: case 0x4000:
+    case 0x5000: case 0x9000: case 0xB000: case 0xE000:
+	return true;
+    case 0xF000:
+	// FX0A loops on itself until a key is pressed and a store may
+	// overwrite the instructions that follow it
+	return (opcode & 0x00FF) == 0x0A || opcode_stores(opcode);
+    }
+    return false;
+}
+
+void RomAnalysis::analyze(const unsigned char *memory)
+{
+    std::vector<unsigned int> work;
+
+    memset(flags, 0, sizeof(flags));
+    blocks.clear();
+
+    flags[Chip8::PROGRAM_START] |= LEADER;
+    work.push_back(Chip8::PROGRAM_START);
+    while (!work.empty())
+    {
+	unsigned int addr = work.back();
+	work.pop_back();
+	if (addr + 1 >= Chip8::MEMORY_SIZE || (flags[addr] & (CODE | UNKNOWN)))
+	    continue;
+
+	unsigned short opcode = memory[addr] << 8 | memory[addr + 1];
+	if (!opcode_valid(opcode))
+	{
+	    flags[addr] |= UNKNOWN;
+	    continue;
+	}
+	flags[addr] |= CODE;
+
+	unsigned int targets[2];
+	unsigned int ntargets = 0;
+	unsigned int nnn = opcode & 0x0FFF;
+	switch (opcode & 0xF000)
+	{
+	case 0x0000:
+	    if (opcode != 0x00EE)
+		targets[ntargets++] = addr + 2;
+	    break;
+	case 0x1000:
+	    targets[ntargets++] = nnn;
+	    break;
+	case 0x2000:
+	    targets[ntargets++] = nnn;
+	    targets[ntargets++] = addr + 2; // return address
+	    break;
+	case 0x3000: case 0x4000: case 0x5000: case 0x9000: case 0xE000:
+	    targets[ntargets++] = addr + 2;
+	    targets[ntargets++] = addr + 4;
+	    break;
+	case 0xB000:
+	    // computed jump, target unknown
+	    break;
+	case 0xF000:
+	    if ((opcode & 0x00FF) == 0x0A)
+		flags[addr] |= LEADER;
+	    targets[ntargets++] = addr + 2;
+	    break;
+	default:
+	    targets[ntargets++] = addr + 2;
+	}
+
+	if (opcode_stores(opcode))
+	    flags[addr] |= STORE;
+	if (opcode_ends_block(opcode))
+	{
+	    flags[addr] |= END;
+	    // every successor of a block end starts a block
+	    for (unsigned int i = 0; i < ntargets; i++)
+		if (targets[i] < Chip8::MEMORY_SIZE)
+		    flags[targets[i]] |= LEADER;
+	}
+	for (unsigned int i = 0; i < ntargets; i++)
+	    work.push_back(targets[i]);
+    }
+
+    idle_loops.clear();
+    for (unsigned int addr = 0; addr < Chip8::MEMORY_SIZE; addr++)
+    {
+	if ((flags[addr] & (CODE | LEADER)) == (CODE | LEADER))
+	    blocks.push_back(addr);
+	if ((flags[addr] & CODE) && idle_loop_length(memory, addr) > 0)
+	{
+	    flags[addr] |= IDLE;
+	    idle_loops.push_back(addr);
+	}
+    }
+}
+
+unsigned int RomAnalysis::idle_loop_length(const unsigned char *memory,
+					   unsigned int addr)
+{
+    unsigned short op[3];
+    for (unsigned int i = 0; i < 3; i++)
+	op[i] = addr + 2 * i + 1 < Chip8::MEMORY_SIZE ?
+	    memory[addr + 2 * i] << 8 | memory[addr + 2 * i + 1] : 0;
+    unsigned short jump_back = 0x1000 | addr;
+
+    if (op[0] == jump_back)
+	return 1;
+    if ((op[0] & 0xF0FF) == 0xE09E || (op[0] & 0xF0FF) == 0xE0A1)
+	return op[1] == jump_back ? 2 : 0;
+    // FX07 then 3XNN or 4XNN on the same register
+    if ((op[0] & 0xF0FF) == 0xF007 &&
+	((op[1] & 0xF000) == 0x3000 || (op[1] & 0xF000) == 0x4000) &&
+	(op[1] & 0x0F00) == (op[0] & 0x0F00))
+	return op[2] == jump_back ? 3 : 0;
+    return 0;
+}
+
+unsigned int RomAnalysis::block_end(unsigned int start, unsigned int *count) const
+{
+    unsigned int addr = start;
+    *count = 0;
+    while (is_code(addr))
+    {
+	(*count)++;
+	if (flags[addr] & END)
+	    return addr + 2;
+	addr += 2;
+	if (addr >= Chip8::MEMORY_SIZE || (flags[addr] & LEADER))
+	    break;
+    }
+    return addr;
+}
@@ -0,0 +1,59 @@
+#ifndef __Analysis_H__
+#define __Analysis_H__
+
+#include <vector>
+
+#include "Chip8.hpp"
+
+/* Static analysis of a ROM: which addresses are reachable code, where
+   the basic blocks start and which loops do nothing but wait: a jump to
+   itself, polling the delay timer (FX07, skip on VX, jump back) or
+   polling a key (EX9E or EXA1, jump back). Code is found by following every
+   statically known control transfer from PROGRAM_START. Addresses only
+   reached through BNNN or by falling into data are not found; callers
+   must treat anything not marked as code as unknown. */
+class RomAnalysis
+{
+public:
+    // per-address flags
+    static const unsigned char CODE = 0x01;     // an instruction starts here
+    static const unsigned char LEADER = 0x02;   // a basic block starts here
+    static const unsigned char END = 0x04;      // instruction ends its block
+    static const unsigned char STORE = 0x08;    // instruction writes memory
+    static const unsigned char UNKNOWN = 0x10;  // reached but not decodable
+    static const unsigned char IDLE = 0x20;     // a loop that only waits starts here
+
+    unsigned char flags[Chip8::MEMORY_SIZE];
+    std::vector<unsigned short> blocks; // block start addresses, sorted
+    std::vector<unsigned short> idle_loops; // IDLE addresses, sorted
+
+    /* Analyzes the program loaded in memory (MEMORY_SIZE bytes) */
+    void analyze(const unsigned char *memory);
+
+    /* Number of instructions in the waiting loop at addr, 0 if the code
+       there is not one */
+    static unsigned int idle_loop_length(const unsigned char *memory,
+					 unsigned int addr);
+
+    /* Address of the instruction following the last one in the block
+       starting at start, and number of instructions in it */
+    unsigned int block_end(unsigned int start, unsigned int *count) const;
+
+    bool is_code(unsigned int addr) const
+    {
+	return addr < Chip8::MEMORY_SIZE && (flags[addr] & CODE);
+    }
+};
+
+/* Instruction classification shared by the analysis and code generators */
+
+/* Known CHIP-8 instruction */
+bool opcode_valid(unsigned short opcode);
+
+/* Instruction after which straight-line execution cannot continue */
+bool opcode_ends_block(unsigned short opcode);
+
+/* Instruction that writes memory (FX33, FX55) */
+bool opcode_stores(unsigned short opcode);
+
+#endif /* defined(__Analysis_H__) */
@@ -1,30 +1,133 @@
 #include "Chip8.hpp"
-#include <iostream>
-#include <fstream>
-#include <ctype.h> // Requiered for debug_dump_mem
-#include <stdio.h> // Requiered for debug_dump_mem
+#include "Analysis.hpp"
+#include "Diagnostics.hpp"
+#include "Trace.hpp"
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include <vector>
 
-void Chip8::clear_screen()
+const unsigned int Chip8::VIDEO_WIDTH;
+const unsigned int Chip8::VIDEO_HEIGHT;
+const unsigned int Chip8::KEYS_SIZE;
+const unsigned int Chip8::MEMORY_SIZE;
+const unsigned int Chip8::VREG_SIZE;
+const unsigned int Chip8::STACK_SIZE;
+const unsigned int Chip8::PROGRAM_START;
+const unsigned int Chip8::MAX_ROM_SIZE;
+const unsigned int Chip8::EVENT_FRAME_DRAWN;
+const unsigned int Chip8::EVENT_KEY_WAIT;
+const unsigned int Chip8::EVENT_SOUND;
+const unsigned int Chip8::EVENT_BREAKPOINT;
+const unsigned int Chip8::EVENT_ALL;
+
+// charset needed for opcode FX29
+static const unsigned char chip8_fontset[80] =
+{
+    0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
+    0x20, 0x60, 0x20, 0x20, 0x70, // 1
+    0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
+    0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
+    0x90, 0x90, 0xF0, 0x10, 0x10, // 4
+    0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
+    0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
+    0xF0, 0x10, 0x20, 0x40, 0x40, // 7
+    0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
+    0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
+    0xF0, 0x90, 0xF0, 0x90, 0x90, // A
+    0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
+    0xF0, 0x80, 0x80, 0x80, 0xF0, // C
+    0xE0, 0x90, 0x90, 0x90, 0xE0, // D
+    0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
+    0xF0, 0x80, 0xF0, 0x80, 0x80  // F
+};
+
+/* Memory image with only the font loaded, shared by every reset machine */
+static PageRef create_blank_memory()
+{
+    PageRef page = PageRef::create(Chip8::MEMORY_SIZE);
+    memcpy(page.data(), chip8_fontset, sizeof(chip8_fontset));
+    return page;
+}
+
+static const PageRef &blank_memory()
+{
+    static const PageRef page = create_blank_memory();
+    return page;
+}
+
+/* Cleared framebuffer, shared by every machine until it draws */
+static const PageRef &blank_framebuffer()
+{
+    static const PageRef page =
+	PageRef::create(Chip8::VIDEO_WIDTH * Chip8::VIDEO_HEIGHT);
+    return page;
+}
+
+/* Memory images of loaded ROMs, so that instances running the same ROM
+   share one copy until they write to it. An image is dropped once no
+   instance references it anymore */
+static std::mutex rom_images_lock;
+
+static PageRef share_rom_image(const unsigned char *image)
 {
-    // clear video ram
-    for (int i = 0; i < VIDEO_WIDTH; i++)
+    std::lock_guard<std::mutex> lock(rom_images_lock);
+    // built on first use, so the core needs no static constructors
+    static std::vector<PageRef> rom_images;
+    for (size_t i = 0; i < rom_images.size(); )
     {
-	for (int j = 0; j < VIDEO_HEIGHT; j++)
+	if (!rom_images[i].shared())
 	{
-	    gfx[i][j] = 0;
+	    rom_images[i] = rom_images.back();
+	    rom_images.pop_back();
 	}
+	else if (memcmp(rom_images[i].data(), image, Chip8::MEMORY_SIZE) == 0)
+	    return rom_images[i];
+	else
+	    i++;
     }
+    rom_images.push_back(PageRef::create(Chip8::MEMORY_SIZE, image));
+    return rom_images.back();
 }
 
-int Chip8::initialize(unsigned char start_time, std::string rom_path)
+Chip8::Chip8()
 {
+    clear_breakpoints();
+    set_seed(0);
     reset();
-    rand_state = start_time;
+}
 
-    Chip8::rom_path = rom_path;
-    if (load_rom())
-	return 1;
-    return 0;
+Chip8 Chip8::fork() const
+{
+    Chip8 child(*this);
+    child.diag = nullptr;
+    if (child.tracer != nullptr)
+    {
+	child.tracer = nullptr;
+	child.select_step();
+    }
+    return child;
+}
+
+static_assert(Chip8::VIDEO_HEIGHT <= 32, "dirty_rows has one bit per display row");
+static_assert(Chip8::VIDEO_WIDTH <= 64, "display_rows has one bit per display column");
+
+void Chip8::clear_screen()
+{
+    // clear video ram, sharing the blank framebuffer instead of
+    // writing to our own
+    gfx_page = blank_framebuffer();
+    gfx = (const unsigned char (*)[VIDEO_HEIGHT])gfx_page.data();
+    memset(display_rows, 0, sizeof(display_rows));
+    dirty_rows = ~0U;
+}
+
+void Chip8::set_seed(unsigned int seed)
+{
+    // xorshift32 never leaves a zero state, keep it out of reach
+    rand_state = seed * 2654435761u ^ 0x9E3779B9u;
+    if (rand_state == 0)
+	rand_state = 1;
 }
 
 void Chip8::reset()
@@ -35,6 +138,10 @@ void Chip8::reset()
     I = 0;
     pc = PROGRAM_START;
     sp = 0;
+    cycle = 0;
+    rom_size = 0;
+    frame_budget = 0;
+    frame_remaining = 0;
 
     clear_screen();
 
@@ -42,9 +149,9 @@ void Chip8::reset()
     for (int i = 0; i < KEYS_SIZE; i++)
 	key[i] = 0;
 
-    // clear memory
-    for (int i = 0; i < MEMORY_SIZE; i++)
-	memory[i] = 0;
+    // clear memory and load fontset
+    memory_page = blank_memory();
+    memory = memory_page.data();
 
     // clear V registers
     for (int i = 0; i < VREG_SIZE; i++)
@@ -53,46 +160,200 @@ void Chip8::reset()
     // clear stack
     for (int i = 0; i < STACK_SIZE; i++)
 	stack[i] = 0;
+}
+
+int Chip8::load_rom(const unsigned char *rom, unsigned int size)
+{
+    if (size > MAX_ROM_SIZE)
+    {
+	report(DIAG_ROM_TOO_BIG, size);
+	return 1;
+    }
+    unsigned char image[MEMORY_SIZE];
+    memcpy(image, memory, MEMORY_SIZE);
+    memcpy(&image[PROGRAM_START], rom, size);
+    memory_page = share_rom_image(image);
+    memory = memory_page.data();
+    rom_size = size;
+    rom_image = memory_page;
+    rom_image_size = size;
+    rom_profile = PROFILE_AUTO;
+    idle_loops = nullptr;
+    idle_count = 0;
+    select_step();
+    return 0;
+}
+
+void Chip8::restart()
+{
+    reset();
+    if (rom_image.valid())
+    {
+	memory_page = rom_image;
+	memory = memory_page.data();
+	rom_size = rom_image_size;
+    }
+    select_step();
+}
 
-    // load fontset
-    for (int i = 0; i < 80; i++)
-	memory[i] = chip8_fontset[i];
+void Chip8::set_tracer(TraceBuffer *tracer)
+{
+    Chip8::tracer = tracer;
+    select_step();
 }
 
-int Chip8::load_rom()
+void Chip8::set_profile(Profile profile, bool checked)
 {
-    std::streampos size;
+    Chip8::profile = profile;
+    Chip8::checked = checked;
+    select_step();
+}
 
-    std::cout << "Loading rom: " << rom_path << std::endl;
-    
-    std::ifstream file(rom_path, std::ios::in|std::ios::binary|std::ios::ate);
-    if (file.is_open())
+void Chip8::set_engine(Engine engine)
+{
+    Chip8::engine = engine;
+    select_step();
+}
+
+template <typename P>
+void Chip8::use_policy()
+{
+    if (tracer != nullptr)
     {
-	size = file.tellg();
-	if (size > MAX_ROM_SIZE)
-	{
-	    std::cout << "Error: ROM too big" << std::endl;
-	    return 1;
-	}
-	file.seekg(0, std::ios::beg);
-	file.read((char*)&memory[PROGRAM_START], size);
-	file.close();
+	step = &Chip8::execute_traced<Traced<P> >;
+	batch = &Chip8::execute_batch<Traced<P> >;
+	until = &Chip8::execute_until<Traced<P> >;
+	return;
     }
+    step = &Chip8::execute<P>;
+    until = &Chip8::execute_until<P>;
+    if (engine == ENGINE_THREADED)
+	batch = &Chip8::execute_threaded<P>;
+    else
+	batch = &Chip8::execute_batch<P>;
+}
+
+void Chip8::select_step()
+{
+    // detected once per ROM, from the image it was loaded as: what the
+    // program later writes to memory never changes its quirks
+    if (profile == PROFILE_AUTO && rom_profile == PROFILE_AUTO && rom_image.valid())
+	rom_profile = detect_profile(rom_image.data(), rom_image_size);
+    if (profile != PROFILE_AUTO)
+	active_profile = profile;
+    else if (rom_profile != PROFILE_AUTO)
+	active_profile = rom_profile;
     else
+	active_profile = PROFILE_CHIP8;
+
+    switch (active_profile)
     {
-	std::cout << "Unable to open " << rom_path << std::endl;
-	return 1;
+    case PROFILE_COSMAC_VIP:
+	if (checked)
+	    use_policy<Chip8Policy<QuirksCosmacVip, true> >();
+	else
+	    use_policy<Chip8Policy<QuirksCosmacVip, false> >();
+	break;
+    case PROFILE_SUPER_CHIP:
+	if (checked)
+	    use_policy<Chip8Policy<QuirksSuperChip, true> >();
+	else
+	    use_policy<Chip8Policy<QuirksSuperChip, false> >();
+	break;
+    default:
+	if (checked)
+	    use_policy<Chip8Policy<QuirksChip8, true> >();
+	else
+	    use_policy<Chip8Policy<QuirksChip8, false> >();
     }
-    return 0;
+}
+
+Chip8::Profile Chip8::detect_profile(const unsigned char *memory, unsigned int size)
+{
+    // the analysis stops at the opcodes it does not know, which is
+    // where SUPER-CHIP ones are
+    RomAnalysis analysis;
+    analysis.analyze(memory);
+    unsigned int end = PROGRAM_START + (size < MAX_ROM_SIZE ? size : MAX_ROM_SIZE);
+    for (unsigned int i = PROGRAM_START; i + 1 < end; i++)
+    {
+	if (!(analysis.flags[i] & (RomAnalysis::CODE | RomAnalysis::UNKNOWN)))
+	    continue;
+	unsigned short op = memory[i] << 8 | memory[i + 1];
+	// 00FB-00FF: scroll, exit, low/high resolution
+	if (op >= 0x00FB && op <= 0x00FF)
+	    return PROFILE_SUPER_CHIP;
+	// FX75/FX85: save/load flags to the HP48 RPL registers
+	if ((op & 0xF0FF) == 0xF075 || (op & 0xF0FF) == 0xF085)
+	    return PROFILE_SUPER_CHIP;
+    }
+    return PROFILE_CHIP8;
+}
+
+static const char *const profile_names[] = {"auto", "chip8", "vip", "schip"};
+
+int Chip8::profile_from_name(const char *name, Profile &profile)
+{
+    for (unsigned int i = 0; i < sizeof(profile_names) / sizeof(profile_names[0]); i++)
+	if (!strcmp(name, profile_names[i]))
+	{
+	    profile = (Profile)i;
+	    return 0;
+	}
+    return 1;
+}
+
+const char *Chip8::profile_name(Profile profile)
+{
+    return profile <= PROFILE_SUPER_CHIP ? profile_names[profile] : "unknown";
+}
 
+template <typename P>
+void Chip8::draw_sprite(unsigned int x, unsigned int y, unsigned int height)
+{
+    unsigned char (*fb)[VIDEO_HEIGHT] = framebuffer();
+    x %= VIDEO_WIDTH;
+    y %= VIDEO_HEIGHT;
+    V[0xF] = 0;
+    for (unsigned int yline = 0; yline < height; yline++)
+    {
+	unsigned int py = y + yline;
+	if (py >= VIDEO_HEIGHT)
+	{
+	    if (P::CLIP_SPRITES)
+		break;
+	    py -= VIDEO_HEIGHT;
+	}
+	dirty_rows |= 1U << py;
+	unsigned char pixel = mem<P>(I + yline);
+	for (unsigned int xline = 0; xline < 8; xline++)
+	{
+	    unsigned int px = x + xline;
+	    if (px >= VIDEO_WIDTH)
+	    {
+		if (P::CLIP_SPRITES)
+		    break;
+		px -= VIDEO_WIDTH;
+	    }
+	    if ((pixel & (0x80 >> xline)) != 0)
+	    {
+		if (fb[px][py] == 1)
+		    V[0xF] = 1;
+		fb[px][py] ^= 1;
+		display_rows[py] ^= (uint64_t)1 << px;
+	    }
+	}
+    }
 }
 
-unsigned int Chip8::run_instruction()
+template <typename P>
+unsigned int Chip8::execute()
 {
+    cycle++;
+
     // fetch opcode
-    opcode = memory[pc] << 8 | memory[pc + 1];
+    opcode = mem<P>(pc) << 8 | mem<P>(pc + 1);
 
-    // TODO: Do the replacement
     unsigned char *vx = &V[(opcode & 0x0F00) >> 8];
     unsigned char *vy = &V[(opcode & 0x00F0) >> 4];
     unsigned short nnn = opcode & 0x0FFF;
@@ -108,19 +369,30 @@ unsigned int Chip8::run_instruction()
 	    pc += 2;
 	    break;
 	case 0x00EE: // 00EE: Returns from a subroutine.
+	    if (P::CHECKED && sp == 0)
+	    {
+		report(DIAG_STACK_FAULT);
+		pc += 2;
+		break;
+	    }
 	    sp--;
 	    pc = stack[sp];
 	    pc += 2;
 	    break;
 	default:
-	    printf("Unknown opcode: 0x%04X\n", opcode);
-	    printf("No RCA 1802 found in the system :(\n");
+	    report(DIAG_MACHINE_CODE_CALL);
 	}
 	break;
     case 0x1000: //1NNN: Jumps to address NNN.
 	pc = nnn;
 	break;
     case 0x2000: // 2NNN: Calls subroutine at NNN.
+	if (P::CHECKED && sp >= STACK_SIZE)
+	{
+	    report(DIAG_STACK_FAULT);
+	    pc += 2;
+	    break;
+	}
 	stack[sp] = pc;
 	sp++;
 	pc = nnn;
@@ -182,16 +454,16 @@ unsigned int Chip8::run_instruction()
 	    pc += 2;
 	    break;
 	case 0x0005: // 8XY5: VY is subtracted from VX. VF is set to 0 when there's a borrow, and 1 when there isn't.
-	    if(*vx >= V[(opcode & 0x0F0) >> 4])
+	    if(*vx >= *vy)
 		V[0xF] = 1; // borrow
 	    else
 		V[0xF] = 0;
 	    *vx -= *vy;
 	    pc += 2;
 	    break;
-	case 0x0006: // 8XY6: Shifts VX right by one. VF is set to the value of the least significant bit of VX before the shift.
-	    V[0xF] = *vx & 0x0001;
-	    *vx = *vx >> 1;
+	case 0x0006: // 8XY6: Shifts VX (or VY, see SHIFT_VY) right by one. VF is set to the value of the least significant bit before the shift.
+	    V[0xF] = (P::SHIFT_VY ? *vy : *vx) & 0x0001;
+	    *vx = (P::SHIFT_VY ? *vy : *vx) >> 1;
 	    pc += 2;
 	    break;
 	case 0x0007: // 8XY7: Sets VX to VY minus VX. VF is set to 0 when there's a borrow, and 1 when there isn't.
@@ -203,13 +475,13 @@ unsigned int Chip8::run_instruction()
 		*vy - *vx;
 	    pc += 2;
 	    break;
-	case 0x000E: // 8XYE: Shifts VX left by one. VF is set to the value of the most significant bit of VX before the shift.
-	    V[0xF] = (*vx & 0x80) >> 7;
-	    *vx = *vx << 1;
+	case 0x000E: // 8XYE: Shifts VX (or VY, see SHIFT_VY) left by one. VF is set to the value of the most significant bit before the shift.
+	    V[0xF] = ((P::SHIFT_VY ? *vy : *vx) & 0x80) >> 7;
+	    *vx = (P::SHIFT_VY ? *vy : *vx) << 1;
 	    pc += 2;
 	    break;
 	default:
-	    printf("Unknown opcode: 0x%04X\n", opcode);    
+	    report(DIAG_UNKNOWN_OPCODE);
 	}
 	break;
     case 0x9000: // 9XY0: Skips the next instruction if VX doesn't equal VY.
@@ -222,53 +494,34 @@ unsigned int Chip8::run_instruction()
 	I = nnn;
 	pc += 2;
 	break;
-    case 0xB000: // BNNN: Jumps to the address NNN plus V0.
-	pc = nnn + V[0x0];
+    case 0xB000: // BNNN: Jumps to the address NNN plus V0 (BXNN: plus VX, see JUMP_VX).
+	pc = nnn + (P::JUMP_VX ? *vx : V[0x0]);
 	break;
     case 0xC000: // CXNN: Sets VX to a random number and NN.
-	*vx = rand() & (nnn);
+	*vx = random_byte() & (nnn);
 	pc += 2;
 	break;
     case 0xD000: // DXYN: Draws a sprite at coordinate (VX, VY) that has a width of 8 pixels and a height of N pixels.
-    {
-	unsigned short x = *vx;
-	unsigned short y = *vy;
-	unsigned short height = opcode & 0x000F;
-	unsigned short pixel;
-	V[0xF] = 0;
-	for (int yline = 0; yline < height; yline++)
-	{
-	    pixel = memory[I + yline];
-	    for (int xline = 0; xline < 8; xline++)
-	    {
-		if ((pixel & (0x80 >> xline)) != 0)
-		{
-		    if (gfx[x + xline][y + yline] == 1)
-			V[0xF] = 1;
-		    gfx[x + xline][y + yline] ^= 1;
-		}
-	    }
-	}
+	draw_sprite<P>(*vx, *vy, opcode & 0x000F);
 	pc += 2;
-    }
-    break;
+	break;
     case 0xE000:
 	switch (opcode & 0x00FF)
 	{
 	case 0x009E: // EX9E: Skips the next instruction if the key stored in VX is pressed.
-	    if (key[*vx] == 1)
+	    if (key[*vx & (P::CHECKED ? 0xF : 0xFF)] == 1)
 		pc += 4;
 	    else
 		pc += 2;
 	    break;
 	case 0x00A1: // EXA1: Skips the next instruction if the key stored in VX isn't pressed.
-	    if (key[*vx] == 0)
+	    if (key[*vx & (P::CHECKED ? 0xF : 0xFF)] == 0)
 		pc += 4;
 	    else
 		pc += 2;
 	    break;
 	default:
-	    printf("Unknown opcode: 0x%04X\n", opcode);    
+	    report(DIAG_UNKNOWN_OPCODE);
 	}
 	break;
     case 0xF000:
@@ -279,7 +532,7 @@ unsigned int Chip8::run_instruction()
 	    pc += 2;
 	    break;
 	case 0x000A: // FX0A: A key press is awaited, and then stored in VX.
-	    for (int i = 0; i < KEYS_SIZE; i++)
+	    for (unsigned int i = 0; i < KEYS_SIZE; i++)
 	    {
 		if (key[i] == 1)
 		{
@@ -309,23 +562,38 @@ unsigned int Chip8::run_instruction()
 	    pc += 2;
 	    break;
 	case 0x0033: // FX33: Stores the Binary-coded decimal representation of VX, with the most significant of three digits at the address in I.
-	    memory[I] = *vx / 100;
-	    memory[I + 1] = (*vx / 10) % 10;
-	    memory[I + 2] = (*vx % 100) % 10;
+	{
+	    unsigned char value = *vx;
+	    unsigned char *m = writable_memory();
+	    m[addr<P>(I)] = value / 100;
+	    m[addr<P>(I + 1)] = (value / 10) % 10;
+	    m[addr<P>(I + 2)] = (value % 100) % 10;
 	    pc += 2;
-	    break;
+	}
+	break;
 	case 0x0055: // FX55: Stores V0 to VX in memory starting at address I.
-	    for (int i = 0; i < ((opcode & 0x0F00) >> 8) + 1; i++)
-		memory[I + i] = V[i];
+	{
+	    unsigned int x = (opcode & 0x0F00) >> 8;
+	    unsigned char *m = writable_memory();
+	    for (unsigned int i = 0; i < x + 1; i++)
+		m[addr<P>(I + i)] = V[i];
+	    if (P::LOAD_STORE_INC_I)
+		I += x + 1;
 	    pc += 2;
-	    break;
+	}
+	break;
 	case 0x0065: // FX65: Fills V0 to VX with values from memory starting at address I.
-	    for (int i = 0; i < ((opcode & 0x0F00) >> 8) + 1; i++)
-		V[i] = memory[I + i];
+	{
+	    unsigned int x = (opcode & 0x0F00) >> 8;
+	    for (unsigned int i = 0; i < x + 1; i++)
+		V[i] = mem<P>(I + i);
+	    if (P::LOAD_STORE_INC_I)
+		I += x + 1;
 	    pc += 2;
-	    break;	    
+	}
+	break;
 	default:
-	    printf("Unknown opcode: 0x%04X\n", opcode);
+	    report(DIAG_UNKNOWN_OPCODE);
 	    // Pass test 23
 	    /* 
 	    for (int i = 0; i < 8; i++)
@@ -335,14 +603,442 @@ unsigned int Chip8::run_instruction()
 	}
 	break;
     default:
-	printf("Unknown opcode: 0x%04X\n", opcode);
+	report(DIAG_UNKNOWN_OPCODE);
     }
 
     return 1;
 }
 
+void Chip8::trace_state(TraceState &state) const
+{
+    state.cycle = cycle;
+    state.pc = pc;
+    state.I = I;
+    state.sp = sp;
+    memcpy(state.V, V, sizeof(V));
+}
+
+template <typename P>
+unsigned int Chip8::execute_traced()
+{
+    TraceState before, after;
+    trace_state(before);
+    unsigned int cycles = execute<typename P::Untraced>();
+    trace_state(after);
+    tracer->record(before, after, opcode, memory);
+    return cycles;
+}
+
+template <typename P>
+unsigned int Chip8::execute_batch(unsigned int n)
+{
+    for (unsigned int i = 0; i < n; i++)
+	execute_one<P>();
+    return n;
+}
+
+template <typename P>
+Chip8::RunResult Chip8::execute_until(unsigned int n)
+{
+    const unsigned int events = stop_events;
+    RunResult result = {STOP_DONE, 0, false};
+    while (result.cycles < n)
+    {
+	if ((events & EVENT_BREAKPOINT) && result.cycles > 0 && is_breakpoint(pc))
+	{
+	    result.reason = STOP_BREAKPOINT;
+	    break;
+	}
+	unsigned short last_pc = pc;
+	unsigned char last_sound_timer = sound_timer;
+	result.cycles += execute_one<P>();
+
+	if ((events & EVENT_FRAME_DRAWN) &&
+	    ((opcode & 0xF000) == 0xD000 || opcode == 0x00E0))
+	{
+	    result.reason = STOP_FRAME_DRAWN;
+	    break;
+	}
+	if ((events & EVENT_KEY_WAIT) && (opcode & 0xF0FF) == 0xF00A && pc == last_pc)
+	{
+	    result.reason = STOP_KEY_WAIT;
+	    break;
+	}
+	if ((events & EVENT_SOUND) && sound_timer != last_sound_timer)
+	{
+	    result.reason = STOP_SOUND;
+	    break;
+	}
+    }
+    return result;
+}
+
+Chip8::RunResult Chip8::run_frame()
+{
+    RunResult result = {STOP_DONE, 0, false};
+    if (frame_remaining == 0)
+    {
+	emulate_hardware();
+	frame_budget += instructions_per_second;
+	frame_remaining = frame_budget / frames_per_second;
+	frame_budget %= frames_per_second;
+	if (idle_count > 0)
+	    result = skip_idle_iterations();
+    }
+
+    if (result.reason == STOP_DONE)
+    {
+	unsigned int cycles = result.cycles;
+	result = run_cycles(frame_remaining);
+	frame_remaining -= result.cycles;
+	result.cycles += cycles;
+    }
+    if (result.reason == STOP_KEY_WAIT)
+    {
+	cycle += frame_remaining;
+	frame_remaining = 0;
+    }
+    result.frame_end = frame_remaining == 0;
+    return result;
+}
+
+Chip8::RunResult Chip8::skip_idle_iterations()
+{
+    RunResult result = {STOP_DONE, 0, false};
+    if (tracer != nullptr || has_breakpoints)
+	return result;
+    // the loop pc is in, if any
+    const unsigned short *next = std::upper_bound(idle_loops, idle_loops + idle_count, pc);
+    if (next == idle_loops)
+	return result;
+    unsigned short start = next[-1];
+    // the program may have written over the loop since it was analyzed
+    unsigned int length = RomAnalysis::idle_loop_length(memory, start);
+    if (length == 0 || pc >= start + 2 * length || (pc - start) % 2 != 0)
+	return result;
+    unsigned int lead = pc == start ? 0 : length - (pc - start) / 2;
+    if (lead + length > frame_remaining)
+	return result;
+
+    // on to the start, then one iteration for real. It is the loop only
+    // if both come back to the start without a call or return on the
+    // way: a key press or an expired delay timer takes it out
+    unsigned char start_sp = sp;
+    unsigned int legs[2] = {lead, length};
+    for (unsigned int i = 0; i < 2; i++)
+    {
+	RunResult leg = run_cycles(legs[i]);
+	frame_remaining -= leg.cycles;
+	result.cycles += leg.cycles;
+	result.reason = leg.reason;
+	if (leg.reason != STOP_DONE || pc != start || sp != start_sp)
+	    return result;
+    }
+    unsigned int skipped = frame_remaining / length * length;
+    cycle += skipped;
+    frame_remaining -= skipped;
+    return result;
+}
+
+void Chip8::set_speed(unsigned int instructions_per_second,
+		      unsigned int frames_per_second)
+{
+    Chip8::instructions_per_second = instructions_per_second;
+    Chip8::frames_per_second = frames_per_second > 0 ? frames_per_second : 1;
+    frame_budget = 0;
+}
+
+void Chip8::set_breakpoint(unsigned short addr, bool enabled)
+{
+    if (addr >= MEMORY_SIZE)
+	return;
+    if (enabled)
+	breakpoints[addr >> 3] |= 1 << (addr & 7);
+    else
+	breakpoints[addr >> 3] &= ~(1 << (addr & 7));
+    has_breakpoints = false;
+    for (unsigned int i = 0; i < MEMORY_SIZE / 8; i++)
+	if (breakpoints[i] != 0)
+	    has_breakpoints = true;
+}
+
+void Chip8::clear_breakpoints()
+{
+    memset(breakpoints, 0, sizeof(breakpoints));
+    has_breakpoints = false;
+}
+
+#if defined(__GNUC__)
+
+/* Fetches and decodes the next instruction and jumps to its handler, or
+   returns once n instructions have run. Expanded at the end of every
+   handler so each one has its own indirect branch to predict */
+#define DISPATCH()							\
+    do {								\
+	if (done == n)							\
+	    return done;						\
+	done++;								\
+	cycle++;							\
+	opcode = mem<P>(pc) << 8 | mem<P>(pc + 1);			\
+	vx = &V[(opcode & 0x0F00) >> 8];				\
+	vy = &V[(opcode & 0x00F0) >> 4];				\
+	nnn = opcode & 0x0FFF;						\
+	goto *dispatch[opcode >> 12];					\
+    } while (0)
+
+template <typename P>
+unsigned int Chip8::execute_threaded(unsigned int n)
+{
+    static void *const dispatch[16] = {
+	&&op_0, &&op_1, &&op_2, &&op_3, &&op_4, &&op_5, &&op_6, &&op_7,
+	&&op_8, &&op_9, &&op_A, &&op_B, &&op_C, &&op_D, &&op_E, &&op_F
+    };
+    static void *const dispatch_8[16] = {
+	&&op_8XY0, &&op_8XY1, &&op_8XY2, &&op_8XY3,
+	&&op_8XY4, &&op_8XY5, &&op_8XY6, &&op_8XY7,
+	&&op_unknown, &&op_unknown, &&op_unknown, &&op_unknown,
+	&&op_unknown, &&op_unknown, &&op_8XYE, &&op_unknown
+    };
+    unsigned int done = 0;
+    unsigned char *vx;
+    unsigned char *vy;
+    unsigned short nnn;
+
+    DISPATCH();
+
+op_0:
+    if (opcode == 0x00E0) // 00E0: Clears the screen.
+    {
+	clear_screen();
+	pc += 2;
+    }
+    else if (opcode == 0x00EE) // 00EE: Returns from a subroutine.
+    {
+	if (P::CHECKED && sp == 0)
+	{
+	    report(DIAG_STACK_FAULT);
+	    pc += 2;
+	    DISPATCH();
+	}
+	sp--;
+	pc = stack[sp];
+	pc += 2;
+    }
+    else
+	report(DIAG_MACHINE_CODE_CALL);
+    DISPATCH();
+op_1: // 1NNN: Jumps to address NNN.
+    pc = nnn;
+    DISPATCH();
+op_2: // 2NNN: Calls subroutine at NNN.
+    if (P::CHECKED && sp >= STACK_SIZE)
+    {
+	report(DIAG_STACK_FAULT);
+	pc += 2;
+	DISPATCH();
+    }
+    stack[sp] = pc;
+    sp++;
+    pc = nnn;
+    DISPATCH();
+op_3: // 3XNN: Skips the next instruction if VX equals NN.
+    pc += *vx == (opcode & 0x00FF) ? 4 : 2;
+    DISPATCH();
+op_4: // 4XNN: Skips the next instruction if VX doesn't equal NN.
+    pc += *vx != (opcode & 0x00FF) ? 4 : 2;
+    DISPATCH();
+op_5: // 5XY0: Skips the next instruction if VX equals VY.
+    pc += *vx == *vy ? 4 : 2;
+    DISPATCH();
+op_6: // 6XNN: Sets VX to NN.
+    *vx = opcode & 0x00FF;
+    pc += 2;
+    DISPATCH();
+op_7: // 7XNN: Adds NN to VX.
+    *vx += opcode & 0x00FF;
+    pc += 2;
+    DISPATCH();
+op_8:
+    goto *dispatch_8[opcode & 0x000F];
+op_8XY0: // 8XY0: Sets VX to the value of VY.
+    *vx = *vy;
+    pc += 2;
+    DISPATCH();
+op_8XY1: // 8XY1: Sets VX to VX or VY.
+    *vx = *vx | *vy;
+    pc += 2;
+    DISPATCH();
+op_8XY2: // 8XY2: Sets VX to VX and VY.
+    *vx = *vx & *vy;
+    pc += 2;
+    DISPATCH();
+op_8XY3: // 8XY3: Sets VX to VX xor VY.
+    *vx = *vx ^ *vy;
+    pc += 2;
+    DISPATCH();
+op_8XY4: // 8XY4: Adds VY to VX. VF is set to 1 when there's a carry.
+    V[0xF] = *vy > (0xFF - *vx) ? 1 : 0;
+    *vx += *vy;
+    pc += 2;
+    DISPATCH();
+op_8XY5: // 8XY5: VY is subtracted from VX. VF is set to 0 when there's a borrow.
+    V[0xF] = *vx >= *vy ? 1 : 0;
+    *vx -= *vy;
+    pc += 2;
+    DISPATCH();
+op_8XY6: // 8XY6: Shifts VX (or VY) right by one.
+    V[0xF] = (P::SHIFT_VY ? *vy : *vx) & 0x0001;
+    *vx = (P::SHIFT_VY ? *vy : *vx) >> 1;
+    pc += 2;
+    DISPATCH();
+op_8XY7: // 8XY7: Sets VX to VY minus VX. VF is set to 0 when there's a borrow.
+    V[0xF] = *vy >= *vx ? 1 : 0;
+    *vx = *vy - *vx;
+    pc += 2;
+    DISPATCH();
+op_8XYE: // 8XYE: Shifts VX (or VY) left by one.
+    V[0xF] = ((P::SHIFT_VY ? *vy : *vx) & 0x80) >> 7;
+    *vx = (P::SHIFT_VY ? *vy : *vx) << 1;
+    pc += 2;
+    DISPATCH();
+op_9: // 9XY0: Skips the next instruction if VX doesn't equal VY.
+    pc += *vx != *vy ? 4 : 2;
+    DISPATCH();
+op_A: // ANNN: Sets I to the address NNN.
+    I = nnn;
+    pc += 2;
+    DISPATCH();
+op_B: // BNNN: Jumps to the address NNN plus V0 (or VX).
+    pc = nnn + (P::JUMP_VX ? *vx : V[0x0]);
+    DISPATCH();
+op_C: // CXNN: Sets VX to a random number and NN.
+    *vx = random_byte() & (nnn);
+    pc += 2;
+    DISPATCH();
+op_D: // DXYN: Draws a sprite at coordinate (VX, VY).
+    draw_sprite<P>(*vx, *vy, opcode & 0x000F);
+    pc += 2;
+    DISPATCH();
+op_E:
+    switch (opcode & 0x00FF)
+    {
+    case 0x009E: // EX9E: Skips the next instruction if the key stored in VX is pressed.
+	pc += key[*vx & (P::CHECKED ? 0xF : 0xFF)] == 1 ? 4 : 2;
+	break;
+    case 0x00A1: // EXA1: Skips the next instruction if the key stored in VX isn't pressed.
+	pc += key[*vx & (P::CHECKED ? 0xF : 0xFF)] == 0 ? 4 : 2;
+	break;
+    default:
+	report(DIAG_UNKNOWN_OPCODE);
+    }
+    DISPATCH();
+op_F:
+    switch (opcode & 0x00FF)
+    {
+    case 0x0007: // FX07: Sets VX to the value of the delay timer.
+	*vx = delay_timer;
+	pc += 2;
+	break;
+    case 0x000A: // FX0A: A key press is awaited, and then stored in VX.
+	for (unsigned int i = 0; i < KEYS_SIZE; i++)
+	{
+	    if (key[i] == 1)
+	    {
+		*vx = i;
+		pc += 2;
+	    }
+	}
+	break;
+    case 0x0015: // FX15: Sets the delay timer to VX.
+	delay_timer = *vx;
+	pc += 2;
+	break;
+    case 0x0018: // FX18: Sets the sound timer to VX.
+	sound_timer = *vx;
+	pc += 2;
+	break;
+    case 0x001E: // FX1E: Adds VX to I.
+	V[0xF] = I + *vx > 0xFFF ? 1 : 0;
+	I += *vx;
+	pc += 2;
+	break;
+    case 0x0029: // FX29: Sets I to the location of the sprite for the character in VX.
+	I = *vx * 5;
+	pc += 2;
+	break;
+    case 0x0033: // FX33: Stores the BCD representation of VX at I.
+    {
+	unsigned char value = *vx;
+	unsigned char *m = writable_memory();
+	m[addr<P>(I)] = value / 100;
+	m[addr<P>(I + 1)] = (value / 10) % 10;
+	m[addr<P>(I + 2)] = (value % 100) % 10;
+	pc += 2;
+    }
+    break;
+    case 0x0055: // FX55: Stores V0 to VX in memory starting at address I.
+    {
+	unsigned int x = (opcode & 0x0F00) >> 8;
+	unsigned char *m = writable_memory();
+	for (unsigned int i = 0; i < x + 1; i++)
+	    m[addr<P>(I + i)] = V[i];
+	if (P::LOAD_STORE_INC_I)
+	    I += x + 1;
+	pc += 2;
+    }
+    break;
+    case 0x0065: // FX65: Fills V0 to VX with values from memory starting at address I.
+    {
+	unsigned int x = (opcode & 0x0F00) >> 8;
+	for (unsigned int i = 0; i < x + 1; i++)
+	    V[i] = mem<P>(I + i);
+	if (P::LOAD_STORE_INC_I)
+	    I += x + 1;
+	pc += 2;
+    }
+    break;
+    default:
+	report(DIAG_UNKNOWN_OPCODE);
+    }
+    DISPATCH();
+op_unknown:
+    report(DIAG_UNKNOWN_OPCODE);
+    DISPATCH();
+}
+
+#undef DISPATCH
+
+#else
+
+// no labels as values, fall back to the switch interpreter
+template <typename P>
+unsigned int Chip8::execute_threaded(unsigned int n)
+{
+    return execute_batch<P>(n);
+}
+
+#endif
+
+template unsigned int Chip8::execute<Chip8Policy<QuirksChip8, false> >();
+template unsigned int Chip8::execute<Chip8Policy<QuirksChip8, true> >();
+template unsigned int Chip8::execute<Chip8Policy<QuirksCosmacVip, false> >();
+template unsigned int Chip8::execute<Chip8Policy<QuirksCosmacVip, true> >();
+template unsigned int Chip8::execute<Chip8Policy<QuirksSuperChip, false> >();
+template unsigned int Chip8::execute<Chip8Policy<QuirksSuperChip, true> >();
+template unsigned int Chip8::execute_batch<Chip8Policy<QuirksChip8, false> >(unsigned int);
+template unsigned int Chip8::execute_threaded<Chip8Policy<QuirksChip8, false> >(unsigned int);
+template Chip8::RunResult Chip8::execute_until<Chip8Policy<QuirksChip8, false> >(unsigned int);
+
+// used by AOT compiled ROMs
+template void Chip8::draw_sprite<Chip8Policy<QuirksChip8, false> >(unsigned int, unsigned int, unsigned int);
+template void Chip8::draw_sprite<Chip8Policy<QuirksCosmacVip, false> >(unsigned int, unsigned int, unsigned int);
+template void Chip8::draw_sprite<Chip8Policy<QuirksSuperChip, false> >(unsigned int, unsigned int, unsigned int);
+
 void Chip8::emulate_hardware()
 {
+    if (tracer != nullptr)
+	tracer->frame();
+
     if (delay_timer > 0)
 	delay_timer--;
 
@@ -350,55 +1046,62 @@ void Chip8::emulate_hardware()
 	sound_timer--;
 }
 
-void Chip8::debug_dump_mem()
+Chip8::Registers Chip8::get_registers() const
 {
-    unsigned char *buf = (unsigned char*)&memory;
-    int i, j;
-    for (i=0; i<MEMORY_SIZE; i+=16) {
-	printf("%06x: ", i);
-	for (j=0; j<16; j++) 
-	    if (i+j < MEMORY_SIZE)
-		printf("%02x ", buf[i+j]);
-	    else
-		printf("   ");
-	printf(" ");
-	for (j=0; j<16; j++) 
-	    if (i+j < MEMORY_SIZE)
-		printf("%c", isprint(buf[i+j]) ? buf[i+j] : '.');
-	printf("\n");
-    }
-    printf("\n");
+    Registers regs;
+    memcpy(regs.V, V, sizeof(V));
+    regs.I = I;
+    regs.pc = pc;
+    memcpy(regs.stack, stack, sizeof(stack));
+    regs.sp = sp;
+    regs.delay_timer = delay_timer;
+    regs.sound_timer = sound_timer;
+    regs.opcode = opcode;
+    regs.cycle = cycle;
+    regs.rand_state = rand_state;
+    return regs;
 }
 
-void Chip8::debug_dump_reg()
+void Chip8::report(DiagType type, unsigned int value)
 {
-    printf("Keys: \t\t");
-    for (int i = 0; i < KEYS_SIZE; i++)
-	printf("%u", key[i]);
-    printf("\n");
-
-    printf("Delay timer: \t%u\n", delay_timer);
-    printf("Sound timer: \t%u\n", sound_timer);
-    printf("Opcode: \t%04x\n", opcode);
-    printf("I: \t\t%04x\n", I);
-    printf("pc: \t\t%04x\n", pc);
-
-    printf("VReg: \t\t");
-    for (int i  = 0; i < VREG_SIZE / 2; i++)
-	printf("V%X: %02x  ", i, V[i]);
-    printf("\n\t\t");
-    for (int i  = VREG_SIZE / 2; i < VREG_SIZE; i++)
-	printf("V%X: %02x  ", i, V[i]);
-    printf("\n");
-    printf("sp: \t\t%02x\n", sp);
-
-    printf("stack: \t\t");
-    for (int i  = 0; i < STACK_SIZE / 2; i++)
-	printf("%04x ", stack[i]);
-    printf("\n\t\t");
-    for (int i  = STACK_SIZE / 2; i < STACK_SIZE; i++)
-	printf("%04x ", stack[i]);
-    printf("\n");
-    
-    printf("\n");
+    if (diag != nullptr)
+	diag->report(type, opcode, pc, cycle, value);
+}
+
+void Chip8::set_registers(const Registers &regs)
+{
+    memcpy(V, regs.V, sizeof(V));
+    I = regs.I;
+    pc = regs.pc;
+    memcpy(stack, regs.stack, sizeof(stack));
+    // pc and I are masked on every access by the checked interpreters,
+    // sp indexes the stack directly and must stay within it
+    sp = regs.sp <= STACK_SIZE ? regs.sp : STACK_SIZE;
+    delay_timer = regs.delay_timer;
+    sound_timer = regs.sound_timer;
+    opcode = regs.opcode;
+    cycle = regs.cycle;
+    rand_state = regs.rand_state;
+}
+
+void Chip8::load_memory(const unsigned char *image)
+{
+    // keep sharing the page if nothing changes
+    if (memcmp(memory, image, MEMORY_SIZE) != 0)
+	memcpy(writable_memory(), image, MEMORY_SIZE);
+}
+
+void Chip8::load_display(const unsigned char display[][VIDEO_HEIGHT])
+{
+    if (memcmp(gfx, display, VIDEO_WIDTH * VIDEO_HEIGHT) != 0)
+    {
+	memcpy(framebuffer(), display, VIDEO_WIDTH * VIDEO_HEIGHT);
+	for (unsigned int y = 0; y < VIDEO_HEIGHT; y++)
+	{
+	    display_rows[y] = 0;
+	    for (unsigned int x = 0; x < VIDEO_WIDTH; x++)
+		display_rows[y] |= (uint64_t)(display[x][y] != 0) << x;
+	}
+	dirty_rows = ~0U;
+    }
 }
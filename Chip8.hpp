@@ -1,11 +1,112 @@
 #ifndef __Chip8_H__
 #define __Chip8_H__
 
-#include <iostream>
+#include <stdint.h>
+
+#include "SharedPage.hpp"
+
+class Diagnostics;
+enum DiagType : unsigned int;
+class TraceBuffer;
+struct TraceState;
+
+/* Quirk sets. Each field selects, at compile time, one of the behaviours
+   that different CHIP-8 interpreters gave to the same opcode */
+
+// The behaviour this emulator always had
+struct QuirksChip8
+{
+    static const bool SHIFT_VY = false;         // 8XY6/8XYE: VX = VY >> 1 / VY << 1
+    static const bool LOAD_STORE_INC_I = false; // FX55/FX65: I = I + X + 1 afterwards
+    static const bool JUMP_VX = false;          // BNNN: jump to NNN + VX instead of V0
+    static const bool CLIP_SPRITES = false;     // DXYN: clip at the edges instead of wrapping
+};
+
+// The original COSMAC VIP interpreter
+struct QuirksCosmacVip
+{
+    static const bool SHIFT_VY = true;
+    static const bool LOAD_STORE_INC_I = true;
+    static const bool JUMP_VX = false;
+    static const bool CLIP_SPRITES = true;
+};
+
+// CHIP-48 and SUPER-CHIP
+struct QuirksSuperChip
+{
+    static const bool SHIFT_VY = false;
+    static const bool LOAD_STORE_INC_I = false;
+    static const bool JUMP_VX = true;
+    static const bool CLIP_SPRITES = true;
+};
+
+/* Execution policy: a quirk set plus checked or unchecked memory access.
+   Checked policies wrap every memory address to 12 bits and report
+   stack overflows/underflows instead of corrupting the machine; use them
+   for ROMs that are not trusted */
+template <typename Quirks, bool Checked>
+struct Chip8Policy : Quirks
+{
+    static const bool CHECKED = Checked;
+    static const bool TRACE = false;
+    typedef Chip8Policy Untraced;
+};
+
+/* Policy P with every instruction recorded to the machine's
+   TraceBuffer. Only selected while one is attached, so untraced runs
+   pay nothing for it */
+template <typename P>
+struct Traced : P
+{
+    static const bool TRACE = true;
+    typedef P Untraced;
+};
 
 class Chip8
 {
+    // code generated by chip8_aot runs directly on the CPU state
+    friend struct Chip8Aot;
+
 public:
+    enum Profile
+    {
+	PROFILE_AUTO,   // picked by detect_profile() when a ROM is loaded
+	PROFILE_CHIP8,
+	PROFILE_COSMAC_VIP,
+	PROFILE_SUPER_CHIP
+    };
+
+    enum Engine
+    {
+	ENGINE_SWITCH,   // decode with a switch, one call per instruction
+	ENGINE_THREADED  // direct threaded, computed goto between handlers
+    };
+
+    /* Why run_cycles() or run_frame() returned */
+    enum StopReason
+    {
+	STOP_DONE,        // ran every cycle asked for
+	STOP_FRAME_DRAWN, // DXYN or 00E0 just ran
+	STOP_KEY_WAIT,    // FX0A is waiting for a key
+	STOP_SOUND,       // the sound timer was just changed
+	STOP_BREAKPOINT   // pc is at a breakpoint, not executed yet
+    };
+
+    // events run_cycles() and run_frame() stop on, see set_stop_events()
+    static const unsigned int EVENT_FRAME_DRAWN = 1 << STOP_FRAME_DRAWN;
+    static const unsigned int EVENT_KEY_WAIT = 1 << STOP_KEY_WAIT;
+    static const unsigned int EVENT_SOUND = 1 << STOP_SOUND;
+    static const unsigned int EVENT_BREAKPOINT = 1 << STOP_BREAKPOINT;
+    static const unsigned int EVENT_ALL = EVENT_FRAME_DRAWN | EVENT_KEY_WAIT |
+	EVENT_SOUND | EVENT_BREAKPOINT;
+
+    struct RunResult
+    {
+	StopReason reason;
+	unsigned int cycles;  // instructions executed
+	bool frame_end;       // run_frame(): the frame is over
+    };
+
     static const unsigned int VIDEO_WIDTH = 64;
     static const unsigned int VIDEO_HEIGHT = 32;
     static const unsigned int KEYS_SIZE = 16;
@@ -16,8 +117,26 @@ public:
 
     static const unsigned int MAX_ROM_SIZE = MEMORY_SIZE - PROGRAM_START;
 
+    /* CPU state other than memory and display, for saving and restoring
+       a machine */
+    struct Registers
+    {
+	unsigned char V[VREG_SIZE];
+	unsigned short I;
+	unsigned short pc;
+	unsigned short stack[STACK_SIZE];
+	unsigned char sp;
+	unsigned char delay_timer;
+	unsigned char sound_timer;
+	unsigned short opcode;
+	unsigned long long cycle;
+	unsigned int rand_state;
+    };
+
     // hardware
-    unsigned char gfx[VIDEO_WIDTH][VIDEO_HEIGHT];
+    // display, gfx[x][y] is 1 if the pixel is on. Read only: it points
+    // into a framebuffer that may be shared with forked instances
+    const unsigned char (*gfx)[VIDEO_HEIGHT];
     unsigned char key[KEYS_SIZE];
     unsigned char delay_timer;
     unsigned char sound_timer;
@@ -25,64 +144,310 @@ public:
 private:
     // CPU
     unsigned short opcode;
-    unsigned char memory[MEMORY_SIZE];
+    // memory and framebuffer are shared copy-on-write between forked
+    // instances, and the initial memory image (font and ROM) between all
+    // instances that loaded the same ROM. memory is the read view of
+    // memory_page, writes go through writable_memory()
+    PageRef memory_page;
+    PageRef gfx_page;
+    const unsigned char *memory;
     unsigned char V[VREG_SIZE];
     unsigned short I;
     unsigned short pc;
     unsigned short stack[STACK_SIZE];
     unsigned char sp;
 
-    // charset needed for opcode FX29
-    unsigned char chip8_fontset[80] =
-    { 
-	0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
-	0x20, 0x60, 0x20, 0x20, 0x70, // 1
-	0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
-	0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
-	0x90, 0x90, 0xF0, 0x10, 0x10, // 4
-	0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
-	0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
-	0xF0, 0x10, 0x20, 0x40, 0x40, // 7
-	0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
-	0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
-	0xF0, 0x90, 0xF0, 0x90, 0x90, // A
-	0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
-	0xF0, 0x80, 0x80, 0x80, 0xF0, // C
-	0xE0, 0x90, 0x90, 0x90, 0xE0, // D
-	0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
-	0xF0, 0x80, 0xF0, 0x80, 0x80  // F
-    };
+    // CXNN random number generator, per machine so that machines on
+    // different threads stay deterministic
+    unsigned int rand_state;
+    unsigned int rom_size = 0;
+    // memory image of the last ROM loaded, for restart(), and the
+    // profile detected from it: PROFILE_AUTO until a PROFILE_AUTO
+    // machine needs it
+    PageRef rom_image;
+    unsigned int rom_image_size = 0;
+    Profile rom_profile = PROFILE_AUTO;
+
+    unsigned long long cycle;
+    // display rows written since take_dirty_rows(), bit y for row y
+    unsigned int dirty_rows = ~0U;
+    // the display packed one word per row, see get_display_rows()
+    uint64_t display_rows[VIDEO_HEIGHT];
+    Diagnostics *diag = nullptr;
+    TraceBuffer *tracer = nullptr;
+
+    /* Next CXNN random byte (xorshift32) */
+    unsigned char random_byte()
+    {
+	rand_state ^= rand_state << 13;
+	rand_state ^= rand_state >> 17;
+	rand_state ^= rand_state << 5;
+	return rand_state >> 24;
+    }
+
+    /* Unshares memory before a write */
+    unsigned char *writable_memory()
+    {
+	unsigned char *data = memory_page.own();
+	memory = data;
+	return data;
+    }
+
+    /* Unshares the framebuffer before a write */
+    unsigned char (*framebuffer())[VIDEO_HEIGHT]
+    {
+	unsigned char (*data)[VIDEO_HEIGHT] =
+	    (unsigned char (*)[VIDEO_HEIGHT])gfx_page.own();
+	gfx = data;
+	return data;
+    }
+
+    // run_frame() and run_cycles() state
+    unsigned int instructions_per_second = 400;
+    unsigned int frames_per_second = 60;
+    unsigned int frame_budget = 0;     // instructions owed, in 1 / fps units
+    unsigned int frame_remaining = 0;  // instructions left in this frame
+    unsigned int stop_events = EVENT_ALL;
+    const unsigned short *idle_loops = nullptr;  // see set_idle_loops()
+    unsigned int idle_count = 0;
+    bool has_breakpoints = false;
+    unsigned char breakpoints[MEMORY_SIZE / 8];
+
+    bool is_breakpoint(unsigned int addr) const
+    {
+	return has_breakpoints && addr < MEMORY_SIZE &&
+	    (breakpoints[addr >> 3] & (1 << (addr & 7)));
+    }
+
+    void report(DiagType type, unsigned int value = 0);
+    RunResult skip_idle_iterations();
 
-    unsigned char rand_state;
-    std::string rom_path;
+    // profile requested by set_profile() and the instruction
+    // interpreter instantiated for the one in use
+    Profile profile = PROFILE_AUTO;
+    Profile active_profile = PROFILE_CHIP8;
+    bool checked = false;
+    Engine engine = ENGINE_SWITCH;
+    unsigned int (Chip8::*step)() =
+	&Chip8::execute<Chip8Policy<QuirksChip8, false> >;
+    unsigned int (Chip8::*batch)(unsigned int) =
+	&Chip8::execute_batch<Chip8Policy<QuirksChip8, false> >;
+    RunResult (Chip8::*until)(unsigned int) =
+	&Chip8::execute_until<Chip8Policy<QuirksChip8, false> >;
+
+    /* Points step, batch and until at the interpreters for profile, checked
+       and engine */
+    void select_step();
+
+    template <typename P>
+    void use_policy();
+
+    /* Memory address under policy P */
+    template <typename P>
+    static unsigned int addr(unsigned int a)
+    {
+	return P::CHECKED ? a & (MEMORY_SIZE - 1) : a;
+    }
+
+    /* Memory read under policy P */
+    template <typename P>
+    unsigned char mem(unsigned int a) const
+    {
+	return memory[addr<P>(a)];
+    }
+
+    /* Interpreter for one instruction, specialized for policy P */
+    template <typename P>
+    unsigned int execute();
+
+    /* execute<P>() wrapped in a TraceBuffer::record() */
+    template <typename P>
+    unsigned int execute_traced();
+
+    /* One instruction under policy P, traced if P is */
+    template <typename P>
+    unsigned int execute_one()
+    {
+	return P::TRACE ? execute_traced<P>() : execute<typename P::Untraced>();
+    }
+
+    void trace_state(TraceState &state) const;
+
+    /* Runs n instructions by calling execute_one<P>() */
+    template <typename P>
+    unsigned int execute_batch(unsigned int n);
+
+    /* Runs up to n instructions, stopping early on stop_events */
+    template <typename P>
+    RunResult execute_until(unsigned int n);
+
+    /* Runs n instructions with direct threaded dispatch: every handler
+       jumps straight to the handler of the next instruction through a
+       table of label addresses. Results are identical to execute<P>() */
+    template <typename P>
+    unsigned int execute_threaded(unsigned int n);
+
+    /* Draws an 8xN sprite for DXYN under policy P */
+    template <typename P>
+    void draw_sprite(unsigned int x, unsigned int y, unsigned int height);
 
 public:
 
-    //Chip8();
-    //virtual ~Chip8();
+    /* Creates a machine with the font loaded and nothing else. Does not
+       allocate: memory and display start out shared with a blank image */
+    Chip8();
+
+    /* Copy of this machine that shares memory and display copy-on-write,
+       so only the registers are copied until either side writes. The
+       fork does not report to the diagnostics channel */
+    Chip8 fork() const;
 
     void clear_screen();
     
-    /* Sets rand_state and rom_path, calls reset() and load_rom()
-       to initialize the machine. Returns 0 upon succes or 1 otherwise */
-    int initialize(unsigned char start_time, std::string rom_path);
+    /* Seeds the CXNN random number generator */
+    void set_seed(unsigned int seed);
+
+    /* Sets rand_state, calls reset() and load_rom(rom_path) to
+       initialize the machine. Returns 0 upon succes or 1 otherwise.
+       Defined in Chip8File.cpp */
+    int initialize(unsigned char start_time, const char *rom_path);
 
     /* Initializes all the registers and memory to 0
        Sets pc to 0x200 where the program will be loaded */
     void reset();
 
-    /* Loads the rom from rom_path at position 0x200 of memory
+    /* Loads the rom from the file rom_path at position 0x200 of memory
+       Returns 0 upon succes or 1 otherwise. Defined in Chip8File.cpp */
+    int load_rom(const char *rom_path);
+
+    /* Loads size bytes of rom at position 0x200 of memory
        Returns 0 upon succes or 1 otherwise */
-    int load_rom();
+    int load_rom(const unsigned char *rom, unsigned int size);
+
+    /* reset() followed by loading the last ROM loaded again, from the
+       memory image kept since, not from its file */
+    void restart();
 
     /* Fetches, decodes and runs instruction from memory at pc
        Returns the number of cycles spent */
-    unsigned int run_instruction();
+    unsigned int run_instruction() { return (this->*step)(); }
+
+    /* Runs n instructions with the selected engine
+       Returns the number of cycles spent */
+    unsigned int run_instructions(unsigned int n) { return (this->*batch)(n); }
+
+    /* Runs up to n instructions in one call into the core and returns
+       early after an instruction that causes one of the events selected
+       with set_stop_events(), or before one at a breakpoint. The first
+       instruction always runs, so calling it again resumes from a
+       breakpoint */
+    RunResult run_cycles(unsigned int n) { return (this->*until)(n); }
+
+    /* Runs one frame: ticks the timers, then runs the instructions the
+       frame gets at the speed set with set_speed(). If an event stops it
+       early the frame is not over (frame_end is false) and the next call
+       carries on with it. A key wait ends the frame: without new input
+       the rest of it would only repeat FX0A, so its cycles are counted
+       without running them */
+    RunResult run_frame();
+
+    /* Instructions per second and frames per second for run_frame() */
+    void set_speed(unsigned int instructions_per_second,
+		   unsigned int frames_per_second);
+
+    /* Events that make run_cycles() and run_frame() stop early, a mask
+       of EVENT_ values. Default: EVENT_ALL */
+    void set_stop_events(unsigned int events) { stop_events = events; }
+    unsigned int get_stop_events() const { return stop_events; }
+
+    /* Addresses of the loops that only wait in the loaded ROM, sorted,
+       as found by RomAnalysis. A frame run_frame() starts in one runs a
+       single iteration and counts the cycles of the rest without running
+       them: timers and keys only change between frames, so they would
+       all do the same. Not used with a tracer or breakpoints. loops is
+       borrowed and must outlive the machine and its forks; load_rom()
+       forgets it */
+    void set_idle_loops(const unsigned short *loops, unsigned int count)
+    {
+	idle_loops = loops;
+	idle_count = loops != nullptr ? count : 0;
+    }
+
+    void set_breakpoint(unsigned short addr, bool enabled = true);
+    void clear_breakpoints();
+
+    /* Selects the interpreter run_instructions() uses */
+    void set_engine(Engine engine);
+    Engine get_engine() const { return engine; }
+
+    /* Selects the quirks and memory checks the interpreter runs with.
+       PROFILE_AUTO uses the ones detected from the ROM loaded, once
+       per ROM */
+    void set_profile(Profile profile, bool checked = false);
+    Profile get_profile() const { return active_profile; }
+    bool is_checked() const { return checked; }
+
+    /* Guesses the profile of the ROM of size bytes loaded in memory
+       (MEMORY_SIZE bytes). ROMs whose code, as far as RomAnalysis can
+       follow it from PROGRAM_START, uses SUPER-CHIP only opcodes get
+       PROFILE_SUPER_CHIP, everything else PROFILE_CHIP8. Data is never
+       looked at, so sprites cannot pass for opcodes */
+    static Profile detect_profile(const unsigned char *memory, unsigned int size);
+
+    /* Profile called name on the command line and in manifests: "auto",
+       "chip8", "vip" or "schip". Returns 0 upon success or 1 if name is
+       none of them */
+    static int profile_from_name(const char *name, Profile &profile);
+    static const char *profile_name(Profile profile);
 
     /* Emulates the internal hardware (timers) */
     void emulate_hardware();
 
-    // debug functions
+    // CPU state accessors
+
+    const unsigned char *get_V() const { return V; }
+    unsigned short get_I() const { return I; }
+    unsigned short get_pc() const { return pc; }
+    unsigned char get_sp() const { return sp; }
+    unsigned long long get_cycle() const { return cycle; }
+    const unsigned char *get_memory() const { return memory; }
+    unsigned int get_rom_size() const { return rom_size; }
+
+    // state save and restore
+
+    Registers get_registers() const;
+    void set_registers(const Registers &regs);
+
+    /* Replaces memory with the MEMORY_SIZE bytes at image */
+    void load_memory(const unsigned char *image);
+
+    /* Replaces the display */
+    void load_display(const unsigned char display[][VIDEO_HEIGHT]);
+
+    /* The display packed one word per row, bit x of row y set if pixel
+       (x, y) is on. Kept up to date as the display is drawn, so that
+       consumers never walk gfx */
+    const uint64_t *get_display_rows() const { return display_rows; }
+
+    /* Display rows that may have changed since the previous call, bit y
+       set for row y, so that consumers only look at those */
+    unsigned int take_dirty_rows()
+    {
+	unsigned int rows = dirty_rows;
+	dirty_rows = 0;
+	return rows;
+    }
+
+    /* Sets the channel unknown opcodes and load errors are reported to.
+       Without one they are silently ignored */
+    void set_diagnostics(Diagnostics *diag) { Chip8::diag = diag; }
+
+    /* Records every instruction to tracer from now on, or stops
+       recording if it is nullptr. Tracing runs one instruction at a time
+       through the switch interpreter whatever the engine */
+    void set_tracer(TraceBuffer *tracer);
+
+    // debug functions, defined in Chip8File.cpp
 
     /* Dumps the current state of memory to stdout */
     void debug_dump_mem();
@@ -0,0 +1,48 @@
+#include "Chip8Aot.hpp"
+
+static const unsigned int MAX_AOT_ROMS = 64;
+
+// filled by static initializers, so plain arrays that are zero before
+// any constructor runs
+static const Chip8AotEntry *aot_roms[MAX_AOT_ROMS];
+static unsigned int aot_rom_count;
+
+unsigned int rom_hash(const unsigned char *rom, unsigned int size)
+{
+    unsigned int hash = 2166136261u;
+    for (unsigned int i = 0; i < size; i++)
+    {
+	hash ^= rom[i];
+	hash *= 16777619u;
+    }
+    return hash;
+}
+
+void chip8_aot_register(const Chip8AotEntry *entry)
+{
+    if (aot_rom_count < MAX_AOT_ROMS)
+	aot_roms[aot_rom_count++] = entry;
+}
+
+const Chip8AotEntry *chip8_aot_find(const Chip8 &chip8)
+{
+    if (aot_rom_count == 0 || chip8.is_checked())
+	return nullptr;
+
+    unsigned int size = chip8.get_rom_size();
+    unsigned int hash = 0;
+    bool hashed = false;
+    for (unsigned int i = 0; i < aot_rom_count; i++)
+    {
+	if (aot_roms[i]->size != size || aot_roms[i]->profile != chip8.get_profile())
+	    continue;
+	if (!hashed)
+	{
+	    hash = rom_hash(chip8.get_memory() + Chip8::PROGRAM_START, size);
+	    hashed = true;
+	}
+	if (aot_roms[i]->hash == hash)
+	    return aot_roms[i];
+    }
+    return nullptr;
+}
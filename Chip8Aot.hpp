@@ -0,0 +1,53 @@
+#ifndef __Chip8Aot_H__
+#define __Chip8Aot_H__
+
+#include "Chip8.hpp"
+
+/* Runs instructions natively for an ahead-of-time compiled ROM.
+   Executes exactly instructions instructions, like calling
+   run_instruction() that many times */
+typedef void (*Chip8AotRun)(Chip8 &chip8, unsigned int instructions);
+
+struct Chip8AotEntry
+{
+    unsigned int hash;   // rom_hash() of the ROM it was compiled from
+    unsigned int size;
+    Chip8::Profile profile;
+    Chip8AotRun run;
+};
+
+/* Access to the CPU state for code generated by chip8_aot. Generated
+   code runs unchecked: it is only used for the ROM and the unchecked
+   profile it was compiled for */
+struct Chip8Aot
+{
+    static unsigned char *V(Chip8 &c) { return c.V; }
+    static unsigned short &I(Chip8 &c) { return c.I; }
+    static unsigned short &pc(Chip8 &c) { return c.pc; }
+    static unsigned char &sp(Chip8 &c) { return c.sp; }
+    static unsigned short *stack(Chip8 &c) { return c.stack; }
+    static const unsigned char *mem(Chip8 &c) { return c.memory; }
+    static unsigned char *wmem(Chip8 &c) { return c.writable_memory(); }
+    static unsigned short &opcode(Chip8 &c) { return c.opcode; }
+    static unsigned long long &cycle(Chip8 &c) { return c.cycle; }
+    static unsigned char random(Chip8 &c) { return c.random_byte(); }
+
+    template <typename P>
+    static void draw(Chip8 &c, unsigned int x, unsigned int y, unsigned int n)
+    {
+	c.draw_sprite<P>(x, y, n);
+    }
+};
+
+/* FNV-1a hash identifying a ROM image */
+unsigned int rom_hash(const unsigned char *rom, unsigned int size);
+
+/* Makes a compiled ROM available to chip8_aot_find(). Generated code
+   calls it from a static initializer */
+void chip8_aot_register(const Chip8AotEntry *entry);
+
+/* Compiled code for the ROM loaded in chip8 under its current profile,
+   or nullptr if none was linked in */
+const Chip8AotEntry *chip8_aot_find(const Chip8 &chip8);
+
+#endif /* defined(__Chip8Aot_H__) */
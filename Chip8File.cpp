@@ -0,0 +1,99 @@
+#include "Chip8.hpp"
+#include "Diagnostics.hpp"
+#include <fstream>
+#include <ctype.h> // Requiered for debug_dump_mem
+#include <stdio.h> // Requiered for debug_dump_mem
+
+/* The parts of Chip8 that use the filesystem or the console, kept out
+   of Chip8.cpp so that the core (and libchip8) does neither */
+
+int Chip8::initialize(unsigned char start_time, const char *rom_path)
+{
+    reset();
+    set_seed(start_time);
+
+    if (load_rom(rom_path))
+	return 1;
+    return 0;
+}
+
+int Chip8::load_rom(const char *rom_path)
+{
+    std::streampos size;
+
+    std::ifstream file(rom_path, std::ios::in|std::ios::binary|std::ios::ate);
+    if (file.is_open())
+    {
+	size = file.tellg();
+	if (size > MAX_ROM_SIZE)
+	{
+	    report(DIAG_ROM_TOO_BIG, size);
+	    return 1;
+	}
+	unsigned char rom[MAX_ROM_SIZE];
+	file.seekg(0, std::ios::beg);
+	file.read((char*)rom, size);
+	file.close();
+	return load_rom(rom, size);
+    }
+    else
+    {
+	report(DIAG_ROM_OPEN_FAILED);
+	return 1;
+    }
+    return 0;
+
+}
+
+void Chip8::debug_dump_mem()
+{
+    const unsigned char *buf = memory;
+    int i, j;
+    for (i=0; i<MEMORY_SIZE; i+=16) {
+	printf("%06x: ", i);
+	for (j=0; j<16; j++) 
+	    if (i+j < MEMORY_SIZE)
+		printf("%02x ", buf[i+j]);
+	    else
+		printf("   ");
+	printf(" ");
+	for (j=0; j<16; j++) 
+	    if (i+j < MEMORY_SIZE)
+		printf("%c", isprint(buf[i+j]) ? buf[i+j] : '.');
+	printf("\n");
+    }
+    printf("\n");
+}
+
+void Chip8::debug_dump_reg()
+{
+    printf("Keys: \t\t");
+    for (int i = 0; i < KEYS_SIZE; i++)
+	printf("%u", key[i]);
+    printf("\n");
+
+    printf("Delay timer: \t%u\n", delay_timer);
+    printf("Sound timer: \t%u\n", sound_timer);
+    printf("Opcode: \t%04x\n", opcode);
+    printf("I: \t\t%04x\n", I);
+    printf("pc: \t\t%04x\n", pc);
+
+    printf("VReg: \t\t");
+    for (int i  = 0; i < VREG_SIZE / 2; i++)
+	printf("V%X: %02x  ", i, V[i]);
+    printf("\n\t\t");
+    for (int i  = VREG_SIZE / 2; i < VREG_SIZE; i++)
+	printf("V%X: %02x  ", i, V[i]);
+    printf("\n");
+    printf("sp: \t\t%02x\n", sp);
+
+    printf("stack: \t\t");
+    for (int i  = 0; i < STACK_SIZE / 2; i++)
+	printf("%04x ", stack[i]);
+    printf("\n\t\t");
+    for (int i  = STACK_SIZE / 2; i < STACK_SIZE; i++)
+	printf("%04x ", stack[i]);
+    printf("\n");
+    
+    printf("\n");
+}
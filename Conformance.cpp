@@ -0,0 +1,265 @@
+#include "Conformance.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+static const unsigned char GOLDEN_VERSION = 1;
+
+static unsigned long long mix(unsigned long long x)
+{
+    // splitmix64 finalizer
+    x ^= x >> 30;
+    x *= 0xBF58476D1CE4E5B9ULL;
+    x ^= x >> 27;
+    x *= 0x94D049BB133111EBULL;
+    return x ^ x >> 31;
+}
+
+FrameHasher::FrameHasher()
+    : display(0)
+{
+    memset(rows, 0, sizeof(rows));
+}
+
+unsigned long long FrameHasher::update(Chip8 &chip8)
+{
+    unsigned int dirty = chip8.take_dirty_rows();
+    for (unsigned int y = 0; dirty != 0 && y < Chip8::VIDEO_HEIGHT; y++, dirty >>= 1)
+    {
+	if (!(dirty & 1))
+	    continue;
+	unsigned long long bits = chip8.get_display_rows()[y];
+	// the display hash is a sum of row hashes, so a row is swapped
+	// out without touching the others
+	unsigned long long row = mix(bits + mix(y + 1));
+	display += row - rows[y];
+	rows[y] = row;
+    }
+    return display;
+}
+
+static unsigned long long hash_bytes(const unsigned char *data, unsigned int size,
+				     unsigned long long hash)
+{
+    for (unsigned int i = 0; i < size; i++)
+	hash = (hash ^ data[i]) * 0x100000001B3ULL;
+    return hash;
+}
+
+int run_case(const ConformanceCase &test, Chip8::Engine engine, bool checked,
+	     std::vector<GoldenFrame> &frames)
+{
+    Chip8 chip8;
+    if (chip8.initialize(0, test.rom.c_str()))
+	return 1;
+    chip8.set_seed(test.seed);
+    chip8.set_profile(test.profile, checked);
+    chip8.set_engine(engine);
+    chip8.set_speed(test.freq, 60);
+
+    FrameHasher hasher;
+    unsigned long long rolling = 0;
+    unsigned int next_keys = 0;
+    frames.clear();
+    frames.reserve(test.frames);
+    for (unsigned int frame = 0; frame < test.frames; frame++)
+    {
+	while (next_keys < test.keys.size() && test.keys[next_keys].first <= frame)
+	{
+	    for (unsigned int i = 0; i < Chip8::KEYS_SIZE; i++)
+		chip8.key[i] = (test.keys[next_keys].second >> i) & 1;
+	    next_keys++;
+	}
+
+	Chip8::RunResult result;
+	do
+	    result = chip8.run_frame();
+	while (!result.frame_end);
+
+	unsigned long long hash = hasher.update(chip8);
+	hash = hash_bytes(chip8.get_V(), Chip8::VREG_SIZE, hash);
+	unsigned char index[2] = {(unsigned char)(chip8.get_I() & 0xFF),
+				  (unsigned char)(chip8.get_I() >> 8)};
+	hash = hash_bytes(index, sizeof(index), hash);
+	for (const std::pair<unsigned short, unsigned short> &range : test.ram)
+	    hash = hash_bytes(chip8.get_memory() + range.first,
+			      range.second - range.first + 1, hash);
+	rolling = mix(rolling ^ hash);
+
+	GoldenFrame golden = {rolling, chip8.get_pc()};
+	frames.push_back(golden);
+    }
+    return 0;
+}
+
+/* Reads one "key=value" option of a manifest line into test */
+static bool parse_option(const std::string &option, ConformanceCase &test)
+{
+    size_t eq = option.find('=');
+    if (eq == std::string::npos)
+	return false;
+    std::string key = option.substr(0, eq);
+    const char *value = option.c_str() + eq + 1;
+    char *end;
+    if (key == "name")
+	test.name = value;
+    else if (key == "profile")
+    {
+	if (Chip8::profile_from_name(value, test.profile))
+	    return false;
+    }
+    else if (key == "seed")
+	test.seed = strtoul(value, nullptr, 0);
+    else if (key == "freq")
+	test.freq = strtoul(value, nullptr, 0);
+    else if (key == "ram")
+    {
+	unsigned long first = strtoul(value, &end, 0);
+	if (*end != '-')
+	    return false;
+	unsigned long last = strtoul(end + 1, &end, 0);
+	if (*end != '\0' || first > last || last >= Chip8::MEMORY_SIZE)
+	    return false;
+	test.ram.push_back(std::make_pair(first, last));
+    }
+    else if (key == "keys")
+    {
+	while (*value != '\0')
+	{
+	    unsigned long frame = strtoul(value, &end, 0);
+	    if (*end != ':')
+		return false;
+	    unsigned long mask = strtoul(end + 1, &end, 16);
+	    if (*end != ',' && *end != '\0')
+		return false;
+	    if (!test.keys.empty() && frame < test.keys.back().first)
+		return false;
+	    test.keys.push_back(std::make_pair(frame, mask));
+	    value = *end == ',' ? end + 1 : end;
+	}
+    }
+    else
+	return false;
+    return true;
+}
+
+int parse_manifest(const std::string &path, std::vector<ConformanceCase> &cases,
+		   std::string &error)
+{
+    std::ifstream file(path);
+    if (!file)
+    {
+	error = "unable to read " + path;
+	return 1;
+    }
+    // ROM paths are relative to the manifest
+    std::string dir;
+    size_t slash = path.rfind('/');
+    if (slash != std::string::npos)
+	dir = path.substr(0, slash + 1);
+
+    std::string line;
+    while (std::getline(file, line))
+    {
+	size_t hash = line.find('#');
+	if (hash != std::string::npos)
+	    line.erase(hash);
+	std::istringstream fields(line);
+	ConformanceCase test;
+	if (!(fields >> test.rom))
+	    continue;
+	if (!(fields >> test.frames))
+	{
+	    error = line;
+	    return 1;
+	}
+	size_t base = test.rom.rfind('/');
+	test.name = test.rom.substr(base == std::string::npos ? 0 : base + 1);
+	if (test.rom[0] != '/')
+	    test.rom = dir + test.rom;
+	test.profile = Chip8::PROFILE_AUTO;
+	test.seed = 0;
+	test.freq = 400;
+	std::string option;
+	while (fields >> option)
+	    if (!parse_option(option, test))
+	    {
+		error = line;
+		return 1;
+	    }
+	cases.push_back(test);
+    }
+    return 0;
+}
+
+static void put_le(unsigned char *p, unsigned long long value, unsigned int size)
+{
+    for (unsigned int i = 0; i < size; i++)
+	p[i] = value >> (8 * i);
+}
+
+static unsigned long long get_le(const unsigned char *p, unsigned int size)
+{
+    unsigned long long value = 0;
+    for (unsigned int i = 0; i < size; i++)
+	value |= (unsigned long long)p[i] << (8 * i);
+    return value;
+}
+
+int save_golden(const std::string &path, const std::vector<GoldenFrame> &frames)
+{
+    std::vector<unsigned char> data(9 + frames.size() * 10);
+    memcpy(&data[0], "C8GH", 4);
+    data[4] = GOLDEN_VERSION;
+    put_le(&data[5], frames.size(), 4);
+    for (unsigned int i = 0; i < frames.size(); i++)
+    {
+	put_le(&data[9 + i * 10], frames[i].hash, 8);
+	put_le(&data[9 + i * 10 + 8], frames[i].pc, 2);
+    }
+
+    // written aside and renamed, a failed run never leaves half a file
+    std::string temp = path + ".tmp";
+    FILE *file = fopen(temp.c_str(), "wb");
+    if (file == nullptr)
+	return 1;
+    bool ok = fwrite(&data[0], 1, data.size(), file) == data.size();
+    ok = fclose(file) == 0 && ok;
+    if (!ok || rename(temp.c_str(), path.c_str()))
+    {
+	remove(temp.c_str());
+	return 1;
+    }
+    return 0;
+}
+
+int load_golden(const std::string &path, std::vector<GoldenFrame> &frames)
+{
+    FILE *file = fopen(path.c_str(), "rb");
+    if (file == nullptr)
+	return 1;
+    unsigned char header[9];
+    if (fread(header, 1, sizeof(header), file) != sizeof(header) ||
+	memcmp(header, "C8GH", 4) != 0 || header[4] != GOLDEN_VERSION)
+    {
+	fclose(file);
+	return 1;
+    }
+    unsigned int count = get_le(header + 5, 4);
+    std::vector<unsigned char> data(count * 10);
+    bool ok = count == 0 || fread(&data[0], 1, data.size(), file) == data.size();
+    fclose(file);
+    if (!ok)
+	return 1;
+
+    frames.resize(count);
+    for (unsigned int i = 0; i < count; i++)
+    {
+	frames[i].hash = get_le(&data[i * 10], 8);
+	frames[i].pc = get_le(&data[i * 10 + 8], 2);
+    }
+    return 0;
+}
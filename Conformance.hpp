@@ -0,0 +1,78 @@
+#ifndef __Conformance_H__
+#define __Conformance_H__
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Chip8.hpp"
+
+/* Golden hash conformance checks: a ROM is run for a number of frames
+   with scripted input, and a rolling hash of the display, V, I and
+   chosen RAM ranges is taken at the end of every frame. The stream of
+   hashes is compared with one stored from a known good build, so any
+   change in behaviour shows up as the first frame whose hash differs.
+
+   Manifest format, one case per line, # starts a comment:
+
+	ROM FRAMES [name=NAME] [profile=chip8|vip|schip] [seed=N]
+		   [freq=N] [ram=START-END]... [keys=FRAME:MASK,...]
+
+   ram ranges are inclusive. keys holds hex key MASK (bit i for key i)
+   from FRAME on, until the next entry. name defaults to the ROM's file
+   name and names the golden file, NAME.c8gh.
+
+   Golden file format (integers little endian):
+
+	"C8GH" version:u8 count:u32 {hash:u64 pc:u16}[count] */
+
+/* Display hash kept up to date from the rows the machine reports
+   changed (Chip8::take_dirty_rows()), so a frame that draws one sprite
+   costs a few row hashes. The hasher must be the only consumer of the
+   machine's dirty rows */
+class FrameHasher
+{
+    unsigned long long rows[Chip8::VIDEO_HEIGHT];
+    unsigned long long display;
+
+public:
+    FrameHasher();
+
+    /* Rehashes the rows of chip8's display that changed and returns
+       the hash of the whole display */
+    unsigned long long update(Chip8 &chip8);
+};
+
+struct ConformanceCase
+{
+    std::string name;
+    std::string rom;
+    unsigned int frames;
+    Chip8::Profile profile;
+    unsigned int seed;
+    unsigned int freq;
+    std::vector<std::pair<unsigned short, unsigned short> > ram;  // first, last
+    std::vector<std::pair<unsigned int, unsigned short> > keys;   // frame, mask
+};
+
+struct GoldenFrame
+{
+    unsigned long long hash;
+    unsigned short pc;
+};
+
+/* Reads a manifest. Returns 0 upon success, or 1 with the offending
+   line in error */
+int parse_manifest(const std::string &path, std::vector<ConformanceCase> &cases,
+		   std::string &error);
+
+/* Runs a case on engine, checked or not, and returns the hash and pc at
+   the end of every frame. Returns 1 if the ROM cannot be loaded */
+int run_case(const ConformanceCase &test, Chip8::Engine engine, bool checked,
+	     std::vector<GoldenFrame> &frames);
+
+/* Returns 0 upon success or 1 otherwise */
+int save_golden(const std::string &path, const std::vector<GoldenFrame> &frames);
+int load_golden(const std::string &path, std::vector<GoldenFrame> &frames);
+
+#endif /* defined(__Conformance_H__) */
@@ -0,0 +1,152 @@
+#include "Diagnostics.hpp"
+#include <chrono>
+#include <stdio.h>
+
+static unsigned long long now_ms()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+	std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void diag_stderr_sink(const DiagEvent &event, unsigned int suppressed,
+		      void *)
+{
+    switch (event.type)
+    {
+    case DIAG_UNKNOWN_OPCODE:
+	fprintf(stderr, "Unknown opcode: 0x%04X at 0x%03X (cycle %llu)\n",
+		event.opcode, event.pc, event.cycle);
+	break;
+    case DIAG_MACHINE_CODE_CALL:
+	fprintf(stderr, "Unknown opcode: 0x%04X at 0x%03X (cycle %llu)\n"
+		"No RCA 1802 found in the system :(\n",
+		event.opcode, event.pc, event.cycle);
+	break;
+    case DIAG_ROM_OPEN_FAILED:
+	fprintf(stderr, "Unable to open rom\n");
+	break;
+    case DIAG_ROM_TOO_BIG:
+	fprintf(stderr, "Error: ROM too big (%u bytes)\n", event.value);
+	break;
+    case DIAG_STACK_FAULT:
+	fprintf(stderr, "Stack fault: 0x%04X at 0x%03X (cycle %llu)\n",
+		event.opcode, event.pc, event.cycle);
+	break;
+    case DIAG_RING_OVERFLOW:
+	fprintf(stderr, "%u diagnostic events lost\n", event.value);
+	break;
+    }
+    if (suppressed > 0)
+	fprintf(stderr, "(%u similar events suppressed)\n", suppressed);
+}
+
+Diagnostics::Diagnostics()
+    : overflow(0), last_key(-1), sink(diag_stderr_sink), sink_data(nullptr),
+      last_refill(now_ms()), running(false), period_ms(50)
+{
+    for (unsigned int i = 0; i < DIAG_TYPE_COUNT; i++)
+    {
+	tokens[i] = RATE;
+	suppressed[i] = 0;
+    }
+}
+
+Diagnostics::~Diagnostics()
+{
+    stop();
+}
+
+void Diagnostics::set_sink(DiagSink sink, void *data)
+{
+    Diagnostics::sink = sink;
+    sink_data = data;
+}
+
+void Diagnostics::drain()
+{
+    DiagEvent event;
+
+    // refill the per-type token buckets
+    unsigned long long now = now_ms();
+    for (unsigned int i = 0; i < DIAG_TYPE_COUNT; i++)
+    {
+	tokens[i] += (now - last_refill) * RATE / 1000.0;
+	if (tokens[i] > RATE)
+	    tokens[i] = RATE;
+    }
+    last_refill = now;
+
+    while (ring.pop(event))
+    {
+	unsigned long long key = (unsigned long long)event.type << 32 |
+	    (unsigned long long)event.opcode << 16 | event.pc;
+	if (event.type == DIAG_UNKNOWN_OPCODE ||
+	    event.type == DIAG_MACHINE_CODE_CALL)
+	{
+	    if (seen.size() >= DEDUP_SIZE)
+		seen.clear();
+	    if (!seen.insert(key).second)
+		continue;
+	}
+	if (tokens[event.type] < 1)
+	{
+	    suppressed[event.type]++;
+	    last_suppressed[event.type] = event;
+	    continue;
+	}
+	tokens[event.type] -= 1;
+	sink(event, suppressed[event.type], sink_data);
+	suppressed[event.type] = 0;
+    }
+
+    unsigned int lost = overflow.exchange(0, std::memory_order_relaxed);
+    if (lost > 0)
+    {
+	DiagEvent event = {DIAG_RING_OVERFLOW, 0, 0, lost, 0};
+	sink(event, 0, sink_data);
+    }
+    flush_suppressed(false);
+}
+
+/* Delivers the last event suppressed of each type with the count of the
+   others, when a token allows or if force: a flood that has stopped
+   would otherwise never be reported */
+void Diagnostics::flush_suppressed(bool force)
+{
+    for (unsigned int i = 0; i < DIAG_TYPE_COUNT; i++)
+    {
+	if (suppressed[i] == 0 || (!force && tokens[i] < 1))
+	    continue;
+	if (tokens[i] >= 1)
+	    tokens[i] -= 1;
+	sink(last_suppressed[i], suppressed[i] - 1, sink_data);
+	suppressed[i] = 0;
+    }
+}
+
+void Diagnostics::drain_loop()
+{
+    while (running)
+    {
+	drain();
+	std::this_thread::sleep_for(std::chrono::milliseconds(period_ms));
+    }
+}
+
+void Diagnostics::start(unsigned int period_ms)
+{
+    if (running)
+	return;
+    Diagnostics::period_ms = period_ms;
+    running = true;
+    drainer = std::thread(&Diagnostics::drain_loop, this);
+}
+
+void Diagnostics::stop()
+{
+    running = false;
+    if (drainer.joinable())
+	drainer.join();
+    drain();
+    flush_suppressed(true);
+}
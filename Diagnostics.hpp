@@ -0,0 +1,112 @@
+#ifndef __Diagnostics_H__
+#define __Diagnostics_H__
+
+#include <atomic>
+#include <thread>
+#include <unordered_set>
+
+#include "SPSCQueue.hpp"
+
+enum DiagType : unsigned int
+{
+    DIAG_UNKNOWN_OPCODE,
+    DIAG_MACHINE_CODE_CALL, // 0NNN, no RCA 1802 to run it on
+    DIAG_ROM_OPEN_FAILED,
+    DIAG_ROM_TOO_BIG,       // value holds the ROM size
+    DIAG_RING_OVERFLOW,     // value holds the number of events lost
+    DIAG_STACK_FAULT,       // checked profiles: stack over/underflow
+    DIAG_TYPE_COUNT
+};
+
+struct DiagEvent
+{
+    unsigned char type;
+    unsigned short opcode;
+    unsigned short pc;
+    unsigned int value;
+    unsigned long long cycle;
+};
+
+/* Called from the drain thread for every event that passes deduplication
+   and rate limiting. suppressed is the number of events of the same type
+   dropped since the last one delivered */
+typedef void (*DiagSink)(const DiagEvent &event, unsigned int suppressed,
+			 void *data);
+
+/* Prints events to stderr */
+void diag_stderr_sink(const DiagEvent &event, unsigned int suppressed,
+		      void *data);
+
+/* Per-instance diagnostics channel. The emulator reports events into a
+   lock-free ring with report(), which never blocks and never does I/O:
+   if the ring is full the event is counted and dropped. Events are
+   delivered to the sink by drain(), either called by the owner or run
+   periodically by the thread started with start(). Repeated events
+   (same type, opcode and pc) are delivered once, and each type is
+   limited to RATE events per second with bursts of up to RATE. Events
+   over the limit are counted and reported with the next one delivered,
+   or on their own once the flood is over. */
+class Diagnostics
+{
+public:
+    static const unsigned int RING_SIZE = 256;
+    static const unsigned int RATE = 10;
+    static const unsigned int DEDUP_SIZE = 4096;
+
+private:
+    SPSCQueue<DiagEvent, RING_SIZE> ring;
+    std::atomic<unsigned int> overflow;
+    // emulator side: last event queued, to drop back to back repeats
+    unsigned long long last_key;
+
+    // drain side state
+    DiagSink sink;
+    void *sink_data;
+    std::unordered_set<unsigned long long> seen;
+    double tokens[DIAG_TYPE_COUNT];
+    unsigned int suppressed[DIAG_TYPE_COUNT];
+    DiagEvent last_suppressed[DIAG_TYPE_COUNT];
+    unsigned long long last_refill;
+
+    std::thread drainer;
+    std::atomic<bool> running;
+    unsigned int period_ms;
+
+    void drain_loop();
+    void flush_suppressed(bool force);
+
+public:
+    Diagnostics();
+    ~Diagnostics();
+
+    /* Sets the function events are delivered to. Default: stderr */
+    void set_sink(DiagSink sink, void *data = nullptr);
+
+    /* Emulator side: queues an event. Wait-free, safe on the hot path */
+    void report(DiagType type, unsigned short opcode, unsigned short pc,
+		unsigned long long cycle, unsigned int value = 0)
+    {
+	// same key as the drain side: pc can go past 0xFFF
+	unsigned long long key = (unsigned long long)type << 32 |
+	    (unsigned long long)opcode << 16 | pc;
+	if (key == last_key)
+	    return;
+	last_key = key;
+	DiagEvent event = {(unsigned char)type, opcode, pc, value, cycle};
+	if (!ring.push(event))
+	    overflow.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /* Delivers queued events to the sink. Must not run concurrently
+       with the drain thread */
+    void drain();
+
+    /* Starts a thread that drains the ring every period_ms */
+    void start(unsigned int period_ms = 50);
+
+    /* Stops the drain thread and delivers the remaining events,
+       including the count of any still suppressed */
+    void stop();
+};
+
+#endif /* defined(__Diagnostics_H__) */
@@ -0,0 +1,89 @@
+#include "FramePacer.hpp"
+#include <algorithm>
+#include <errno.h>
+#include <time.h>
+
+long long FramePacer::now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+FramePacer::FramePacer(double hz)
+    : frames(0), missed(0), resyncs(0), history(HISTORY, 0), history_pos(0)
+{
+    set_rate(hz);
+}
+
+void FramePacer::set_rate(double hz)
+{
+    period_ns = 1e9 / hz;
+    start();
+}
+
+void FramePacer::start()
+{
+    start_ns = now_ns();
+    last_ns = start_ns;
+    index = 0;
+}
+
+bool FramePacer::wait()
+{
+    index++;
+    long long deadline = start_ns + (long long)(index * period_ns);
+    long long now = now_ns();
+    bool on_time = now <= deadline;
+
+    if (!on_time)
+    {
+	missed++;
+	if (now - deadline > MAX_LAG * period_ns)
+	{
+	    // too far behind to catch up, restart the schedule from now
+	    resyncs++;
+	    start_ns = now;
+	    index = 0;
+	}
+    }
+    else
+    {
+	long long wake = deadline - SPIN_NS;
+	if (wake > now)
+	{
+	    struct timespec ts = {(time_t)(wake / 1000000000LL),
+				  (long)(wake % 1000000000LL)};
+	    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts,
+				   nullptr) == EINTR)
+		;
+	}
+	while ((now = now_ns()) < deadline)
+	    ;
+    }
+
+    history[history_pos] = (now - last_ns) / 1000;
+    history_pos = (history_pos + 1) % HISTORY;
+    last_ns = now;
+    frames++;
+    return on_time;
+}
+
+FramePacer::Stats FramePacer::get_stats() const
+{
+    Stats stats = {frames, missed, resyncs, 0, 0, 0};
+    unsigned int n = frames < HISTORY ? frames : HISTORY;
+    if (n == 0)
+	return stats;
+
+    std::vector<unsigned int> sorted(history.begin(), history.begin() + n);
+    std::sort(sorted.begin(), sorted.end());
+
+    double sum = 0;
+    for (unsigned int i = 0; i < n; i++)
+	sum += sorted[i];
+    stats.mean_ms = sum / n / 1000;
+    stats.p99_ms = sorted[(n - 1) * 99 / 100] / 1000.0;
+    stats.max_ms = sorted[n - 1] / 1000.0;
+    return stats;
+}
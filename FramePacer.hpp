@@ -0,0 +1,62 @@
+#ifndef __FramePacer_H__
+#define __FramePacer_H__
+
+#include <vector>
+
+/* Paces a loop to a fixed rate using absolute deadlines on the
+   monotonic clock. Deadline n is start + n * period, computed from the
+   frame index rather than accumulated, so rounding never adds up to
+   drift. wait() sleeps with clock_nanosleep until shortly before the
+   deadline and spins for the rest. If the loop falls more than
+   MAX_LAG frames behind, the schedule restarts from now instead of
+   running a burst of frames to catch up. */
+class FramePacer
+{
+public:
+    static const unsigned int MAX_LAG = 4;
+    static const unsigned int SPIN_NS = 200000;
+    static const unsigned int HISTORY = 1024;
+
+    struct Stats
+    {
+	unsigned long long frames;
+	unsigned long long missed; // deadlines passed before wait()
+	unsigned long long resyncs;
+	double mean_ms;            // frame time, last HISTORY frames
+	double p99_ms;
+	double max_ms;
+    };
+
+private:
+    double period_ns;
+    long long start_ns;
+    unsigned long long index;
+    long long last_ns;
+
+    unsigned long long frames;
+    unsigned long long missed;
+    unsigned long long resyncs;
+    std::vector<unsigned int> history; // frame times in microseconds
+    unsigned int history_pos;
+
+public:
+    FramePacer(double hz = 60);
+
+    /* Changes the rate and restarts the schedule */
+    void set_rate(double hz);
+    double get_rate() const { return 1e9 / period_ns; }
+
+    /* Starts the schedule: the first deadline is one period from now */
+    void start();
+
+    /* Blocks until the next deadline. Returns false if the deadline
+       had already passed */
+    bool wait();
+
+    Stats get_stats() const;
+
+    /* Monotonic clock in nanoseconds */
+    static long long now_ns();
+};
+
+#endif /* defined(__FramePacer_H__) */
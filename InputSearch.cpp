@@ -0,0 +1,311 @@
+#include "InputSearch.hpp"
+
+#include <climits>
+#include <cstring>
+#include <thread>
+
+const signed char InputSearch::NO_KEY;
+const unsigned int InputSearch::SHARDS;
+
+RamGoal::RamGoal(unsigned short addr, Compare compare, unsigned char value)
+    : addr(addr & (Chip8::MEMORY_SIZE - 1)), compare(compare), value(value)
+{
+}
+
+int RamGoal::score(const Chip8 &chip8) const
+{
+    unsigned char byte = chip8.get_memory()[addr];
+    switch (compare)
+    {
+    case GREATER:
+    case MAXIMIZE:
+	return byte;
+    case LESS:
+    case MINIMIZE:
+	return -byte;
+    default:
+	return reached(chip8) ? 1 : 0;
+    }
+}
+
+bool RamGoal::reached(const Chip8 &chip8) const
+{
+    unsigned char byte = chip8.get_memory()[addr];
+    switch (compare)
+    {
+    case EQUAL:
+	return byte == value;
+    case NOT_EQUAL:
+	return byte != value;
+    case LESS:
+	return byte < value;
+    case GREATER:
+	return byte > value;
+    default:
+	return false;
+    }
+}
+
+FrameGoal::FrameGoal(const std::vector<unsigned char> &pattern,
+		     unsigned int width, unsigned int height,
+		     unsigned int x, unsigned int y)
+    : pattern(pattern), stride(width), width(width), height(height), x(x), y(y)
+{
+    // clip to the display
+    if (x >= Chip8::VIDEO_WIDTH || y >= Chip8::VIDEO_HEIGHT)
+	FrameGoal::width = FrameGoal::height = 0;
+    if (x + FrameGoal::width > Chip8::VIDEO_WIDTH)
+	FrameGoal::width = Chip8::VIDEO_WIDTH - x;
+    if (y + FrameGoal::height > Chip8::VIDEO_HEIGHT)
+	FrameGoal::height = Chip8::VIDEO_HEIGHT - y;
+    if (pattern.size() < width * height)
+	FrameGoal::width = FrameGoal::height = 0;
+}
+
+int FrameGoal::score(const Chip8 &chip8) const
+{
+    int matching = 0;
+    for (unsigned int row = 0; row < height; row++)
+	for (unsigned int col = 0; col < width; col++)
+	    if ((chip8.gfx[x + col][y + row] != 0) ==
+		(pattern[row * stride + col] != 0))
+		matching++;
+    return matching;
+}
+
+bool FrameGoal::reached(const Chip8 &chip8) const
+{
+    // a pattern entirely off the display can never appear
+    return width * height > 0 && score(chip8) == (int)(width * height);
+}
+
+InputSearch::InputSearch(const SearchGoal &goal)
+    : goal(goal), pending(0), states(0), duplicates(0), stopping(false)
+{
+}
+
+static unsigned long long hash_bytes(const unsigned char *data, unsigned int size,
+				     unsigned long long hash)
+{
+    const unsigned long long K = 0x9E3779B97F4A7C15ULL;
+    unsigned int i = 0;
+    for (; i + 8 <= size; i += 8)
+    {
+	unsigned long long word;
+	memcpy(&word, data + i, 8);
+	hash = (hash ^ word) * K;
+	hash ^= hash >> 29;
+    }
+    for (; i < size; i++)
+	hash = (hash ^ data[i]) * K;
+    return hash ^ (hash >> 32);
+}
+
+unsigned long long InputSearch::hash_state(const Chip8 &chip8)
+{
+    Chip8::Registers regs = chip8.get_registers();
+    // fields one by one, the struct has padding
+    unsigned char cpu[Chip8::VREG_SIZE + 2 * Chip8::STACK_SIZE + 7];
+    unsigned char *p = cpu;
+    memcpy(p, regs.V, sizeof(regs.V));
+    p += sizeof(regs.V);
+    memcpy(p, regs.stack, sizeof(regs.stack));
+    p += sizeof(regs.stack);
+    *p++ = regs.I & 0xFF;
+    *p++ = regs.I >> 8;
+    *p++ = regs.pc & 0xFF;
+    *p++ = regs.pc >> 8;
+    *p++ = regs.sp;
+    *p++ = regs.delay_timer;
+    *p++ = regs.sound_timer;
+
+    unsigned long long hash = hash_bytes(cpu, sizeof(cpu), 0);
+    hash = hash_bytes(chip8.get_memory(), Chip8::MEMORY_SIZE, hash);
+    return hash_bytes(&chip8.gfx[0][0], Chip8::VIDEO_WIDTH * Chip8::VIDEO_HEIGHT, hash);
+}
+
+InputSearch::Result InputSearch::run(const Chip8 &start, const Options &options)
+{
+    InputSearch::options = options;
+    if (InputSearch::options.choices.empty())
+    {
+	InputSearch::options.choices.push_back(NO_KEY);
+	for (signed char k = 0; k < (signed char)Chip8::KEYS_SIZE; k++)
+	    InputSearch::options.choices.push_back(k);
+    }
+    unsigned int threads = options.threads;
+    if (threads == 0)
+	threads = std::thread::hardware_concurrency();
+    if (threads == 0)
+	threads = 1;
+
+    for (unsigned int i = 0; i < SHARDS; i++)
+	visited[i].depth.clear();
+    workers.clear();
+    for (unsigned int i = 0; i < threads; i++)
+	workers.push_back(std::unique_ptr<Worker>(new Worker()));
+    states = 0;
+    duplicates = 0;
+    stopping = false;
+    best = Result();
+    best.score = INT_MIN;
+
+    Node *root = new Node{start.fork(), std::vector<signed char>()};
+    visit(hash_state(root->state), 0);
+    offer(root->state, root->inputs);
+    if (stopping || options.depth == 0)
+    {
+	delete root;
+    }
+    else
+    {
+	workers[0]->nodes.push_back(root);
+	pending = 1;
+
+	std::vector<std::thread> pool;
+	for (unsigned int i = 0; i < threads; i++)
+	    pool.push_back(std::thread(&InputSearch::work, this, i));
+	for (unsigned int i = 0; i < threads; i++)
+	    pool[i].join();
+    }
+
+    // left over when stopped early
+    for (unsigned int i = 0; i < threads; i++)
+    {
+	for (Node *node : workers[i]->nodes)
+	    delete node;
+	workers[i]->nodes.clear();
+    }
+    for (unsigned int i = 0; i < SHARDS; i++)
+	visited[i].depth.clear();
+
+    best.states = states;
+    best.duplicates = duplicates;
+    return best;
+}
+
+void InputSearch::work(unsigned int id)
+{
+    while (!stopping)
+    {
+	Node *node = take(id);
+	if (node == nullptr)
+	{
+	    // the others may still produce work until all of it is done
+	    if (pending.load() == 0)
+		break;
+	    std::this_thread::yield();
+	    continue;
+	}
+	expand(id, node);
+	delete node;
+	pending--;
+    }
+}
+
+InputSearch::Node *InputSearch::take(unsigned int id)
+{
+    Node *node = nullptr;
+    {
+	// newest first from our own deque: depth first, and what we
+	// pushed last is still in our cache
+	std::lock_guard<std::mutex> guard(workers[id]->lock);
+	if (!workers[id]->nodes.empty())
+	{
+	    node = workers[id]->nodes.back();
+	    workers[id]->nodes.pop_back();
+	    return node;
+	}
+    }
+    // oldest first from the others: closest to the root, so the most
+    // work per steal
+    for (unsigned int i = 1; i < workers.size(); i++)
+    {
+	Worker &victim = *workers[(id + i) % workers.size()];
+	std::lock_guard<std::mutex> guard(victim.lock);
+	if (!victim.nodes.empty())
+	{
+	    node = victim.nodes.front();
+	    victim.nodes.pop_front();
+	    return node;
+	}
+    }
+    return nullptr;
+}
+
+void InputSearch::expand(unsigned int id, Node *node)
+{
+    unsigned int depth = node->inputs.size() + 1;
+    for (signed char choice : options.choices)
+    {
+	if (stopping)
+	    return;
+
+	Chip8 child = node->state.fork();
+	for (unsigned int k = 0; k < Chip8::KEYS_SIZE; k++)
+	    child.key[k] = (signed char)k == choice;
+	for (unsigned int f = 0; f < options.interval; f++)
+	{
+	    Chip8::RunResult result;
+	    do
+		result = child.run_frame();
+	    while (!result.frame_end);
+	}
+
+	unsigned long long run = ++states;
+	if (options.max_states > 0 && run >= options.max_states)
+	    stopping = true;
+	if (!visit(hash_state(child), depth))
+	{
+	    duplicates++;
+	    continue;
+	}
+
+	std::vector<signed char> inputs(node->inputs);
+	inputs.push_back(choice);
+	offer(child, inputs);
+	if (depth < options.depth)
+	{
+	    Node *next = new Node{child, inputs};
+	    pending++;
+	    std::lock_guard<std::mutex> guard(workers[id]->lock);
+	    workers[id]->nodes.push_back(next);
+	}
+    }
+}
+
+bool InputSearch::visit(unsigned long long hash, unsigned int depth)
+{
+    Shard &shard = visited[hash >> 58];
+    std::lock_guard<std::mutex> guard(shard.lock);
+    std::pair<std::unordered_map<unsigned long long, unsigned int>::iterator, bool>
+	inserted = shard.depth.insert(std::make_pair(hash, depth));
+    if (inserted.second)
+	return true;
+    // seen, but reached now with more decisions left to explore from it
+    if (depth < inserted.first->second)
+    {
+	inserted.first->second = depth;
+	return true;
+    }
+    return false;
+}
+
+void InputSearch::offer(const Chip8 &state, const std::vector<signed char> &inputs)
+{
+    bool reached = goal.reached(state);
+    int score = goal.score(state);
+
+    std::lock_guard<std::mutex> guard(best_lock);
+    if (best.reached)
+	return;
+    if (reached || score > best.score ||
+	(score == best.score && inputs.size() < best.inputs.size()))
+    {
+	best.reached = reached;
+	best.score = score;
+	best.inputs = inputs;
+    }
+    if (reached)
+	stopping = true;
+}
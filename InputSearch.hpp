@@ -0,0 +1,159 @@
+#ifndef __InputSearch_H__
+#define __InputSearch_H__
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "Chip8.hpp"
+
+/* What an InputSearch looks for: scores states, higher is better, and
+   says when one is good enough to stop. Called from several threads at
+   once */
+class SearchGoal
+{
+public:
+    virtual ~SearchGoal() {}
+    virtual int score(const Chip8 &chip8) const = 0;
+    virtual bool reached(const Chip8 &chip8) const = 0;
+};
+
+/* Goal on one byte of memory, e.g. a score or a level counter */
+class RamGoal : public SearchGoal
+{
+public:
+    enum Compare
+    {
+	EQUAL,
+	NOT_EQUAL,
+	LESS,
+	GREATER,
+	MAXIMIZE,  // never reached, the search returns the highest value
+	MINIMIZE   // never reached, the search returns the lowest value
+    };
+
+    RamGoal(unsigned short addr, Compare compare, unsigned char value = 0);
+
+    int score(const Chip8 &chip8) const;
+    bool reached(const Chip8 &chip8) const;
+
+private:
+    unsigned short addr;
+    Compare compare;
+    unsigned char value;
+};
+
+/* Goal on the display: a width x height pattern that must appear at
+   x, y. Scores the number of pattern pixels already matching. The part
+   of the pattern off the display is ignored; one entirely off it is
+   never reached */
+class FrameGoal : public SearchGoal
+{
+public:
+    /* pattern holds width * height bytes, row by row, 1 for a pixel on */
+    FrameGoal(const std::vector<unsigned char> &pattern, unsigned int width,
+	      unsigned int height, unsigned int x = 0, unsigned int y = 0);
+
+    int score(const Chip8 &chip8) const;
+    bool reached(const Chip8 &chip8) const;
+
+private:
+    std::vector<unsigned char> pattern;
+    unsigned int stride;   // width of pattern, before clipping
+    unsigned int width;
+    unsigned int height;
+    unsigned int x;
+    unsigned int y;
+};
+
+/* Searches for a sequence of inputs that takes a machine to a goal.
+   Every decision holds one of the choices (a key, or none) for interval
+   frames, giving a tree of inputs that is explored depth first by a pool
+   of threads. Each thread works on its own deque of unexpanded states
+   and, when it runs dry, steals the oldest entry of another thread's,
+   which is the root of the largest subtree left there. Machines are
+   forked copy-on-write, and states already reached with as many
+   decisions to spare are not expanded again. */
+class InputSearch
+{
+public:
+    static const signed char NO_KEY = -1;
+
+    struct Options
+    {
+	unsigned int interval = 4;      // frames per decision
+	unsigned int depth = 30;        // decisions
+	std::vector<signed char> choices; // keys to try, NO_KEY for none
+	unsigned int threads = 0;       // 0: one per core
+	unsigned long long max_states = 0; // 0: no limit
+    };
+
+    struct Result
+    {
+	bool reached = false;
+	int score = 0;
+	std::vector<signed char> inputs;  // the choice for every decision
+	unsigned long long states = 0;    // states run
+	unsigned long long duplicates = 0; // states found visited
+    };
+
+    InputSearch(const SearchGoal &goal);
+
+    /* Searches from start, which keeps its own speed and profile
+       settings. Returns the inputs reaching the goal, or those reaching
+       the best scoring state if it was not reached */
+    Result run(const Chip8 &start, const Options &options);
+
+    /* Makes a running search return early, from any thread */
+    void stop() { stopping = true; }
+
+    /* Hash of the state of a machine: memory, display, registers and
+       timers. The cycle count and the random number generator are left
+       out, so machines that only differ in those count as one state */
+    static unsigned long long hash_state(const Chip8 &chip8);
+
+private:
+    static const unsigned int SHARDS = 64;
+
+    struct Node
+    {
+	Chip8 state;
+	std::vector<signed char> inputs;
+    };
+
+    struct Worker
+    {
+	std::mutex lock;
+	std::deque<Node*> nodes;
+    };
+
+    struct alignas(64) Shard
+    {
+	std::mutex lock;
+	// hash -> fewest decisions it was reached with
+	std::unordered_map<unsigned long long, unsigned int> depth;
+    };
+
+    const SearchGoal &goal;
+    Options options;
+    std::vector<std::unique_ptr<Worker> > workers;
+    Shard visited[SHARDS];
+    std::atomic<long long> pending;  // nodes queued or being expanded
+    std::atomic<unsigned long long> states;
+    std::atomic<unsigned long long> duplicates;
+    std::atomic<bool> stopping;
+
+    std::mutex best_lock;
+    Result best;
+
+    void work(unsigned int id);
+    Node *take(unsigned int id);
+    void expand(unsigned int id, Node *node);
+    bool visit(unsigned long long hash, unsigned int depth);
+    void offer(const Chip8 &state, const std::vector<signed char> &inputs);
+};
+
+#endif /* defined(__InputSearch_H__) */
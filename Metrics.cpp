@@ -0,0 +1,254 @@
+#include "Metrics.hpp"
+#include "FramePacer.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+const unsigned int Histogram::BUCKETS;
+
+Histogram::Histogram()
+    : sum_us(0), count(0)
+{
+    for (unsigned int i = 0; i <= BUCKETS; i++)
+	counts[i] = 0;
+}
+
+double Histogram::quantile(double q) const
+{
+    unsigned long long total = get_count();
+    if (total == 0)
+	return 0;
+    double rank = q * total;
+    unsigned long long seen = 0;
+    for (unsigned int i = 0; i <= BUCKETS; i++)
+    {
+	unsigned long long n = counts[i].load(std::memory_order_relaxed);
+	if (n > 0 && seen + n >= rank)
+	{
+	    double low = i == 0 ? 0 : (double)(1ULL << (i - 1));
+	    double high = i < BUCKETS ? (double)(1ULL << i) : low * 2;
+	    return low + (high - low) * (rank - seen) / n;
+	}
+	seen += n;
+    }
+    return (double)(1ULL << BUCKETS);
+}
+
+void Histogram::format(std::string &out, const char *name, const char *help) const
+{
+    char line[256];
+    snprintf(line, sizeof(line), "# HELP %s %s\n# TYPE %s histogram\n",
+	     name, help, name);
+    out += line;
+    unsigned long long cumulative = 0;
+    for (unsigned int i = 0; i <= BUCKETS; i++)
+    {
+	cumulative += counts[i].load(std::memory_order_relaxed);
+	if (i < BUCKETS)
+	    snprintf(line, sizeof(line), "%s_bucket{le=\"%g\"} %llu\n",
+		     name, (1ULL << i) / 1e6, cumulative);
+	else
+	    snprintf(line, sizeof(line), "%s_bucket{le=\"+Inf\"} %llu\n",
+		     name, cumulative);
+	out += line;
+    }
+    snprintf(line, sizeof(line), "%s_sum %g\n%s_count %llu\n",
+	     name, sum_us.load(std::memory_order_relaxed) / 1e6,
+	     name, cumulative);
+    out += line;
+}
+
+Metrics::Metrics(double fps)
+    : fps(fps), sample_ns(FramePacer::now_ns()), sample_frames(0),
+      instructions(0), frames(0), frames_presented(0), frames_late(0),
+      frames_dropped(0), audio_underruns(0), input_queue_depth(0),
+      sessions(0), speed(0)
+{
+}
+
+void Metrics::update_speed()
+{
+    long long now = FramePacer::now_ns();
+    unsigned long long n = frames.load(std::memory_order_relaxed);
+    unsigned int running = sessions.load(std::memory_order_relaxed);
+    if (now <= sample_ns)
+	return;
+    speed = (n - sample_frames) * 1e9 /
+	((now - sample_ns) * fps * (running > 0 ? running : 1));
+    sample_ns = now;
+    sample_frames = n;
+}
+
+static void format_value(std::string &out, const char *name, const char *type,
+			 const char *help, double value)
+{
+    char line[256];
+    snprintf(line, sizeof(line), "# HELP %s %s\n# TYPE %s %s\n%s %.17g\n",
+	     name, help, name, type, name, value);
+    out += line;
+}
+
+std::string Metrics::format() const
+{
+    std::string out;
+    format_value(out, "chip8_instructions_total", "counter",
+		 "Instructions executed", instructions.load());
+    format_value(out, "chip8_frames_total", "counter",
+		 "Frames emulated", frames.load());
+    format_value(out, "chip8_frames_presented_total", "counter",
+		 "Frames presented", frames_presented.load());
+    format_value(out, "chip8_frames_late_total", "counter",
+		 "Frames whose emulation missed its deadline", frames_late.load());
+    format_value(out, "chip8_frames_dropped_total", "counter",
+		 "Frames emulated but never presented", frames_dropped.load());
+    format_value(out, "chip8_audio_underruns_total", "counter",
+		 "Sound the audio output never played", audio_underruns.load());
+    format_value(out, "chip8_input_queue_depth", "gauge",
+		 "Input events waiting for the emulation", input_queue_depth.load());
+    format_value(out, "chip8_sessions", "gauge",
+		 "Sessions running", sessions.load());
+    format_value(out, "chip8_speed_ratio", "gauge",
+		 "Emulated over wall-clock time per session, 1 is full speed", speed.load());
+    frame_build.format(out, "chip8_frame_build_seconds",
+		       "Time to emulate a frame");
+    frame_present.format(out, "chip8_frame_present_seconds",
+			 "Time to draw and present a frame");
+    return out;
+}
+
+MetricsExporter::MetricsExporter()
+    : running(false)
+{
+}
+
+MetricsExporter::~MetricsExporter()
+{
+    close();
+}
+
+int MetricsExporter::open(const Metrics &metrics, const std::string &file,
+			  const std::string &socket_path, unsigned int period_ms)
+{
+    close();
+    if (file != "")
+    {
+	FILE *f = fopen((file + ".tmp").c_str(), "w");
+	if (f == nullptr)
+	    return 1;
+	fclose(f);
+    }
+    if (socket_path != "")
+    {
+	sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (socket_path.size() >= sizeof(addr.sun_path))
+	    return 1;
+	strcpy(addr.sun_path, socket_path.c_str());
+	unlink(socket_path.c_str());
+
+	listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (listen_fd == -1 ||
+	    bind(listen_fd, (sockaddr*)&addr, sizeof(addr)) == -1 ||
+	    listen(listen_fd, 16) == -1)
+	{
+	    close();
+	    return 1;
+	}
+    }
+
+    MetricsExporter::metrics = &metrics;
+    file_path = file;
+    MetricsExporter::socket_path = socket_path;
+    MetricsExporter::period_ms = period_ms;
+    if (file != "" || socket_path != "")
+    {
+	running = true;
+	exporter = std::thread(&MetricsExporter::export_loop, this);
+    }
+    return 0;
+}
+
+void MetricsExporter::close()
+{
+    if (running)
+    {
+	running = false;
+	exporter.join();
+    }
+    if (listen_fd != -1)
+    {
+	::close(listen_fd);
+	listen_fd = -1;
+	if (socket_path != "")
+	    unlink(socket_path.c_str());
+    }
+    if (file_path != "")
+	unlink((file_path + ".tmp").c_str());
+    file_path = "";
+    socket_path = "";
+}
+
+void MetricsExporter::write_file()
+{
+    std::string text = metrics->format();
+    std::string tmp = file_path + ".tmp";
+    FILE *f = fopen(tmp.c_str(), "w");
+    if (f == nullptr)
+	return;
+    bool ok = fwrite(text.data(), 1, text.size(), f) == text.size();
+    if (fclose(f) == 0 && ok)
+	rename(tmp.c_str(), file_path.c_str());
+}
+
+void MetricsExporter::serve(int fd)
+{
+    // the request itself does not matter: read what has arrived
+    char request[1024];
+    pollfd p = {fd, POLLIN, 0};
+    if (poll(&p, 1, 100) > 0 && read(fd, request, sizeof(request)) < 0)
+	return;
+
+    std::string text = metrics->format();
+    char header[128];
+    snprintf(header, sizeof(header),
+	     "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+	     "Content-Length: %zu\r\n\r\n", text.size());
+    std::string response = header + text;
+    size_t sent = 0;
+    while (sent < response.size())
+    {
+	ssize_t n = send(fd, response.data() + sent, response.size() - sent,
+			 MSG_NOSIGNAL);
+	if (n <= 0)
+	    break;
+	sent += n;
+    }
+}
+
+void MetricsExporter::export_loop()
+{
+    long long next_write = 0;
+    while (running)
+    {
+	long long now = FramePacer::now_ns();
+	if (file_path != "" && now >= next_write)
+	{
+	    write_file();
+	    next_write = now + period_ms * 1000000LL;
+	}
+	// wake up at least every 100 ms so that close() does not wait long
+	pollfd p = {listen_fd, POLLIN, 0};
+	if (poll(&p, listen_fd != -1 ? 1 : 0, 100) <= 0)
+	    continue;
+	int fd = accept(listen_fd, nullptr, nullptr);
+	if (fd == -1)
+	    continue;
+	serve(fd);
+	::close(fd);
+    }
+}
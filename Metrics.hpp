@@ -0,0 +1,116 @@
+#ifndef __Metrics_H__
+#define __Metrics_H__
+
+#include <atomic>
+#include <string>
+#include <thread>
+
+/* Histogram of durations in microseconds with power of two buckets:
+   bucket i counts observations up to 2^i us, the last one everything
+   above. Updated with relaxed atomic increments, so any thread may
+   observe while another one reads. */
+class Histogram
+{
+public:
+    static const unsigned int BUCKETS = 21; // up to 2^20 us, about 1 s
+
+private:
+    std::atomic<unsigned long long> counts[BUCKETS + 1];
+    std::atomic<unsigned long long> sum_us;
+    std::atomic<unsigned long long> count;
+
+public:
+    Histogram();
+
+    void observe(unsigned long long us)
+    {
+	unsigned int i = 0;
+	while (i < BUCKETS && us > (1ULL << i))
+	    i++;
+	counts[i].fetch_add(1, std::memory_order_relaxed);
+	sum_us.fetch_add(us, std::memory_order_relaxed);
+	count.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /* Estimated q quantile (0 to 1) in microseconds, interpolated
+       within its bucket */
+    double quantile(double q) const;
+
+    unsigned long long get_count() const { return count.load(std::memory_order_relaxed); }
+
+    /* Appends the histogram in Prometheus text format, in seconds */
+    void format(std::string &out, const char *name, const char *help) const;
+};
+
+/* Runtime counters of a frontend or headless runner. Counters and
+   gauges are relaxed atomics that the emulation and render threads
+   update directly; format() can run on any thread at any time. */
+class Metrics
+{
+    double fps;
+    // last update_speed()
+    long long sample_ns;
+    unsigned long long sample_frames;
+
+public:
+    // counters
+    std::atomic<unsigned long long> instructions;
+    std::atomic<unsigned long long> frames;           // emulated
+    std::atomic<unsigned long long> frames_presented;
+    std::atomic<unsigned long long> frames_late;      // emulation missed its deadline
+    std::atomic<unsigned long long> frames_dropped;   // emulated but never presented
+    std::atomic<unsigned long long> audio_underruns;  // sound the output never played
+    // gauges
+    std::atomic<unsigned int> input_queue_depth;
+    std::atomic<unsigned int> sessions;
+    std::atomic<double> speed; // see update_speed()
+
+    Histogram frame_build;   // emulating one frame (a batch, headless)
+    Histogram frame_present; // drawing and presenting one frame
+
+    /* fps is the nominal emulation rate, used for speed */
+    Metrics(double fps = 60);
+
+    /* Sets speed to the frames emulated per session and per wall-clock
+       frame period since the last call: 1.0 is full speed. Meant to be
+       called about once a second by a single thread */
+    void update_speed();
+
+    /* All metrics in Prometheus text exposition format */
+    std::string format() const;
+};
+
+/* Publishes Metrics::format() from a background thread, by rewriting a
+   file every period (atomically, for node_exporter's textfile collector
+   and the like), by answering every connection to a Unix socket with an
+   HTTP response (e.g. curl --unix-socket PATH http://localhost/), or
+   both */
+class MetricsExporter
+{
+    const Metrics *metrics = nullptr;
+    std::string file_path;
+    std::string socket_path;
+    int listen_fd = -1;
+    unsigned int period_ms = 1000;
+    std::thread exporter;
+    std::atomic<bool> running;
+
+    void write_file();
+    void serve(int fd);
+    void export_loop();
+
+public:
+    MetricsExporter();
+    ~MetricsExporter();
+
+    /* Starts exporting metrics to file every period_ms and on the Unix
+       socket at socket_path. Either may be empty.
+       Returns 0 upon success or 1 otherwise */
+    int open(const Metrics &metrics, const std::string &file,
+	     const std::string &socket_path, unsigned int period_ms = 1000);
+
+    /* Stops exporting, removes the socket if there is one */
+    void close();
+};
+
+#endif /* defined(__Metrics_H__) */
@@ -0,0 +1,363 @@
+#include "Recorder.hpp"
+#include <chrono>
+#include <cstring>
+
+static void put_u16(unsigned char *p, unsigned int v)
+{
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+}
+
+static void put_u32(unsigned char *p, unsigned int v)
+{
+    put_u16(p, v & 0xFFFF);
+    put_u16(p + 2, v >> 16);
+}
+
+static unsigned int get_u16(const unsigned char *p)
+{
+    return p[0] | p[1] << 8;
+}
+
+static unsigned int get_u32(const unsigned char *p)
+{
+    return get_u16(p) | get_u16(p + 2) << 16;
+}
+
+void pack_frame(const unsigned char gfx[][Chip8::VIDEO_HEIGHT],
+		unsigned char out[Recorder::FRAME_BYTES])
+{
+    for (unsigned int y = 0; y < Chip8::VIDEO_HEIGHT; y++)
+    {
+	for (unsigned int b = 0; b < Chip8::VIDEO_WIDTH / 8; b++)
+	{
+	    unsigned char byte = 0;
+	    for (unsigned int i = 0; i < 8; i++)
+		byte = byte << 1 | (gfx[b * 8 + i][y] & 1);
+	    out[y * (Chip8::VIDEO_WIDTH / 8) + b] = byte;
+	}
+    }
+}
+
+/* PackBits: a control byte c < 128 is followed by c + 1 literal bytes,
+   c >= 128 is followed by one byte repeated c - 125 times (3 to 130) */
+unsigned int rle_encode(const unsigned char *in, unsigned int len,
+			unsigned char *out)
+{
+    unsigned int i = 0, o = 0;
+    while (i < len)
+    {
+	unsigned int run = 1;
+	while (i + run < len && run < 130 && in[i + run] == in[i])
+	    run++;
+	if (run >= 3)
+	{
+	    out[o++] = run + 125;
+	    out[o++] = in[i];
+	    i += run;
+	    continue;
+	}
+	// literal block, stopped by the next run of 3 or more
+	unsigned int start = i;
+	while (i < len && i - start < 128)
+	{
+	    if (i + 2 < len && in[i] == in[i + 1] && in[i] == in[i + 2])
+		break;
+	    i++;
+	}
+	out[o++] = i - start - 1;
+	memcpy(&out[o], &in[start], i - start);
+	o += i - start;
+    }
+    return o;
+}
+
+int rle_decode(const unsigned char *in, unsigned int len,
+	       unsigned char *out, unsigned int out_len)
+{
+    unsigned int i = 0, o = 0;
+    while (i < len)
+    {
+	unsigned int c = in[i++];
+	if (c < 128)
+	{
+	    if (i + c + 1 > len || o + c + 1 > out_len)
+		return 1;
+	    memcpy(&out[o], &in[i], c + 1);
+	    i += c + 1;
+	    o += c + 1;
+	}
+	else
+	{
+	    if (i >= len || o + c - 125 > out_len)
+		return 1;
+	    memset(&out[o], in[i++], c - 125);
+	    o += c - 125;
+	}
+    }
+    return o == out_len ? 0 : 1;
+}
+
+Recorder::Recorder() : running(false), dropped(0)
+{
+}
+
+Recorder::~Recorder()
+{
+    close();
+}
+
+int Recorder::open(const std::string &path, unsigned int keyframe_interval)
+{
+    file = fopen(path.c_str(), "wb");
+    if (file == nullptr)
+	return 1;
+
+    Recorder::keyframe_interval = keyframe_interval ? keyframe_interval : 1;
+    frame_count = 0;
+    index.clear();
+    memset(prev, 0, sizeof(prev));
+
+    unsigned char header[9] = {'C', '8', 'R', 'C', VERSION,
+			       Chip8::VIDEO_WIDTH, Chip8::VIDEO_HEIGHT};
+    put_u16(&header[7], Recorder::keyframe_interval);
+    fwrite(header, 1, sizeof(header), file);
+
+    running = true;
+    writer = std::thread(&Recorder::writer_loop, this);
+    return 0;
+}
+
+void Recorder::record_frame(const unsigned char gfx[][Chip8::VIDEO_HEIGHT],
+			    unsigned char sound_timer)
+{
+    Frame frame;
+    frame.sound_timer = sound_timer;
+    pack_frame(gfx, frame.data);
+    if (!queue.push(frame))
+	dropped++;
+}
+
+void Recorder::writer_loop()
+{
+    Frame frame;
+    while (true)
+    {
+	if (queue.pop(frame))
+	{
+	    write_frame(frame);
+	    continue;
+	}
+	if (!running)
+	    break;
+	std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+}
+
+void Recorder::write_frame(const Frame &frame)
+{
+    unsigned char delta[FRAME_BYTES];
+    unsigned char record[4 + FRAME_BYTES + FRAME_BYTES / 128 + 1];
+    const unsigned char *src = frame.data;
+
+    unsigned char type = DELTA;
+    if (frame_count % keyframe_interval != 0)
+    {
+	for (unsigned int i = 0; i < FRAME_BYTES; i++)
+	    delta[i] = frame.data[i] ^ prev[i];
+	src = delta;
+    }
+    else
+	type = KEYFRAME;
+    unsigned int len = rle_encode(src, FRAME_BYTES, &record[4]);
+
+    // the footer stores 32-bit offsets, up to the end of the frames
+    unsigned long long offset = ftell(file);
+    if (offset + len + 4 > MAX_OFFSET)
+    {
+	dropped++;
+	return;
+    }
+    if (type == KEYFRAME)
+    {
+	// whatever happens to the process, the frames so far are kept
+	fflush(file);
+	index.push_back(frame_count);
+	index.push_back(offset);
+    }
+
+    record[0] = type;
+    record[1] = frame.sound_timer;
+    put_u16(&record[2], len);
+    fwrite(record, 1, len + 4, file);
+
+    memcpy(prev, frame.data, FRAME_BYTES);
+    frame_count++;
+}
+
+void Recorder::close()
+{
+    if (file == nullptr)
+	return;
+
+    running = false;
+    if (writer.joinable())
+	writer.join();
+
+    unsigned char buf[8];
+    unsigned int index_offset = ftell(file);
+    fwrite("C8IX", 1, 4, file);
+    put_u32(buf, index.size() / 2);
+    fwrite(buf, 1, 4, file);
+    for (unsigned int i = 0; i < index.size(); i++)
+    {
+	put_u32(buf, index[i]);
+	fwrite(buf, 1, 4, file);
+    }
+    put_u32(buf, index_offset);
+    memcpy(&buf[4], "C8RE", 4);
+    fwrite(buf, 1, 8, file);
+
+    fclose(file);
+    file = nullptr;
+}
+
+RecordingReader::~RecordingReader()
+{
+    if (file != nullptr)
+	fclose(file);
+}
+
+int RecordingReader::open(const std::string &path)
+{
+    unsigned char buf[9];
+
+    file = fopen(path.c_str(), "rb");
+    if (file == nullptr)
+	return 1;
+
+    if (fread(buf, 1, 9, file) != 9 || memcmp(buf, "C8RC", 4) != 0 ||
+	buf[4] != Recorder::VERSION || buf[5] != Chip8::VIDEO_WIDTH ||
+	buf[6] != Chip8::VIDEO_HEIGHT)
+	return 1;
+    keyframe_interval = get_u16(&buf[7]);
+
+    // a recording that was never closed has no footer
+    if (read_index())
+    {
+	index_frames.clear();
+	index_offsets.clear();
+	if (scan_index())
+	    return 1;
+    }
+
+    memset(frame, 0, sizeof(frame));
+    frame_no = 0;
+    return fseek(file, 9, SEEK_SET) ? 1 : 0;
+}
+
+/* Loads the keyframe index from the footer */
+int RecordingReader::read_index()
+{
+    unsigned char buf[8];
+    if (fseek(file, -8, SEEK_END) || fread(buf, 1, 8, file) != 8 ||
+	memcmp(&buf[4], "C8RE", 4) != 0)
+	return 1;
+    unsigned int index_offset = get_u32(buf);
+    if (fseek(file, index_offset, SEEK_SET) || fread(buf, 1, 8, file) != 8 ||
+	memcmp(buf, "C8IX", 4) != 0)
+	return 1;
+    unsigned int count = get_u32(&buf[4]);
+    for (unsigned int i = 0; i < count; i++)
+    {
+	if (fread(buf, 1, 8, file) != 8)
+	    return 1;
+	index_frames.push_back(get_u32(buf));
+	index_offsets.push_back(get_u32(&buf[4]));
+    }
+    // the footer marks the end of the frame data
+    index_offsets.push_back(index_offset);
+    return 0;
+}
+
+/* Rebuilds the keyframe index by reading every frame record, up to the
+   first one that is cut short or does not decode */
+int RecordingReader::scan_index()
+{
+    unsigned char head[4];
+    unsigned char payload[Recorder::FRAME_BYTES * 2];
+    unsigned char decoded[Recorder::FRAME_BYTES];
+    unsigned long long offset = 9;
+    if (fseek(file, offset, SEEK_SET))
+	return 1;
+    for (unsigned int n = 0; ; n++)
+    {
+	if (fread(head, 1, 4, file) != 4 || head[0] > Recorder::DELTA)
+	    break;
+	unsigned int len = get_u16(&head[2]);
+	if (len > sizeof(payload) || fread(payload, 1, len, file) != len ||
+	    rle_decode(payload, len, decoded, Recorder::FRAME_BYTES) ||
+	    offset + 4 + len > Recorder::MAX_OFFSET)
+	    break;
+	if (head[0] == Recorder::KEYFRAME)
+	{
+	    index_frames.push_back(n);
+	    index_offsets.push_back(offset);
+	}
+	offset += 4 + len;
+    }
+    index_offsets.push_back(offset);
+    return 0;
+}
+
+int RecordingReader::next(unsigned char &sound_timer)
+{
+    unsigned char head[4];
+    unsigned char payload[Recorder::FRAME_BYTES * 2];
+    unsigned char decoded[Recorder::FRAME_BYTES];
+
+    if ((unsigned int)ftell(file) >= index_offsets.back())
+	return 1;
+    if (fread(head, 1, 4, file) != 4)
+	return 1;
+    unsigned int len = get_u16(&head[2]);
+    if (len > sizeof(payload) || fread(payload, 1, len, file) != len)
+	return 1;
+    if (rle_decode(payload, len, decoded, Recorder::FRAME_BYTES))
+	return 1;
+
+    if (head[0] == Recorder::KEYFRAME)
+	memcpy(frame, decoded, Recorder::FRAME_BYTES);
+    else
+	for (unsigned int i = 0; i < Recorder::FRAME_BYTES; i++)
+	    frame[i] ^= decoded[i];
+
+    sound_timer = head[1];
+    frame_no++;
+    return 0;
+}
+
+int RecordingReader::seek(unsigned int n)
+{
+    unsigned char sound_timer;
+    unsigned int k = 0;
+
+    // last keyframe at or before n
+    while (k + 1 < index_frames.size() && index_frames[k + 1] <= n)
+	k++;
+    if (index_frames.empty() || index_frames[k] > n)
+	return 1;
+    if (fseek(file, index_offsets[k], SEEK_SET))
+	return 1;
+    frame_no = index_frames[k];
+    while (frame_no < n)
+	if (next(sound_timer))
+	    return 1;
+    return 0;
+}
+
+int RecordingReader::pixel(unsigned int x, unsigned int y) const
+{
+    unsigned char byte = frame[y * (Chip8::VIDEO_WIDTH / 8) + x / 8];
+    return (byte >> (7 - x % 8)) & 1;
+}
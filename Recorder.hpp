@@ -0,0 +1,130 @@
+#ifndef __Recorder_H__
+#define __Recorder_H__
+
+#include <atomic>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Chip8.hpp"
+#include "SPSCQueue.hpp"
+
+/* Gameplay recording format (all integers little endian):
+
+   header:  "C8RC" version:u8 width:u8 height:u8 keyframe_interval:u16
+   frame:   type:u8 sound_timer:u8 length:u16 payload[length]
+   footer:  "C8IX" count:u32 {frame:u32 offset:u32}[count]
+	    index_offset:u32 "C8RE"
+
+   Frames are packed to one bit per pixel, row major, most significant
+   bit first (FRAME_BYTES bytes). A KEYFRAME payload is the packed frame,
+   a DELTA payload is the packed frame XORed with the previous one. Both
+   are compressed with PackBits run-length encoding. The footer indexes
+   every keyframe so readers can seek without decoding the whole file.
+   It is only written by close(): the reader rebuilds the index of a
+   recording cut short by scanning its frames, and frames are flushed
+   to the file at every keyframe. Offsets are 32 bits, so frame data
+   stops at 4 GiB: frames past that are dropped and counted. */
+
+class Recorder
+{
+public:
+    static const unsigned int FRAME_BYTES =
+	Chip8::VIDEO_WIDTH * Chip8::VIDEO_HEIGHT / 8;
+    static const unsigned int QUEUE_SIZE = 256;
+    static const unsigned char VERSION = 1;
+    static const unsigned char KEYFRAME = 0;
+    static const unsigned char DELTA = 1;
+    // largest offset the footer can hold
+    static const unsigned long long MAX_OFFSET = 0xFFFFFFFFULL;
+
+    struct Frame
+    {
+	unsigned char sound_timer;
+	unsigned char data[FRAME_BYTES];
+    };
+
+private:
+    SPSCQueue<Frame, QUEUE_SIZE> queue;
+    std::thread writer;
+    std::atomic<bool> running;
+    std::atomic<unsigned int> dropped;
+
+    // writer thread state
+    FILE *file = nullptr;
+    unsigned int keyframe_interval = 0;
+    unsigned int frame_count = 0;
+    unsigned char prev[FRAME_BYTES];
+    std::vector<unsigned int> index;
+
+    void writer_loop();
+    void write_frame(const Frame &frame);
+
+public:
+    Recorder();
+    ~Recorder();
+
+    /* Creates the recording file and starts the writer thread.
+       Returns 0 upon success or 1 otherwise */
+    int open(const std::string &path, unsigned int keyframe_interval = 300);
+
+    /* Queues a frame for writing. Never blocks: if the writer thread
+       falls behind the frame is dropped and counted */
+    void record_frame(const unsigned char gfx[][Chip8::VIDEO_HEIGHT],
+		      unsigned char sound_timer);
+
+    /* Flushes pending frames, writes the keyframe index and closes */
+    void close();
+
+    bool is_open() const { return file != nullptr; }
+    unsigned int frames_dropped() const { return dropped.load(); }
+};
+
+/* Sequential and seeking reader for recordings written by Recorder */
+class RecordingReader
+{
+    FILE *file = nullptr;
+    unsigned int keyframe_interval = 0;
+    unsigned int frame_no = 0;
+    std::vector<unsigned int> index_frames;
+    std::vector<unsigned int> index_offsets;
+    unsigned char frame[Recorder::FRAME_BYTES];
+
+    int read_index();
+    int scan_index();
+
+public:
+    ~RecordingReader();
+
+    /* Opens a recording and loads its keyframe index, or rebuilds it
+       from the frames if the recording has no footer. Frames after
+       the last whole one are ignored. Returns 0 upon success or 1
+       otherwise */
+    int open(const std::string &path);
+
+    /* Decodes the next frame into frame. Returns 1 at end of file */
+    int next(unsigned char &sound_timer);
+
+    /* Positions the reader so that next() returns frame n */
+    int seek(unsigned int n);
+
+    /* Current packed frame */
+    const unsigned char *data() const { return frame; }
+
+    /* Pixel (x, y) of the current frame */
+    int pixel(unsigned int x, unsigned int y) const;
+
+    unsigned int frames_indexed() const { return index_frames.size(); }
+};
+
+// packing and PackBits helpers shared by the recorder and the converter
+
+void pack_frame(const unsigned char gfx[][Chip8::VIDEO_HEIGHT],
+		unsigned char out[Recorder::FRAME_BYTES]);
+unsigned int rle_encode(const unsigned char *in, unsigned int len,
+			unsigned char *out);
+int rle_decode(const unsigned char *in, unsigned int len,
+	       unsigned char *out, unsigned int out_len);
+
+#endif /* defined(__Recorder_H__) */
@@ -0,0 +1,150 @@
+#include "Rewind.hpp"
+
+#include <cstring>
+
+const unsigned int RewindBuffer::BLOCK_SIZE;
+const unsigned int RewindBuffer::BLOCKS;
+const unsigned int RewindBuffer::ROW_BYTES;
+
+RewindBuffer::RewindBuffer(size_t budget, unsigned int keyframe_interval)
+    : budget(budget),
+      keyframe_interval(keyframe_interval > 0 ? keyframe_interval : 1)
+{
+}
+
+void RewindBuffer::push(const Chip8 &chip8)
+{
+    Snapshot snap;
+    snap.keyframe = history.empty() || since_keyframe + 1 >= keyframe_interval;
+    since_keyframe = snap.keyframe ? 0 : since_keyframe + 1;
+    snap.regs = chip8.get_registers();
+
+    const unsigned char *mem = chip8.get_memory();
+    unsigned char packed[Recorder::FRAME_BYTES];
+    pack_frame(chip8.gfx, packed);
+
+    // find what changed first so that data is allocated once, exactly
+    snap.block_mask = 0;
+    snap.row_mask = 0;
+    unsigned int size = 0;
+    for (unsigned int b = 0; b < BLOCKS; b++)
+    {
+	unsigned int offset = b * BLOCK_SIZE;
+	if (snap.keyframe ||
+	    memcmp(&mem[offset], &memory[offset], BLOCK_SIZE) != 0)
+	{
+	    snap.block_mask |= 1ULL << b;
+	    size += BLOCK_SIZE;
+	}
+    }
+    for (unsigned int y = 0; y < Chip8::VIDEO_HEIGHT; y++)
+    {
+	unsigned int offset = y * ROW_BYTES;
+	if (snap.keyframe ||
+	    memcmp(&packed[offset], &display[offset], ROW_BYTES) != 0)
+	{
+	    snap.row_mask |= 1U << y;
+	    size += ROW_BYTES;
+	}
+    }
+
+    snap.data.reserve(size);
+    for (unsigned int b = 0; b < BLOCKS; b++)
+	if (snap.block_mask & (1ULL << b))
+	    snap.data.insert(snap.data.end(), &mem[b * BLOCK_SIZE],
+			     &mem[(b + 1) * BLOCK_SIZE]);
+    for (unsigned int y = 0; y < Chip8::VIDEO_HEIGHT; y++)
+	if (snap.row_mask & (1U << y))
+	    snap.data.insert(snap.data.end(), &packed[y * ROW_BYTES],
+			     &packed[(y + 1) * ROW_BYTES]);
+
+    memcpy(memory, mem, sizeof(memory));
+    memcpy(display, packed, sizeof(display));
+    used += snapshot_bytes(snap);
+    history.push_back(std::move(snap));
+    evict();
+}
+
+void RewindBuffer::apply(const Snapshot &snap)
+{
+    const unsigned char *p = snap.data.data();
+    for (unsigned int b = 0; b < BLOCKS; b++)
+    {
+	if (snap.block_mask & (1ULL << b))
+	{
+	    memcpy(&memory[b * BLOCK_SIZE], p, BLOCK_SIZE);
+	    p += BLOCK_SIZE;
+	}
+    }
+    for (unsigned int y = 0; y < Chip8::VIDEO_HEIGHT; y++)
+    {
+	if (snap.row_mask & (1U << y))
+	{
+	    memcpy(&display[y * ROW_BYTES], p, ROW_BYTES);
+	    p += ROW_BYTES;
+	}
+    }
+}
+
+void RewindBuffer::rebuild(size_t n)
+{
+    size_t k = n;
+    while (!history[k].keyframe)
+	k--;
+    for (size_t i = k; i <= n; i++)
+	apply(history[i]);
+}
+
+void RewindBuffer::evict()
+{
+    // drop whole keyframe intervals from the front, never the newest one
+    while (used > budget)
+    {
+	size_t next = 1;
+	while (next < history.size() && !history[next].keyframe)
+	    next++;
+	if (next == history.size())
+	    break;
+	for (size_t i = 0; i < next; i++)
+	{
+	    used -= snapshot_bytes(history.front());
+	    history.pop_front();
+	}
+    }
+}
+
+unsigned int RewindBuffer::rewind(Chip8 &chip8, unsigned int frames)
+{
+    if (history.empty())
+	return 0;
+    if (frames > size())
+	frames = size();
+
+    for (unsigned int i = 0; i < frames; i++)
+    {
+	used -= snapshot_bytes(history.back());
+	history.pop_back();
+    }
+    rebuild(history.size() - 1);
+
+    since_keyframe = 0;
+    for (size_t i = history.size() - 1; !history[i].keyframe; i--)
+	since_keyframe++;
+
+    unsigned char gfx[Chip8::VIDEO_WIDTH][Chip8::VIDEO_HEIGHT];
+    for (unsigned int y = 0; y < Chip8::VIDEO_HEIGHT; y++)
+	for (unsigned int x = 0; x < Chip8::VIDEO_WIDTH; x++)
+	    gfx[x][y] = (display[y * ROW_BYTES + x / 8] >> (7 - x % 8)) & 1;
+
+    chip8.set_registers(history.back().regs);
+    chip8.load_memory(memory);
+    chip8.load_display(gfx);
+    return frames;
+}
+
+void RewindBuffer::clear()
+{
+    history.clear();
+    used = 0;
+    since_keyframe = 0;
+}
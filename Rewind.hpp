@@ -0,0 +1,81 @@
+#ifndef __Rewind_H__
+#define __Rewind_H__
+
+#include <cstddef>
+#include <deque>
+#include <vector>
+
+#include "Chip8.hpp"
+#include "Recorder.hpp"
+
+/* In-memory history of the machine state for rewinding, one snapshot
+   per emulated frame. A snapshot stores the registers plus only the
+   memory blocks and display rows that changed since the previous one;
+   every keyframe_interval frames a snapshot stores everything. Any frame
+   in the window is rebuilt from its keyframe by applying at most
+   keyframe_interval - 1 deltas. When the history grows past the memory
+   budget its oldest keyframe and the deltas after it are dropped. */
+class RewindBuffer
+{
+public:
+    static const unsigned int BLOCK_SIZE = 64;
+    static const unsigned int BLOCKS = Chip8::MEMORY_SIZE / BLOCK_SIZE;
+    static const unsigned int ROW_BYTES = Chip8::VIDEO_WIDTH / 8;
+
+private:
+    struct Snapshot
+    {
+	bool keyframe;
+	Chip8::Registers regs;
+	unsigned long long block_mask; // bit i: memory block i stored
+	unsigned int row_mask;         // bit y: display row y stored
+	// the stored blocks, then the stored rows packed one bit per pixel
+	std::vector<unsigned char> data;
+    };
+
+    std::deque<Snapshot> history;
+    size_t budget;
+    size_t used = 0;
+    unsigned int keyframe_interval;
+    unsigned int since_keyframe = 0;
+
+    // state of the newest snapshot, that deltas are taken against
+    unsigned char memory[Chip8::MEMORY_SIZE];
+    unsigned char display[Recorder::FRAME_BYTES];
+
+    static size_t snapshot_bytes(const Snapshot &snap)
+    {
+	return sizeof(Snapshot) + snap.data.capacity();
+    }
+
+    void apply(const Snapshot &snap);
+    void rebuild(size_t n);
+    void evict();
+
+public:
+    /* Keeps as many frames as fit in budget bytes (at least one
+       keyframe interval) */
+    RewindBuffer(size_t budget = 8 << 20, unsigned int keyframe_interval = 60);
+
+    /* Records the state of chip8 as the newest frame */
+    void push(const Chip8 &chip8);
+
+    /* Restores chip8 to the state frames frames before the newest one
+       and forgets the frames after it, so that emulation continues from
+       there. Returns the number of frames actually rewound, which is
+       less than frames when the history is shorter */
+    unsigned int rewind(Chip8 &chip8, unsigned int frames);
+
+    void clear();
+
+    /* Number of frames that can be rewound */
+    unsigned int size() const
+    {
+	return history.empty() ? 0 : history.size() - 1;
+    }
+
+    /* Memory used by the history */
+    size_t bytes() const { return used; }
+};
+
+#endif /* defined(__Rewind_H__) */
@@ -0,0 +1,195 @@
+#include "RomCache.hpp"
+#include "Analysis.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+
+const unsigned int RomCache::VERSION;
+
+static const unsigned int HEADER_SIZE = 32;
+static const uint32_t ENDIAN_MARK = 0x01020304;
+
+RomCache::RomCache(const std::string &dir)
+    : dir(dir)
+{
+    worker = std::thread(&RomCache::worker_loop, this);
+}
+
+RomCache::~RomCache()
+{
+    {
+	std::lock_guard<std::mutex> guard(lock);
+	stopping = true;
+    }
+    wake.notify_one();
+    worker.join();
+    for (std::map<unsigned long long, Mapping>::iterator it = mapped.begin();
+	 it != mapped.end(); ++it)
+	munmap(it->second.base, it->second.size);
+}
+
+unsigned long long RomCache::key(const unsigned char *rom, unsigned int size)
+{
+    unsigned long long hash = 0xCBF29CE484222325ULL;
+    unsigned char prefix[8];
+    for (unsigned int i = 0; i < 4; i++)
+    {
+	prefix[i] = size >> (8 * i);
+	prefix[4 + i] = VERSION >> (8 * i);
+    }
+    for (unsigned int i = 0; i < sizeof(prefix); i++)
+	hash = (hash ^ prefix[i]) * 0x100000001B3ULL;
+    for (unsigned int i = 0; i < size; i++)
+	hash = (hash ^ rom[i]) * 0x100000001B3ULL;
+    return hash;
+}
+
+int RomCache::map_entry(const std::string &path, unsigned long long key,
+			unsigned int rom_size, Mapping &mapping)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+	return 1;
+    struct stat st;
+    if (fstat(fd, &st) || st.st_size < HEADER_SIZE)
+    {
+	close(fd);
+	return 1;
+    }
+    size_t size = st.st_size;
+    void *base = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+	return 1;
+
+    const unsigned char *p = (const unsigned char *)base;
+    uint32_t header[3];
+    uint64_t stored_key;
+    uint32_t fields[2];
+    memcpy(header, p + 4, sizeof(header));
+    memcpy(&stored_key, p + 16, sizeof(stored_key));
+    memcpy(fields, p + 24, sizeof(fields));
+    if (memcmp(p, "C8AC", 4) != 0 || header[0] != VERSION ||
+	header[1] != ENDIAN_MARK || header[2] != rom_size || stored_key != key ||
+	fields[0] > Chip8::PROFILE_SUPER_CHIP ||
+	size != HEADER_SIZE + 2 * (size_t)fields[1])
+    {
+	munmap(base, size);
+	return 1;
+    }
+
+    mapping.base = base;
+    mapping.size = size;
+    mapping.entry.profile = (Chip8::Profile)fields[0];
+    mapping.entry.idle_loops = (const unsigned short *)(p + HEADER_SIZE);
+    mapping.entry.idle_count = fields[1];
+    return 0;
+}
+
+int RomCache::write_entry(const std::string &path, unsigned long long key,
+			  const unsigned char *rom, unsigned int size)
+{
+    // the same memory image and profile detection a session gets
+    Chip8 machine;
+    if (machine.load_rom(rom, size))
+	return 1;
+    const unsigned char *memory = machine.get_memory();
+    uint32_t profile = machine.get_profile();
+    RomAnalysis analysis;
+    analysis.analyze(memory);
+
+    uint32_t header[3] = {VERSION, ENDIAN_MARK, size};
+    uint32_t fields[2] = {profile, (uint32_t)analysis.idle_loops.size()};
+    std::vector<unsigned char> data(HEADER_SIZE);
+    memcpy(&data[0], "C8AC", 4);
+    memcpy(&data[4], header, sizeof(header));
+    memcpy(&data[16], &key, sizeof(key));
+    memcpy(&data[24], fields, sizeof(fields));
+    const unsigned char *idle = (const unsigned char *)analysis.idle_loops.data();
+    data.insert(data.end(), idle, idle + 2 * analysis.idle_loops.size());
+
+    // written aside and renamed into place: another process reading or
+    // writing the same entry sees either none or all of it
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), ".%d.tmp", (int)getpid());
+    std::string temp = path + suffix;
+    int fd = open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+	return 1;
+    size_t written = 0;
+    while (written < data.size())
+    {
+	ssize_t n = write(fd, &data[written], data.size() - written);
+	if (n <= 0)
+	    break;
+	written += n;
+    }
+    if (close(fd) || written < data.size() || rename(temp.c_str(), path.c_str()))
+    {
+	unlink(temp.c_str());
+	return 1;
+    }
+    return 0;
+}
+
+std::string RomCache::entry_path(unsigned long long key) const
+{
+    char name[32];
+    snprintf(name, sizeof(name), "/%016llx.c8ac", key);
+    return dir + name;
+}
+
+void RomCache::worker_loop()
+{
+    for (;;)
+    {
+	Job job;
+	{
+	    std::unique_lock<std::mutex> guard(lock);
+	    wake.wait(guard, [&] { return !jobs.empty() || stopping; });
+	    if (stopping)
+		return;
+	    job = std::move(jobs.front());
+	    jobs.pop_front();
+	}
+
+	std::string path = entry_path(job.key);
+	unsigned int size = job.rom.size();
+	Mapping mapping;
+	if (map_entry(path, job.key, size, mapping) &&
+	    (write_entry(path, job.key, job.rom.data(), size) ||
+	     map_entry(path, job.key, size, mapping)))
+	    continue;
+	std::lock_guard<std::mutex> guard(lock);
+	mapped[job.key] = mapping;
+    }
+}
+
+const RomCache::Entry *RomCache::get(const unsigned char *rom, unsigned int size)
+{
+    if (size > Chip8::MAX_ROM_SIZE)
+	return nullptr;
+    unsigned long long k = key(rom, size);
+    std::lock_guard<std::mutex> guard(lock);
+    std::map<unsigned long long, Mapping>::iterator it = mapped.find(k);
+    if (it != mapped.end())
+    {
+	hits++;
+	return &it->second.entry;
+    }
+    misses++;
+    if (requested.insert(k).second)
+    {
+	jobs.push_back(Job());
+	jobs.back().key = k;
+	jobs.back().rom.assign(rom, rom + size);
+	wake.notify_one();
+    }
+    return nullptr;
+}
@@ -0,0 +1,102 @@
+#ifndef __RomCache_H__
+#define __RomCache_H__
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Chip8.hpp"
+
+/* Directory of what a session needs derived from its ROM: the quirks
+   profile detect_profile() picks and the waiting loops RomAnalysis
+   finds, for Chip8::set_idle_loops(). Entries are keyed by a hash of
+   the ROM and VERSION, written once by whichever process meets the ROM
+   first (to a temporary file renamed into place, so readers never see
+   half an entry) and memory-mapped read-only by everyone after, sharing
+   the pages between processes. Mapped entries stay mapped until the
+   cache is destroyed: the set of ROMs served is expected to be small.
+
+   get() never touches the disk: a ROM it has no entry for yet is handed
+   to the cache's own thread, which maps the entry or analyzes the ROM
+   and writes it, for the calls that come after.
+
+   Entry file, NAME.c8ac with NAME the 16 hex digits of the key, in the
+   byte order of the machine that wrote it (checked on load):
+
+	"C8AC" version:u32 byte_order:u32 rom_size:u32 key:u64 profile:u32
+	idle_count:u32 idle:u16[idle_count] */
+class RomCache
+{
+public:
+    /* Bumped whenever the analysis, profile detection or file layout
+       changes, which retires every entry written before */
+    static const unsigned int VERSION = 3;
+
+    /* A mapped entry. Valid until the cache is destroyed */
+    struct Entry
+    {
+	Chip8::Profile profile;
+	const unsigned short *idle_loops;   // sorted
+	unsigned int idle_count;
+    };
+
+private:
+    struct Mapping
+    {
+	void *base;
+	size_t size;
+	Entry entry;
+    };
+
+    struct Job
+    {
+	unsigned long long key;
+	std::vector<unsigned char> rom;
+    };
+
+    std::string dir;
+    std::mutex lock;
+    std::map<unsigned long long, Mapping> mapped;
+    std::set<unsigned long long> requested;   // queued, done or failed for good
+    std::deque<Job> jobs;
+    std::condition_variable wake;
+    bool stopping = false;
+    std::thread worker;
+    unsigned long long hits = 0;
+    unsigned long long misses = 0;
+
+    void worker_loop();
+    std::string entry_path(unsigned long long key) const;
+    int map_entry(const std::string &path, unsigned long long key,
+		  unsigned int rom_size, Mapping &mapping);
+    int write_entry(const std::string &path, unsigned long long key,
+		    const unsigned char *rom, unsigned int size);
+
+public:
+    /* Entries are kept in dir, which must exist */
+    RomCache(const std::string &dir);
+    ~RomCache();
+
+    RomCache(const RomCache&) = delete;
+    RomCache &operator=(const RomCache&) = delete;
+
+    /* Entry for size bytes of rom if it is mapped already. Otherwise
+       nullptr, and the entry is read or computed in the background. A
+       ROM whose entry can be neither read nor written stays without
+       one. Thread safe */
+    const Entry *get(const unsigned char *rom, unsigned int size);
+
+    /* Key of a ROM: 64-bit FNV-1a of its size, bytes and VERSION */
+    static unsigned long long key(const unsigned char *rom, unsigned int size);
+
+    /* get() calls that found an entry, and calls that did not */
+    unsigned long long get_hits() const { return hits; }
+    unsigned long long get_misses() const { return misses; }
+};
+
+#endif /* defined(__RomCache_H__) */
@@ -0,0 +1,64 @@
+#ifndef __SPSCQueue_H__
+#define __SPSCQueue_H__
+
+#include <atomic>
+#include <cstddef>
+
+/* Bounded lock-free single-producer/single-consumer queue.
+   SIZE must be a power of two; one slot is always left empty to tell
+   a full queue from an empty one. push() and pop() never block: they
+   return false when the queue is full or empty respectively. */
+template <typename T, unsigned int SIZE>
+class SPSCQueue
+{
+    static_assert((SIZE & (SIZE - 1)) == 0, "SIZE must be a power of two");
+
+    static const unsigned int MASK = SIZE - 1;
+    static const std::size_t CACHE_LINE = 64;
+
+    T slots[SIZE];
+    // head is written by the consumer, tail by the producer
+    alignas(CACHE_LINE) std::atomic<unsigned int> head;
+    alignas(CACHE_LINE) std::atomic<unsigned int> tail;
+
+public:
+    SPSCQueue() : head(0), tail(0) {}
+
+    /* Producer side. Returns false if the queue is full */
+    bool push(const T &item)
+    {
+	unsigned int t = tail.load(std::memory_order_relaxed);
+	unsigned int next = (t + 1) & MASK;
+	if (next == head.load(std::memory_order_acquire))
+	    return false;
+	slots[t] = item;
+	tail.store(next, std::memory_order_release);
+	return true;
+    }
+
+    /* Consumer side. Returns false if the queue is empty */
+    bool pop(T &item)
+    {
+	unsigned int h = head.load(std::memory_order_relaxed);
+	if (h == tail.load(std::memory_order_acquire))
+	    return false;
+	item = slots[h];
+	head.store((h + 1) & MASK, std::memory_order_release);
+	return true;
+    }
+
+    /* Number of queued items. Only approximate while the other side runs */
+    unsigned int size() const
+    {
+	return (tail.load(std::memory_order_acquire) -
+		head.load(std::memory_order_acquire)) & MASK;
+    }
+
+    bool empty() const
+    {
+	return head.load(std::memory_order_acquire) ==
+	    tail.load(std::memory_order_acquire);
+    }
+};
+
+#endif /* defined(__SPSCQueue_H__) */
@@ -0,0 +1,70 @@
+#ifndef __ServerProtocol_H__
+#define __ServerProtocol_H__
+
+#include <stdint.h>
+
+#include "Chip8.hpp"
+
+/* Protocol spoken by chip8_server over its Unix domain socket. Every
+   message, in both directions, is a MsgHeader followed by length bytes
+   of payload. Integers are in host byte order: client and server run on
+   the same machine. Every request gets exactly one reply with the same
+   type and session, a status and possibly a payload. A client may send
+   requests without waiting for replies; replies come in order, except
+   that MSG_STEP replies once its frames have run. The server stops
+   reading from a client that leaves more than a few replies unread and
+   closes it if it does not catch up within a few seconds.
+
+   request       payload                       reply payload
+   MSG_CREATE    ROM image                     - (session in the header)
+   MSG_INPUT     keys:u16, bit i is key i      -
+   MSG_STEP      frames:u32                    frame:u64
+   MSG_RUN       realtime:u8                   -
+   MSG_FRAME     -                             frame:u64 sound_timer:u8
+						 packed display (MSG_FRAME_BYTES)
+   MSG_SNAPSHOT  -                             Chip8::Registers, memory
+						 (MEMORY_SIZE), packed display
+   MSG_DESTROY   -                             -
+
+   Packed displays are one bit per pixel, row major, most significant
+   bit first, like Recorder frames. A session in realtime mode advances
+   one frame per server tick (60 Hz); MSG_STEP runs frames as fast as
+   possible on top of that. A session belongs to the connection that
+   created it: requests from any other get STATUS_NO_SESSION, and it is
+   destroyed when that connection closes. */
+
+enum MsgType
+{
+    MSG_CREATE = 1,
+    MSG_INPUT,
+    MSG_STEP,
+    MSG_RUN,
+    MSG_FRAME,
+    MSG_SNAPSHOT,
+    MSG_DESTROY
+};
+
+enum MsgStatus
+{
+    STATUS_OK,
+    STATUS_BAD_REQUEST, // unknown type or malformed payload
+    STATUS_NO_SESSION,
+    STATUS_BAD_ROM,
+    STATUS_FULL         // session limit reached
+};
+
+struct MsgHeader
+{
+    uint32_t length;  // payload bytes following the header
+    uint8_t type;     // MsgType
+    uint8_t status;   // MsgStatus, replies only
+    uint16_t reserved;
+    uint32_t session;
+};
+
+static const uint32_t MSG_MAX_PAYLOAD = 8192;
+static const uint32_t MSG_MAX_STEP = 60 * 60; // frames per MSG_STEP
+static const unsigned int MSG_FRAME_BYTES =
+    Chip8::VIDEO_WIDTH * Chip8::VIDEO_HEIGHT / 8;
+
+#endif /* defined(__ServerProtocol_H__) */
@@ -0,0 +1,676 @@
+#include "SessionServer.hpp"
+#include "FramePacer.hpp"
+#include "Recorder.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+const unsigned int SessionServer::FPS;
+const unsigned int SessionServer::FREQ;
+const unsigned int SessionServer::CHUNK;
+const unsigned int SessionServer::MAX_PENDING_IN;
+const unsigned int SessionServer::MAX_PENDING_OUT;
+const unsigned int SessionServer::CLIENT_TIMEOUT_MS;
+
+// epoll user data for the fds that are not clients
+static const uint64_t EV_LISTEN = 1ULL << 32;
+static const uint64_t EV_TIMER = 2ULL << 32;
+static const uint64_t EV_DONE = 3ULL << 32;
+static const uint64_t EV_STOP = 4ULL << 32;
+
+SessionServer::SessionServer()
+    : metrics(FPS), working(0)
+{
+}
+
+/* NUMA node of cpu as sysfs lists it, or -1 */
+static int cpu_node(int cpu)
+{
+    for (int node = 0; node < 64; node++)
+    {
+	char path[64];
+	snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpu%d", node, cpu);
+	if (access(path, F_OK) == 0)
+	    return node;
+    }
+    return -1;
+}
+
+SessionServer::~SessionServer()
+{
+    close();
+}
+
+int SessionServer::open(const std::string &path, unsigned int nworkers,
+			unsigned int max_sessions)
+{
+    SessionServer::path = path;
+    SessionServer::max_sessions = max_sessions;
+
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path))
+	return 1;
+    strcpy(addr.sun_path, path.c_str());
+    unlink(path.c_str());
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listen_fd == -1 ||
+	bind(listen_fd, (sockaddr*)&addr, sizeof(addr)) == -1 ||
+	listen(listen_fd, 128) == -1)
+	return 1;
+
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    done_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (timer_fd == -1 || done_fd == -1 || stop_fd == -1 || epoll_fd == -1)
+	return 1;
+
+    itimerspec period;
+    period.it_interval.tv_sec = 0;
+    period.it_interval.tv_nsec = 1000000000 / FPS;
+    period.it_value = period.it_interval;
+    timerfd_settime(timer_fd, 0, &period, nullptr);
+
+    const int fds[] = {listen_fd, timer_fd, done_fd, stop_fd};
+    const uint64_t tags[] = {EV_LISTEN, EV_TIMER, EV_DONE, EV_STOP};
+    for (unsigned int i = 0; i < 4; i++)
+    {
+	epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.u64 = tags[i];
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fds[i], &ev) == -1)
+	    return 1;
+    }
+
+    if (nworkers == 0)
+	nworkers = 1;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    queues = std::vector<HomeQueue>(nworkers);
+    home_sessions.assign(nworkers, 0);
+    pool.set_homes(nworkers);
+    for (unsigned int i = 0; i < nworkers; i++)
+    {
+	queues[i].next = 0;
+	workers.push_back(std::thread(&SessionServer::worker_loop, this, i));
+	int cpu = i % (cpus > 0 ? cpus : 1);
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	// best effort: without it the scheduler places the worker, and the
+	// slabs of its sessions, wherever the kernel sees fit
+	if (pthread_setaffinity_np(workers.back().native_handle(), sizeof(set), &set) == 0)
+	    pool.set_node(i, cpu_node(cpu));
+    }
+    return 0;
+}
+
+void SessionServer::close()
+{
+    {
+	std::lock_guard<std::mutex> guard(lock);
+	stopping = true;
+    }
+    wake.notify_all();
+    for (size_t i = 0; i < workers.size(); i++)
+	workers[i].join();
+    workers.clear();
+
+    for (std::map<int, Client>::iterator it = clients.begin();
+	 it != clients.end(); ++it)
+	::close(it->first);
+    clients.clear();
+    while (!sessions.empty())
+	destroy_session(sessions.begin()->second);
+
+    const int fds[] = {epoll_fd, listen_fd, timer_fd, done_fd, stop_fd};
+    for (unsigned int i = 0; i < 5; i++)
+	if (fds[i] != -1)
+	    ::close(fds[i]);
+    epoll_fd = listen_fd = timer_fd = done_fd = stop_fd = -1;
+    if (path != "")
+	unlink(path.c_str());
+    path = "";
+}
+
+void SessionServer::stop()
+{
+    uint64_t one = 1;
+    if (write(stop_fd, &one, sizeof(one)) != sizeof(one))
+	return;
+}
+
+void SessionServer::run()
+{
+    epoll_event events[64];
+    unsigned int ticks = 0;
+    for (;;)
+    {
+	int n = epoll_wait(epoll_fd, events, 64, -1);
+	if (n == -1 && errno != EINTR)
+	    return;
+	for (int i = 0; i < n; i++)
+	{
+	    uint64_t tag = events[i].data.u64;
+	    uint64_t count;
+	    if (tag == EV_STOP)
+		return;
+	    else if (tag == EV_LISTEN)
+		accept_clients();
+	    else if (tag == EV_TIMER)
+	    {
+		if (read(timer_fd, &count, sizeof(count)) != sizeof(count))
+		    continue;
+		if (in_flight)
+		    metrics.frames_late.fetch_add(1, std::memory_order_relaxed);
+		else
+		    dispatch();
+		if (++ticks % FPS == 0)
+		    close_blocked_clients();
+	    }
+	    else if (tag == EV_DONE)
+	    {
+		if (read(done_fd, &count, sizeof(count)) == sizeof(count))
+		    finish_batch();
+	    }
+	    else
+	    {
+		int fd = (int)tag;
+		std::map<int, Client>::iterator client = clients.find(fd);
+		if (client == clients.end())
+		    continue;
+		if (events[i].events & EPOLLOUT)
+		    write_client(client->second);
+		// reads up to the hangup, then closes. A client not read
+		// from has requests queued that it will never see replies to
+		if ((events[i].events & (EPOLLHUP | EPOLLERR)) &&
+		    !(client->second.events & EPOLLIN))
+		    close_client(fd);
+		else if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+		    read_client(fd);
+		else if (!in_flight)
+		    // replies drained: requests held back may go on
+		    process_requests(client->second);
+	    }
+	}
+    }
+}
+
+// emulation
+
+void SessionServer::worker_loop(unsigned int home)
+{
+    unsigned long long seen = 0;
+    for (;;)
+    {
+	{
+	    std::unique_lock<std::mutex> guard(lock);
+	    wake.wait(guard, [&] { return generation != seen || stopping; });
+	    if (stopping)
+		return;
+	    seen = generation;
+	}
+	unsigned long long frames = 0;
+	unsigned long long instructions = 0;
+	// home sessions first, then whatever the other workers have left
+	for (size_t i = 0; i < queues.size(); i++)
+	    run_queue(queues[(home + i) % queues.size()], frames, instructions);
+	metrics.frames.fetch_add(frames, std::memory_order_relaxed);
+	metrics.instructions.fetch_add(instructions, std::memory_order_relaxed);
+	if (working.fetch_sub(1) == 1)
+	{
+	    uint64_t one = 1;
+	    if (write(done_fd, &one, sizeof(one)) != sizeof(one))
+		continue;
+	}
+    }
+}
+
+void SessionServer::run_queue(HomeQueue &queue, unsigned long long &frames,
+			      unsigned long long &instructions)
+{
+    for (;;)
+    {
+	size_t first = queue.next.fetch_add(CHUNK);
+	if (first >= queue.jobs.size())
+	    return;
+	size_t last = first + CHUNK < queue.jobs.size() ? first + CHUNK : queue.jobs.size();
+	for (size_t i = first; i < last; i++)
+	{
+	    Session &s = *queue.jobs[i];
+	    unsigned long long cycle = s.chip8.get_cycle();
+	    frames += run_session(s);
+	    instructions += s.chip8.get_cycle() - cycle;
+	}
+    }
+}
+
+unsigned int SessionServer::run_session(Session &s)
+{
+    unsigned int frames = (s.realtime ? 1 : 0) + s.steps;
+    for (unsigned int f = 0; f < frames; f++)
+    {
+	Chip8::RunResult result;
+	do
+	    result = s.chip8.run_frame();
+	while (!result.frame_end);
+	s.frames++;
+    }
+    return frames;
+}
+
+void SessionServer::dispatch()
+{
+    batch.clear();
+    for (size_t i = 0; i < queues.size(); i++)
+    {
+	queues[i].jobs.clear();
+	queues[i].next = 0;
+    }
+    for (std::map<unsigned int, Session*>::iterator it = sessions.begin();
+	 it != sessions.end(); ++it)
+	if (it->second->realtime || it->second->steps > 0)
+	{
+	    batch.push_back(it->second);
+	    queues[pool.home_of(it->second)].jobs.push_back(it->second);
+	}
+    if (batch.empty())
+	return;
+
+    in_flight = true;
+    batch_start = FramePacer::now_ns();
+    working = workers.size();
+    {
+	std::lock_guard<std::mutex> guard(lock);
+	generation++;
+    }
+    wake.notify_all();
+}
+
+void SessionServer::finish_batch()
+{
+    in_flight = false;
+    long long now = FramePacer::now_ns();
+    metrics.frame_build.observe((now - batch_start) / 1000);
+    if (now - speed_sampled >= 1000000000)
+    {
+	metrics.update_speed();
+	speed_sampled = now;
+    }
+
+    for (size_t i = 0; i < batch.size(); i++)
+    {
+	Session &s = *batch[i];
+	if (s.steps == 0)
+	    continue;
+	s.steps = 0;
+	std::map<int, Client>::iterator client = clients.find(s.step_fd);
+	if (client != clients.end() && client->second.id == s.step_client)
+	{
+	    MsgHeader h = {0, MSG_STEP, 0, 0, s.id};
+	    uint64_t frame = s.frames;
+	    reply(client->second, h, STATUS_OK, &frame, sizeof(frame));
+	}
+    }
+    batch.clear();
+    destroy_orphans();
+
+    // requests that arrived meanwhile
+    std::vector<int> fds;
+    for (std::map<int, Client>::iterator it = clients.begin();
+	 it != clients.end(); ++it)
+	fds.push_back(it->first);
+    for (size_t i = 0; i < fds.size(); i++)
+	if (clients.count(fds[i]))
+	    process_requests(clients[fds[i]]);
+}
+
+void SessionServer::destroy_orphans()
+{
+    for (size_t i = 0; i < closed_clients.size(); i++)
+    {
+	std::map<unsigned int, Session*>::iterator it = sessions.begin();
+	while (it != sessions.end())
+	{
+	    Session *s = it->second;
+	    ++it;
+	    if (s->owner == closed_clients[i])
+		destroy_session(s);
+	}
+    }
+    closed_clients.clear();
+    metrics.sessions = sessions.size();
+}
+
+void SessionServer::destroy_session(Session *s)
+{
+    sessions.erase(s->id);
+    home_sessions[pool.home_of(s)]--;
+    pool.release(s);
+}
+
+// clients
+
+void SessionServer::accept_clients()
+{
+    for (;;)
+    {
+	int fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (fd == -1)
+	    return;
+	epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.u64 = (unsigned int)fd;
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1)
+	{
+	    ::close(fd);
+	    continue;
+	}
+	Client &client = clients[fd];
+	client.fd = fd;
+	client.id = next_client++;
+	client.events = EPOLLIN;
+    }
+}
+
+void SessionServer::read_client(int fd)
+{
+    Client &client = clients[fd];
+    unsigned char buf[16384];
+    while (client.in.size() < MAX_PENDING_IN)
+    {
+	size_t room = MAX_PENDING_IN - client.in.size();
+	ssize_t n = read(fd, buf, room < sizeof(buf) ? room : sizeof(buf));
+	if (n > 0)
+	    client.in.insert(client.in.end(), buf, buf + n);
+	else if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+	    break;
+	else if (n == -1 && errno == EINTR)
+	    continue;
+	else
+	{
+	    close_client(fd);
+	    return;
+	}
+    }
+    if (!in_flight)
+	process_requests(client);
+    else
+	update_events(client);
+}
+
+void SessionServer::write_client(Client &client)
+{
+    size_t sent = 0;
+    while (sent < client.out.size())
+    {
+	ssize_t n = send(client.fd, &client.out[sent], client.out.size() - sent,
+			 MSG_NOSIGNAL);
+	if (n > 0)
+	    sent += n;
+	else if (n == -1 && errno == EINTR)
+	    continue;
+	else
+	    break;
+    }
+    client.out.erase(client.out.begin(), client.out.begin() + sent);
+    update_events(client);
+}
+
+void SessionServer::update_events(Client &client)
+{
+    // reads while there is room for a request and for its reply, and
+    // only waits for the socket to drain while there is something left
+    uint32_t events = 0;
+    if (client.in.size() < MAX_PENDING_IN && client.out.size() < MAX_PENDING_OUT)
+	events |= EPOLLIN;
+    if (!client.out.empty())
+	events |= EPOLLOUT;
+    if (events == client.events)
+	return;
+    epoll_event ev;
+    ev.events = events;
+    ev.data.u64 = (unsigned int)client.fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, client.fd, &ev);
+    client.events = events;
+}
+
+void SessionServer::close_client(int fd)
+{
+    std::map<int, Client>::iterator client = clients.find(fd);
+    if (client == clients.end())
+	return;
+    unsigned long long id = client->second.id;
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+    ::close(fd);
+    clients.erase(client);
+
+    // sessions in a batch are left alone until it is done
+    closed_clients.push_back(id);
+    if (!in_flight)
+	destroy_orphans();
+}
+
+void SessionServer::process_requests(Client &client)
+{
+    int fd = client.fd;
+    size_t pos = 0;
+    while (client.in.size() - pos >= sizeof(MsgHeader))
+    {
+	// replies go out as they pile up; requests wait while they cannot
+	if (client.out.size() >= MAX_PENDING_OUT)
+	{
+	    write_client(client);
+	    if (client.out.size() >= MAX_PENDING_OUT)
+		break;
+	}
+	MsgHeader h;
+	memcpy(&h, &client.in[pos], sizeof(h));
+	if (h.length > MSG_MAX_PAYLOAD)
+	{
+	    close_client(fd);
+	    return;
+	}
+	if (client.in.size() - pos < sizeof(h) + h.length)
+	    break;
+	handle(client, h, &client.in[pos + sizeof(h)]);
+	pos += sizeof(h) + h.length;
+    }
+    client.in.erase(client.in.begin(), client.in.begin() + pos);
+    if (!client.out.empty())
+	write_client(client);
+
+    // a client that does not read its replies gets no more of them,
+    // and is closed by close_blocked_clients() if that goes on
+    if (client.out.size() < MAX_PENDING_OUT)
+	client.blocked_since = 0;
+    else if (client.blocked_since == 0)
+	client.blocked_since = FramePacer::now_ns();
+    update_events(client);
+}
+
+void SessionServer::close_blocked_clients()
+{
+    long long now = FramePacer::now_ns();
+    std::vector<int> fds;
+    for (std::map<int, Client>::iterator it = clients.begin();
+	 it != clients.end(); ++it)
+	if (it->second.blocked_since != 0 &&
+	    now - it->second.blocked_since > CLIENT_TIMEOUT_MS * 1000000LL)
+	    fds.push_back(it->first);
+    for (size_t i = 0; i < fds.size(); i++)
+	close_client(fds[i]);
+}
+
+/* Session h is about, if client owns it */
+SessionServer::Session *SessionServer::find(const Client &client, const MsgHeader &h)
+{
+    std::map<unsigned int, Session*>::iterator it = sessions.find(h.session);
+    if (it == sessions.end() || it->second->owner != client.id)
+	return nullptr;
+    return it->second;
+}
+
+void SessionServer::handle(Client &client, const MsgHeader &h,
+			   const unsigned char *payload)
+{
+    if (h.type == MSG_CREATE)
+    {
+	if (sessions.size() >= max_sessions)
+	{
+	    reply(client, h, STATUS_FULL);
+	    return;
+	}
+	// homed on the worker with the fewest sessions
+	unsigned int home = 0;
+	for (unsigned int i = 1; i < home_sessions.size(); i++)
+	    if (home_sessions[i] < home_sessions[home])
+		home = i;
+	Session *s = pool.allocate(home);
+	if (s == nullptr)
+	{
+	    reply(client, h, STATUS_FULL);
+	    return;
+	}
+	home_sessions[home]++;
+	// the cache answers from memory: the first sessions of a ROM it
+	// has not mapped yet detect their profile and run without idle loop
+	// skipping while it is analyzed
+	const RomCache::Entry *cached = nullptr;
+	if (rom_cache != nullptr && h.length > 0)
+	    cached = rom_cache->get(payload, h.length);
+	// with the profile known up front, loading the ROM selects the
+	// interpreter once and scans nothing
+	s->chip8.set_profile(cached != nullptr ? cached->profile : Chip8::PROFILE_AUTO,
+			     true);
+	if (h.length == 0 || s->chip8.load_rom(payload, h.length))
+	{
+	    home_sessions[home]--;
+	    pool.release(s);
+	    reply(client, h, STATUS_BAD_ROM);
+	    return;
+	}
+	if (cached != nullptr)
+	    s->chip8.set_idle_loops(cached->idle_loops, cached->idle_count);
+	s->chip8.set_speed(FREQ, FPS);
+	// a session blocked on FX0A costs nothing until its input arrives
+	s->chip8.set_stop_events(Chip8::EVENT_KEY_WAIT);
+	s->id = next_session++;
+	s->owner = client.id;
+	s->realtime = false;
+	s->steps = 0;
+	s->step_client = 0;
+	s->step_fd = -1;
+	s->frames = 0;
+	MsgHeader created = h;
+	created.session = s->id;
+	sessions[s->id] = s;
+	metrics.sessions = sessions.size();
+	reply(client, created, STATUS_OK);
+	return;
+    }
+
+    Session *s = find(client, h);
+    if (s == nullptr)
+    {
+	reply(client, h, STATUS_NO_SESSION);
+	return;
+    }
+
+    switch (h.type)
+    {
+    case MSG_INPUT:
+    {
+	if (h.length != 2)
+	    break;
+	uint16_t keys;
+	memcpy(&keys, payload, sizeof(keys));
+	for (unsigned int i = 0; i < Chip8::KEYS_SIZE; i++)
+	    s->chip8.key[i] = (keys >> i) & 1;
+	reply(client, h, STATUS_OK);
+	return;
+    }
+    case MSG_STEP:
+    {
+	uint32_t frames;
+	if (h.length != 4 || s->steps > 0)
+	    break;
+	memcpy(&frames, payload, sizeof(frames));
+	if (frames == 0 || frames > MSG_MAX_STEP)
+	    break;
+	// replied to once the next batch has run them
+	s->steps = frames;
+	s->step_client = client.id;
+	s->step_fd = client.fd;
+	return;
+    }
+    case MSG_RUN:
+	if (h.length != 1)
+	    break;
+	s->realtime = payload[0] != 0;
+	reply(client, h, STATUS_OK);
+	return;
+    case MSG_FRAME:
+    {
+	unsigned char frame[8 + 1 + MSG_FRAME_BYTES];
+	uint64_t n = s->frames;
+	memcpy(frame, &n, 8);
+	frame[8] = s->chip8.sound_timer;
+	pack_frame(s->chip8.gfx, &frame[9]);
+	reply(client, h, STATUS_OK, frame, sizeof(frame));
+	return;
+    }
+    case MSG_SNAPSHOT:
+    {
+	unsigned char snapshot[sizeof(Chip8::Registers) + Chip8::MEMORY_SIZE +
+			       MSG_FRAME_BYTES];
+	Chip8::Registers regs = s->chip8.get_registers();
+	memcpy(snapshot, &regs, sizeof(regs));
+	memcpy(&snapshot[sizeof(regs)], s->chip8.get_memory(), Chip8::MEMORY_SIZE);
+	pack_frame(s->chip8.gfx, &snapshot[sizeof(regs) + Chip8::MEMORY_SIZE]);
+	reply(client, h, STATUS_OK, snapshot, sizeof(snapshot));
+	return;
+    }
+    case MSG_DESTROY:
+	if (s->steps > 0)
+	{
+	    // the pending MSG_STEP is answered on its own connection
+	    std::map<int, Client>::iterator waiting = clients.find(s->step_fd);
+	    if (waiting != clients.end() && waiting->second.id == s->step_client)
+	    {
+		MsgHeader step = {0, MSG_STEP, 0, 0, s->id};
+		reply(waiting->second, step, STATUS_NO_SESSION);
+	    }
+	}
+	destroy_session(s);
+	metrics.sessions = sessions.size();
+	reply(client, h, STATUS_OK);
+	return;
+    }
+    reply(client, h, STATUS_BAD_REQUEST);
+}
+
+void SessionServer::reply(Client &client, const MsgHeader &request,
+			  MsgStatus status, const void *payload, uint32_t length)
+{
+    MsgHeader h = request;
+    h.length = length;
+    h.status = status;
+    const unsigned char *p = (const unsigned char*)&h;
+    client.out.insert(client.out.end(), p, p + sizeof(h));
+    p = (const unsigned char*)payload;
+    if (length > 0)
+	client.out.insert(client.out.end(), p, p + length);
+}
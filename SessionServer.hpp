@@ -0,0 +1,158 @@
+#ifndef __SessionServer_H__
+#define __SessionServer_H__
+
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Chip8.hpp"
+#include "Metrics.hpp"
+#include "RomCache.hpp"
+#include "ServerProtocol.hpp"
+#include "SlabPool.hpp"
+
+/* Headless server for many Chip8 sessions (see ServerProtocol.hpp).
+   One thread runs an epoll loop over the listening socket, the clients
+   and a 60 Hz timer. On every tick the sessions that have frames to run
+   are collected into a batch that a pool of worker threads, each pinned
+   to a core, runs to completion. While a batch is in flight the event
+   loop keeps reading from clients but leaves their requests queued, so
+   sessions are only ever touched by one thread at a time.
+
+   Every session has a home worker, the least loaded one when it was
+   created. It lives in that worker's slabs of a SlabPool, on the NUMA
+   node of the worker's core, and the worker runs its home sessions
+   before helping others with theirs, so a session mostly stays in the
+   caches of one core. */
+class SessionServer
+{
+public:
+    static const unsigned int FPS = 60;
+    static const unsigned int FREQ = 400;  // instructions per second
+    static const unsigned int CHUNK = 8;   // sessions a worker claims at once
+    // bytes queued per client: requests read but not handled yet, at
+    // most one whole request, and replies not sent yet. A client over
+    // MAX_PENDING_OUT is not read from and its requests are left queued
+    // until it reads its replies, and it is closed if that takes longer
+    // than CLIENT_TIMEOUT_MS (checked once a second)
+    static const unsigned int MAX_PENDING_IN = sizeof(MsgHeader) + MSG_MAX_PAYLOAD;
+    static const unsigned int MAX_PENDING_OUT = 4 * (sizeof(MsgHeader) + MSG_MAX_PAYLOAD);
+    static const unsigned int CLIENT_TIMEOUT_MS = 5000;
+
+private:
+    struct Session
+    {
+	Chip8 chip8;
+	unsigned int id;
+	unsigned long long owner;  // id of the client that created it
+	bool realtime;
+	unsigned int steps;        // frames to run for MSG_STEP
+	unsigned long long step_client; // client waiting for MSG_STEP
+	int step_fd;
+	unsigned long long frames;
+    };
+
+    // sessions of one home worker in the current batch
+    struct HomeQueue
+    {
+	std::vector<Session*> jobs;
+	std::atomic<size_t> next;
+	char pad[64];           // keeps the counters of two workers apart
+    };
+
+    struct Client
+    {
+	int fd;
+	unsigned long long id;
+	std::vector<unsigned char> in;
+	std::vector<unsigned char> out;
+	uint32_t events = 0;          // epoll events waited for
+	long long blocked_since = 0;  // when out went over MAX_PENDING_OUT
+    };
+
+    int epoll_fd = -1;
+    int listen_fd = -1;
+    int timer_fd = -1;
+    int done_fd = -1;   // eventfd, written by the worker finishing a batch
+    int stop_fd = -1;   // eventfd, written by stop()
+    std::string path;
+
+    SlabPool<Session> pool;
+    std::map<unsigned int, Session*> sessions;
+    std::vector<unsigned int> home_sessions;  // sessions per home worker
+    std::map<int, Client> clients;
+    unsigned int next_session = 1;
+    unsigned long long next_client = 1;
+    unsigned int max_sessions = 0;
+    std::vector<unsigned long long> closed_clients;
+    RomCache *rom_cache = nullptr;
+
+    // batch shared with the workers
+    std::vector<Session*> batch;
+    std::vector<HomeQueue> queues;
+    bool in_flight = false;
+    long long batch_start = 0;
+    long long speed_sampled = 0;
+    Metrics metrics;
+    std::vector<std::thread> workers;
+    std::mutex lock;
+    std::condition_variable wake;
+    unsigned long long generation = 0;
+    bool stopping = false;
+    std::atomic<unsigned int> working;
+
+    void worker_loop(unsigned int home);
+    static unsigned int run_session(Session &s);
+    void run_queue(HomeQueue &queue, unsigned long long &frames,
+		   unsigned long long &instructions);
+    void dispatch();
+    void finish_batch();
+    void destroy_orphans();
+    void destroy_session(Session *s);
+
+    void accept_clients();
+    void read_client(int fd);
+    void write_client(Client &client);
+    void update_events(Client &client);
+    void close_blocked_clients();
+    void close_client(int fd);
+    void process_requests(Client &client);
+    void handle(Client &client, const MsgHeader &h, const unsigned char *payload);
+    void reply(Client &client, const MsgHeader &request, MsgStatus status,
+	       const void *payload = nullptr, uint32_t length = 0);
+    Session *find(const Client &client, const MsgHeader &h);
+
+public:
+    SessionServer();
+    ~SessionServer();
+
+    /* Listens on the Unix socket at path and starts workers threads.
+       Returns 0 upon success or 1 otherwise */
+    int open(const std::string &path, unsigned int workers,
+	     unsigned int max_sessions);
+
+    /* Takes the profile of new sessions' ROMs and their idle loops
+       from cache instead of detecting the profile every time. Call
+       before run(); the cache must outlive close() */
+    void set_rom_cache(RomCache *cache) { rom_cache = cache; }
+
+    /* Serves clients until stop() is called */
+    void run();
+
+    /* Makes run() return. Async-signal-safe */
+    void stop();
+
+    /* Stops the workers and removes the socket */
+    void close();
+
+    /* Frames counts all sessions, frame_build times whole batches and
+       frames_late counts ticks skipped because a batch was still
+       running. Nothing is presented or queued */
+    const Metrics &get_metrics() const { return metrics; }
+};
+
+#endif /* defined(__SessionServer_H__) */
@@ -0,0 +1,92 @@
+#ifndef __SharedPage_H__
+#define __SharedPage_H__
+
+#include <atomic>
+#include <cstring>
+#include <new>
+
+/* Reference counted block of bytes shared copy-on-write. Copying a
+   PageRef shares the block; own() gives the caller a private copy the
+   first time it is about to write to a block somebody else still
+   references. Counts are atomic so references may live on different
+   threads, but a single PageRef must not be used from two threads at
+   once. */
+class PageRef
+{
+    struct Page
+    {
+	std::atomic<unsigned int> refs;
+	unsigned int size;
+    };
+
+    Page *page;
+
+    static Page *allocate(unsigned int size)
+    {
+	Page *p = (Page*)::operator new(sizeof(Page) + size);
+	p->refs.store(1, std::memory_order_relaxed);
+	p->size = size;
+	return p;
+    }
+
+    void release()
+    {
+	if (page != nullptr &&
+	    page->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+	    ::operator delete(page);
+	page = nullptr;
+    }
+
+public:
+    PageRef() : page(nullptr) {}
+
+    PageRef(const PageRef &other) : page(other.page)
+    {
+	if (page != nullptr)
+	    page->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    PageRef &operator=(const PageRef &other)
+    {
+	if (other.page != nullptr)
+	    other.page->refs.fetch_add(1, std::memory_order_relaxed);
+	release();
+	page = other.page;
+	return *this;
+    }
+
+    ~PageRef() { release(); }
+
+    /* New unshared block of size bytes, copied from init or zeroed */
+    static PageRef create(unsigned int size, const unsigned char *init = nullptr)
+    {
+	PageRef ref;
+	ref.page = allocate(size);
+	if (init != nullptr)
+	    memcpy(ref.data(), init, size);
+	else
+	    memset(ref.data(), 0, size);
+	return ref;
+    }
+
+    unsigned char *data() const { return (unsigned char*)(page + 1); }
+    unsigned int size() const { return page->size; }
+    bool valid() const { return page != nullptr; }
+
+    /* True if another PageRef references the same block */
+    bool shared() const
+    {
+	return page->refs.load(std::memory_order_acquire) > 1;
+    }
+
+    /* Makes this the only reference to its block, copying it if it is
+       shared. Returns the (possibly new) data to write to */
+    unsigned char *own()
+    {
+	if (shared())
+	    *this = create(page->size, data());
+	return data();
+    }
+};
+
+#endif /* defined(__SharedPage_H__) */
@@ -0,0 +1,140 @@
+#include "ShmFrameRing.hpp"
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+ShmFrameRing::~ShmFrameRing()
+{
+    close();
+}
+
+int ShmFrameRing::create(const std::string &name, unsigned int nslots,
+			 bool replace)
+{
+    ShmFrameRing::name = "/" + name;
+    size = sizeof(ShmFrameHeader) + nslots * sizeof(ShmFrameSlot);
+
+    // readers of a replaced ring keep the old object, never a new writer
+    if (replace)
+	shm_unlink(ShmFrameRing::name.c_str());
+    int fd = shm_open(ShmFrameRing::name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd == -1)
+	return 1;
+    if (ftruncate(fd, size) == -1)
+    {
+	::close(fd);
+	shm_unlink(ShmFrameRing::name.c_str());
+	return 1;
+    }
+    void *base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (base == MAP_FAILED)
+    {
+	shm_unlink(ShmFrameRing::name.c_str());
+	return 1;
+    }
+    memset(base, 0, size);
+
+    header = (ShmFrameHeader*)base;
+    slots = (ShmFrameSlot*)(header + 1);
+    header->nslots = nslots;
+    header->slot_size = sizeof(ShmFrameSlot);
+    header->version = ShmFrameHeader::VERSION;
+    // readers check the magic last
+    std::atomic_thread_fence(std::memory_order_release);
+    header->magic = ShmFrameHeader::MAGIC;
+    return 0;
+}
+
+void ShmFrameRing::publish(const Chip8 &chip8)
+{
+    uint64_t n = header->frames.load(std::memory_order_relaxed);
+    ShmFrameSlot &slot = slots[n % header->nslots];
+    uint32_t seq = slot.seq.load(std::memory_order_relaxed);
+
+    slot.seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    ShmFrame &f = slot.data;
+    f.frame = n;
+    memcpy(f.gfx, chip8.gfx, sizeof(f.gfx));
+    memcpy(f.V, chip8.get_V(), sizeof(f.V));
+    f.I = chip8.get_I();
+    f.pc = chip8.get_pc();
+    f.sp = chip8.get_sp();
+    f.delay_timer = chip8.delay_timer;
+    f.sound_timer = chip8.sound_timer;
+
+    slot.seq.store(seq + 2, std::memory_order_release);
+    header->frames.store(n + 1, std::memory_order_release);
+}
+
+void ShmFrameRing::close()
+{
+    if (header == nullptr)
+	return;
+    munmap(header, size);
+    shm_unlink(name.c_str());
+    header = nullptr;
+    slots = nullptr;
+}
+
+ShmFrameReader::~ShmFrameReader()
+{
+    close();
+}
+
+int ShmFrameReader::open(const std::string &name)
+{
+    std::string path = "/" + name;
+    struct stat st;
+
+    int fd = shm_open(path.c_str(), O_RDONLY, 0);
+    if (fd == -1)
+	return 1;
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(ShmFrameHeader))
+    {
+	::close(fd);
+	return 1;
+    }
+    size = st.st_size;
+    void *base = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (base == MAP_FAILED)
+	return 1;
+
+    header = (const ShmFrameHeader*)base;
+    slots = (const ShmFrameSlot*)(header + 1);
+    if (header->magic != ShmFrameHeader::MAGIC ||
+	header->version != ShmFrameHeader::VERSION ||
+	header->slot_size != sizeof(ShmFrameSlot) ||
+	sizeof(ShmFrameHeader) + header->nslots * sizeof(ShmFrameSlot) > size)
+    {
+	close();
+	return 1;
+    }
+    return 0;
+}
+
+uint64_t ShmFrameReader::frames() const
+{
+    return header->frames.load(std::memory_order_acquire);
+}
+
+bool ShmFrameReader::read_latest_copy(ShmFrame &out) const
+{
+    return read_latest([&out](const ShmFrame &f) {
+	    memcpy(&out, &f, sizeof(out));
+	});
+}
+
+void ShmFrameReader::close()
+{
+    if (header == nullptr)
+	return;
+    munmap((void*)header, size);
+    header = nullptr;
+    slots = nullptr;
+}
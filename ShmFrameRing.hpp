@@ -0,0 +1,123 @@
+#ifndef __ShmFrameRing_H__
+#define __ShmFrameRing_H__
+
+#include <atomic>
+#include <stdint.h>
+#include <string>
+
+#include "Chip8.hpp"
+
+/* POSIX shared-memory ring of emulated frames for external readers.
+
+   The emulator is the only writer: once per frame it fills the next
+   slot, bumping the slot's sequence number to an odd value before the
+   write and to the following even value after it. Readers never take a
+   lock; they read the slot in place and retry if the sequence number
+   was odd or changed while they were reading. With NSLOTS slots a reader
+   has NSLOTS - 1 frames of time before the slot it reads is reused. */
+
+struct ShmFrame
+{
+    uint64_t frame;
+    unsigned char gfx[Chip8::VIDEO_WIDTH][Chip8::VIDEO_HEIGHT];
+    unsigned char V[Chip8::VREG_SIZE];
+    uint16_t I;
+    uint16_t pc;
+    unsigned char sp;
+    unsigned char delay_timer;
+    unsigned char sound_timer;
+};
+
+struct ShmFrameSlot
+{
+    std::atomic<uint32_t> seq;
+    ShmFrame data;
+};
+
+struct ShmFrameHeader
+{
+    static const uint32_t MAGIC = 0x52463843; // "C8FR"
+    static const uint32_t VERSION = 1;
+
+    uint32_t magic;
+    uint32_t version;
+    uint32_t nslots;
+    uint32_t slot_size;
+    // number of frames published so far; the newest is in slot
+    // (frames - 1) % nslots
+    std::atomic<uint64_t> frames;
+};
+
+class ShmFrameRing
+{
+    std::string name;
+    ShmFrameHeader *header = nullptr;
+    ShmFrameSlot *slots = nullptr;
+    size_t size = 0;
+
+public:
+    ~ShmFrameRing();
+
+    /* Creates the shared-memory object /name with nslots slots and maps
+       it. Only one writer may publish to a ring, so an existing object
+       is an error (errno is EEXIST) unless replace is set, for one left
+       behind by an emulator that crashed. Returns 0 upon success or 1
+       otherwise */
+    int create(const std::string &name, unsigned int nslots = 8,
+	       bool replace = false);
+
+    /* Copies the display, timers and registers of chip8 into the next
+       slot. Wait-free */
+    void publish(const Chip8 &chip8);
+
+    /* Unmaps and unlinks the shared-memory object */
+    void close();
+
+    bool is_open() const { return header != nullptr; }
+};
+
+class ShmFrameReader
+{
+    const ShmFrameHeader *header = nullptr;
+    const ShmFrameSlot *slots = nullptr;
+    size_t size = 0;
+
+public:
+    ~ShmFrameReader();
+
+    /* Maps the ring /name read only. Returns 0 upon success or 1 otherwise */
+    int open(const std::string &name);
+
+    /* Number of frames the emulator has published so far */
+    uint64_t frames() const;
+
+    /* Calls visit(const ShmFrame &) on the newest frame, in place, and
+       returns true if the frame stayed consistent while it was visited.
+       visit may run more than once; it must only read the frame */
+    template <typename Visitor>
+    bool read_latest(Visitor visit, unsigned int retries = 4) const
+    {
+	for (unsigned int attempt = 0; attempt < retries; attempt++)
+	{
+	    uint64_t n = frames();
+	    if (n == 0)
+		return false;
+	    const ShmFrameSlot &slot = slots[(n - 1) % header->nslots];
+	    uint32_t before = slot.seq.load(std::memory_order_acquire);
+	    if (before & 1)
+		continue;
+	    visit(slot.data);
+	    std::atomic_thread_fence(std::memory_order_acquire);
+	    if (slot.seq.load(std::memory_order_relaxed) == before)
+		return true;
+	}
+	return false;
+    }
+
+    /* Copies the newest consistent frame into out */
+    bool read_latest_copy(ShmFrame &out) const;
+
+    void close();
+};
+
+#endif /* defined(__ShmFrameRing_H__) */
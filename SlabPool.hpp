@@ -0,0 +1,174 @@
+#ifndef __SlabPool_H__
+#define __SlabPool_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+/* Fixed-size slots for objects of type T, carved out of slabs that each
+   belong to one home (in the server, a worker thread). Slots are padded
+   to whole cache lines, so two objects never share one, and a released
+   slot goes on its home's free list to be handed out again by the next
+   allocate() for that home: once the pool has grown to its peak nothing
+   more is mapped. Slabs are mapped untouched and, if the home was given
+   a NUMA node, bound to it before the first object is built, whichever
+   thread builds it. Binding is best effort: without NUMA support or the
+   permission, the kernel places pages where they are first touched.
+
+   Objects still allocated when the pool is destroyed are not destroyed.
+   Not thread safe. */
+template <typename T>
+class SlabPool
+{
+public:
+    static const std::size_t CACHE_LINE = 64;
+    static const std::size_t SLAB_SIZE = 1 << 20;
+    static const std::size_t SLOT_SIZE =
+	(sizeof(T) + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+
+private:
+    static_assert(alignof(T) <= CACHE_LINE, "T is aligned beyond a cache line");
+    static_assert(SLOT_SIZE <= SLAB_SIZE - CACHE_LINE, "T does not fit a slab");
+
+    // first cache line of every slab, which is SLAB_SIZE aligned so a
+    // slot finds it by masking its address
+    struct SlabHeader
+    {
+	unsigned int home;
+    };
+
+    struct Home
+    {
+	void *free = nullptr;     // released slots, linked through their first word
+	char *next = nullptr;     // never used part of the newest slab
+	char *end = nullptr;
+	int node = -1;
+    };
+
+    std::vector<Home> homes;
+    std::vector<void*> slabs;
+
+    void *map_slab(unsigned int home)
+    {
+	// twice the size, trimmed to an aligned slab
+	char *base = (char*)mmap(nullptr, 2 * SLAB_SIZE, PROT_READ | PROT_WRITE,
+				 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (base == (char*)MAP_FAILED)
+	    return nullptr;
+	uintptr_t offset = (uintptr_t)base & (SLAB_SIZE - 1);
+	char *slab = offset == 0 ? base : base + (SLAB_SIZE - offset);
+	if (slab != base)
+	    munmap(base, slab - base);
+	munmap(slab + SLAB_SIZE, base + 2 * SLAB_SIZE - (slab + SLAB_SIZE));
+
+#ifdef SYS_mbind
+	int node = homes[home].node;
+	if (node >= 0 && node < 64)
+	{
+	    const int MPOL_PREFERRED_MODE = 1;
+	    unsigned long mask = 1UL << node;
+	    syscall(SYS_mbind, slab, SLAB_SIZE, MPOL_PREFERRED_MODE, &mask,
+		    sizeof(mask) * 8, 0);
+	}
+#endif
+	((SlabHeader*)slab)->home = home;
+	slabs.push_back(slab);
+	return slab;
+    }
+
+public:
+    SlabPool() {}
+
+    ~SlabPool()
+    {
+	for (std::size_t i = 0; i < slabs.size(); i++)
+	    munmap(slabs[i], SLAB_SIZE);
+    }
+
+    SlabPool(const SlabPool&) = delete;
+    SlabPool &operator=(const SlabPool&) = delete;
+
+    /* Sets the number of homes. Only grows */
+    void set_homes(unsigned int count)
+    {
+	if (count > homes.size())
+	    homes.resize(count);
+    }
+
+    /* Slabs mapped for home from now on are bound to node, -1 for none */
+    void set_node(unsigned int home, int node)
+    {
+	set_homes(home + 1);
+	homes[home].node = node;
+    }
+
+    /* Builds a T from args in a slot of home. Returns nullptr if no slab
+       can be mapped; exceptions from T's constructor give the slot back */
+    template <typename... Args>
+    T *allocate(unsigned int home, Args&&... args)
+    {
+	set_homes(home + 1);
+	Home &h = homes[home];
+	void *slot;
+	if (h.free != nullptr)
+	{
+	    slot = h.free;
+	    h.free = *(void**)slot;
+	}
+	else
+	{
+	    if (h.next == h.end)
+	    {
+		char *slab = (char*)map_slab(home);
+		if (slab == nullptr)
+		    return nullptr;
+		h.next = slab + CACHE_LINE;
+		h.end = h.next + (SLAB_SIZE - CACHE_LINE) / SLOT_SIZE * SLOT_SIZE;
+	    }
+	    slot = h.next;
+	    h.next += SLOT_SIZE;
+	}
+	try
+	{
+	    return new (slot) T(std::forward<Args>(args)...);
+	}
+	catch (...)
+	{
+	    *(void**)slot = h.free;
+	    h.free = slot;
+	    throw;
+	}
+    }
+
+    /* Destroys object and gives its slot back to the home it came from */
+    void release(T *object)
+    {
+	if (object == nullptr)
+	    return;
+	object->~T();
+	SlabHeader *slab = (SlabHeader*)((uintptr_t)object & ~(uintptr_t)(SLAB_SIZE - 1));
+	Home &h = homes[slab->home];
+	*(void**)object = h.free;
+	h.free = object;
+    }
+
+    /* Home of an object from this pool */
+    static unsigned int home_of(const T *object)
+    {
+	return ((const SlabHeader*)((uintptr_t)object & ~(uintptr_t)(SLAB_SIZE - 1)))->home;
+    }
+
+    /* Bytes mapped for slabs */
+    std::size_t mapped() const { return slabs.size() * SLAB_SIZE; }
+};
+
+template <typename T> const std::size_t SlabPool<T>::CACHE_LINE;
+template <typename T> const std::size_t SlabPool<T>::SLAB_SIZE;
+template <typename T> const std::size_t SlabPool<T>::SLOT_SIZE;
+
+#endif /* defined(__SlabPool_H__) */
@@ -0,0 +1,209 @@
+#include "TermRenderer.hpp"
+
+#include <cstdio>
+#include <cstring>
+
+const unsigned int TermRenderer::MAX_COLUMNS;
+const unsigned int TermRenderer::MAX_ROWS;
+const unsigned int TermRenderer::NO_CURSOR;
+
+// half block glyphs: blank, upper, lower, full
+static const char *half_blocks[4] = {" ", "\xE2\x96\x80", "\xE2\x96\x84", "\xE2\x96\x88"};
+
+// braille dot bits by [y][x] within a 2x4 cell
+static const unsigned char braille_dots[4][2] =
+    {{0x01, 0x08}, {0x02, 0x10}, {0x04, 0x20}, {0x40, 0x80}};
+
+static unsigned int digits(unsigned int n)
+{
+    unsigned int count = 1;
+    while (n >= 10)
+    {
+	n /= 10;
+	count++;
+    }
+    return count;
+}
+
+TermRenderer::TermRenderer(Mode mode, unsigned int bytes_per_second)
+    : last_ns(0)
+{
+    set_rate(bytes_per_second);
+    set_mode(mode);
+}
+
+void TermRenderer::set_mode(Mode mode)
+{
+    this->mode = mode;
+    if (mode == MODE_BRAILLE)
+    {
+	columns = Chip8::VIDEO_WIDTH / 2;
+	rows = Chip8::VIDEO_HEIGHT / 4;
+    }
+    else
+    {
+	columns = Chip8::VIDEO_WIDTH;
+	rows = Chip8::VIDEO_HEIGHT / 2;
+    }
+    invalidate();
+}
+
+void TermRenderer::set_rate(unsigned int bytes_per_second)
+{
+    rate = bytes_per_second;
+    budget = 0;
+}
+
+void TermRenderer::invalidate()
+{
+    clear_pending = true;
+    first_row = 0;
+}
+
+void TermRenderer::pack(const unsigned char gfx[][Chip8::VIDEO_HEIGHT])
+{
+    for (unsigned int row = 0; row < rows; row++)
+	for (unsigned int col = 0; col < columns; col++)
+	{
+	    unsigned char glyph = 0;
+	    if (mode == MODE_BRAILLE)
+	    {
+		for (unsigned int y = 0; y < 4; y++)
+		    for (unsigned int x = 0; x < 2; x++)
+			if (gfx[col * 2 + x][row * 4 + y])
+			    glyph |= braille_dots[y][x];
+	    }
+	    else
+		glyph = (gfx[col][row * 2] ? 1 : 0) | (gfx[col][row * 2 + 1] ? 2 : 0);
+	    wanted[row][col] = glyph;
+	}
+}
+
+unsigned int TermRenderer::glyph_size(unsigned char glyph) const
+{
+    return glyph == 0 ? 1 : 3;
+}
+
+void TermRenderer::put_glyph(unsigned char glyph, std::string &out) const
+{
+    if (mode == MODE_HALF_BLOCK)
+	out += half_blocks[glyph];
+    else if (glyph == 0)
+	out += ' ';
+    else
+    {
+	// U+2800 + glyph in UTF-8
+	out += '\xE2';
+	out += (char)(0xA0 | glyph >> 6);
+	out += (char)(0x80 | (glyph & 0x3F));
+    }
+}
+
+unsigned int TermRenderer::move_size(unsigned int row, unsigned int column) const
+{
+    if (row == cursor_row && column >= cursor_column)
+    {
+	unsigned int gap = column - cursor_column;
+	if (gap == 0)
+	    return 0;
+	// forward over the gap, or write again what it holds
+	unsigned int forward = gap == 1 ? 3 : 3 + digits(gap);
+	unsigned int rewrite = 0;
+	for (unsigned int col = cursor_column; col < column && rewrite < forward; col++)
+	    rewrite += glyph_size(shown[row][col]);
+	return rewrite < forward ? rewrite : forward;
+    }
+    return 4 + digits(row + 1) + digits(column + 1);
+}
+
+void TermRenderer::move(unsigned int row, unsigned int column, std::string &out)
+{
+    char buf[32];
+    if (row == cursor_row && column >= cursor_column)
+    {
+	unsigned int gap = column - cursor_column;
+	if (gap == 0)
+	    return;
+	unsigned int forward = gap == 1 ? 3 : 3 + digits(gap);
+	if (move_size(row, column) < forward)
+	{
+	    for (unsigned int col = cursor_column; col < column; col++)
+		put_glyph(shown[row][col], out);
+	}
+	else if (gap == 1)
+	    out += "\x1b[C";
+	else
+	{
+	    snprintf(buf, sizeof(buf), "\x1b[%uC", gap);
+	    out += buf;
+	}
+    }
+    else
+    {
+	snprintf(buf, sizeof(buf), "\x1b[%u;%uH", row + 1, column + 1);
+	out += buf;
+    }
+    cursor_row = row;
+    cursor_column = column;
+}
+
+bool TermRenderer::update(const unsigned char gfx[][Chip8::VIDEO_HEIGHT],
+			  long long now_ns, std::string &out)
+{
+    if (rate > 0)
+    {
+	if (last_ns != 0)
+	    budget += rate * (now_ns - last_ns) / 1e9;
+	// enough for the costliest cell even at very low rates
+	double cap = rate / 10 > 16 ? rate / 10 : 16;
+	if (budget > cap)
+	    budget = cap;
+    }
+    last_ns = now_ns;
+
+    if (clear_pending)
+    {
+	if (rate > 0 && budget < 4)
+	    return false;
+	out += "\x1b[2J";
+	budget -= 4;
+	// a cleared terminal shows blanks, only lit cells need drawing
+	memset(shown, 0, sizeof(shown));
+	cursor_row = NO_CURSOR;
+	cursor_column = NO_CURSOR;
+	clear_pending = false;
+    }
+
+    pack(gfx);
+    for (unsigned int n = 0; n < rows; n++)
+    {
+	unsigned int row = (first_row + n) % rows;
+	for (unsigned int col = 0; col < columns; col++)
+	{
+	    unsigned char glyph = wanted[row][col];
+	    if (glyph == shown[row][col])
+		continue;
+	    unsigned int cost = move_size(row, col) + glyph_size(glyph);
+	    if (rate > 0 && cost > budget)
+	    {
+		// start with what is left on the next call
+		first_row = row;
+		return false;
+	    }
+	    move(row, col, out);
+	    put_glyph(glyph, out);
+	    shown[row][col] = glyph;
+	    cursor_column++;
+	    budget -= cost;
+	}
+    }
+    first_row = 0;
+    return true;
+}
+
+std::string TermRenderer::end() const
+{
+    char buf[32];
+    snprintf(buf, sizeof(buf), "\x1b[%u;1H\x1b[?25h", rows + 1);
+    return buf;
+}
@@ -0,0 +1,82 @@
+#ifndef __TermRenderer_H__
+#define __TermRenderer_H__
+
+#include <string>
+
+#include "Chip8.hpp"
+
+/* Draws the display on a text terminal with ANSI escapes, for watching
+   over slow links. Pixels are packed into Unicode cells, two per
+   half block or eight per braille pattern, and the renderer remembers
+   what the terminal shows: update() only emits the cursor moves and
+   characters of cells that changed, choosing whichever of a cursor
+   move or rewriting the cells in between is shorter. Output can be
+   capped to a byte rate; cells that do not fit stay pending and are
+   drawn first on the following calls, so a busy screen converges
+   instead of tearing at the same rows every time. */
+class TermRenderer
+{
+public:
+    enum Mode
+    {
+	MODE_HALF_BLOCK, // 64x16 cells, upper and lower half blocks
+	MODE_BRAILLE     // 32x8 cells, 2x4 dot braille patterns
+    };
+
+private:
+    static const unsigned int MAX_COLUMNS = Chip8::VIDEO_WIDTH;
+    static const unsigned int MAX_ROWS = Chip8::VIDEO_HEIGHT / 2;
+    static const unsigned int NO_CURSOR = ~0U;
+
+    Mode mode;
+    unsigned int columns;
+    unsigned int rows;
+    unsigned char shown[MAX_ROWS][MAX_COLUMNS];  // glyphs on the terminal
+    unsigned char wanted[MAX_ROWS][MAX_COLUMNS];
+    bool clear_pending;
+    unsigned int cursor_row;
+    unsigned int cursor_column;
+    unsigned int first_row;  // where the budget last ran out
+
+    double rate;             // bytes per second, 0 for no limit
+    double budget;
+    long long last_ns;
+
+    void pack(const unsigned char gfx[][Chip8::VIDEO_HEIGHT]);
+    void put_glyph(unsigned char glyph, std::string &out) const;
+    unsigned int glyph_size(unsigned char glyph) const;
+    unsigned int move_size(unsigned int row, unsigned int column) const;
+    void move(unsigned int row, unsigned int column, std::string &out);
+
+public:
+    TermRenderer(Mode mode = MODE_HALF_BLOCK, unsigned int bytes_per_second = 0);
+
+    /* Changes the cell type, and redraws everything */
+    void set_mode(Mode mode);
+    Mode get_mode() const { return mode; }
+
+    /* Caps the output to bytes_per_second, 0 for no limit. Up to a
+       tenth of a second of unused budget carries over */
+    void set_rate(unsigned int bytes_per_second);
+
+    /* Clears the terminal and redraws everything on the next update(),
+       for when its contents were lost (resized, or written over) */
+    void invalidate();
+
+    /* Rows of text the display takes */
+    unsigned int height() const { return rows; }
+
+    /* Appends to out what turns the terminal into gfx, within the byte
+       budget at time now_ns (FramePacer::now_ns()). Returns true if the
+       terminal is up to date, false if some cells are still pending */
+    bool update(const unsigned char gfx[][Chip8::VIDEO_HEIGHT], long long now_ns,
+		std::string &out);
+
+    /* Escapes to send before the first update(): hide the cursor */
+    static const char *begin() { return "\x1b[?25l"; }
+
+    /* Escapes to send on exit: cursor shown, below the display */
+    std::string end() const;
+};
+
+#endif /* defined(__TermRenderer_H__) */
@@ -0,0 +1,133 @@
+#include "TileAtlas.hpp"
+
+const unsigned int TileAtlas::GUTTER;
+const unsigned int TileAtlas::TILE_WIDTH;
+const unsigned int TileAtlas::TILE_HEIGHT;
+
+TileAtlas::TileAtlas(unsigned int count, unsigned int columns)
+    : count(count < 1 ? 1 : count), focused(-1), x0(0), y0(0), x1(0), y1(0)
+{
+    if (columns == 0)
+	while (columns * columns < this->count)
+	    columns++;
+    this->columns = columns;
+    rows = (this->count + columns - 1) / columns;
+    image.resize(width() * height());
+    shown.resize(this->count * Chip8::VIDEO_HEIGHT);
+    valid.resize(this->count);
+    set_palette(0xFF000000, 0xFFFFFFFF, 0xFF404040, 0xFFFFC000);
+}
+
+void TileAtlas::mark(unsigned int x, unsigned int y, unsigned int w, unsigned int h)
+{
+    if (x0 >= x1)
+    {
+	x0 = x;
+	y0 = y;
+	x1 = x + w;
+	y1 = y + h;
+	return;
+    }
+    if (x < x0)
+	x0 = x;
+    if (y < y0)
+	y0 = y;
+    if (x + w > x1)
+	x1 = x + w;
+    if (y + h > y1)
+	y1 = y + h;
+}
+
+void TileAtlas::draw_gutter(unsigned int tile, uint32_t color)
+{
+    unsigned int left = tile % columns * TILE_WIDTH;
+    unsigned int top = tile / columns * TILE_HEIGHT;
+    for (unsigned int y = 0; y < TILE_HEIGHT; y++)
+    {
+	uint32_t *row = &image[(top + y) * width() + left];
+	if (y < GUTTER || y >= TILE_HEIGHT - GUTTER)
+	    for (unsigned int x = 0; x < TILE_WIDTH; x++)
+		row[x] = color;
+	else
+	    for (unsigned int x = 0; x < GUTTER; x++)
+		row[x] = row[TILE_WIDTH - 1 - x] = color;
+    }
+    mark(left, top, TILE_WIDTH, TILE_HEIGHT);
+}
+
+void TileAtlas::set_palette(uint32_t off, uint32_t on, uint32_t gutter, uint32_t focus)
+{
+    colors[0] = off;
+    colors[1] = on;
+    colors[2] = gutter;
+    colors[3] = focus;
+    // cells past the last tile are gutter too
+    for (unsigned int i = 0; i < image.size(); i++)
+	image[i] = gutter;
+    for (unsigned int tile = 0; tile < count; tile++)
+    {
+	valid[tile] = false;
+	draw_gutter(tile, (int)tile == focused ? focus : gutter);
+    }
+    x0 = 0;
+    y0 = 0;
+    x1 = width();
+    y1 = height();
+}
+
+bool TileAtlas::update(unsigned int tile, const uint64_t display[Chip8::VIDEO_HEIGHT])
+{
+    if (tile >= count)
+	return false;
+    unsigned int left = tile % columns * TILE_WIDTH + GUTTER;
+    unsigned int top = tile / columns * TILE_HEIGHT + GUTTER;
+    uint64_t *rows_shown = &shown[tile * Chip8::VIDEO_HEIGHT];
+    bool changed = false;
+    for (unsigned int y = 0; y < Chip8::VIDEO_HEIGHT; y++)
+    {
+	uint64_t bits = display[y];
+	if (valid[tile] && bits == rows_shown[y])
+	    continue;
+	rows_shown[y] = bits;
+	uint32_t *row = &image[(top + y) * width() + left];
+	for (unsigned int x = 0; x < Chip8::VIDEO_WIDTH; x++)
+	    row[x] = colors[bits >> x & 1];
+	mark(left, top + y, Chip8::VIDEO_WIDTH, 1);
+	changed = true;
+    }
+    valid[tile] = true;
+    return changed;
+}
+
+void TileAtlas::set_focus(int tile)
+{
+    if (tile == focused)
+	return;
+    if (focused >= 0)
+	draw_gutter(focused, colors[2]);
+    focused = tile >= 0 && tile < (int)count ? tile : -1;
+    if (focused >= 0)
+	draw_gutter(focused, colors[3]);
+}
+
+int TileAtlas::tile_at(unsigned int x, unsigned int y) const
+{
+    if (x >= width() || y >= height())
+	return -1;
+    unsigned int tile = y / TILE_HEIGHT * columns + x / TILE_WIDTH;
+    return tile < count ? tile : -1;
+}
+
+TileAtlas::Rect TileAtlas::take_dirty()
+{
+    Rect rect = {0, 0, 0, 0};
+    if (x0 < x1)
+    {
+	rect.x = x0;
+	rect.y = y0;
+	rect.w = x1 - x0;
+	rect.h = y1 - y0;
+    }
+    x0 = x1 = y0 = y1 = 0;
+    return rect;
+}
@@ -0,0 +1,80 @@
+#ifndef __TileAtlas_H__
+#define __TileAtlas_H__
+
+#include <stdint.h>
+#include <vector>
+
+#include "Chip8.hpp"
+
+/* Many displays laid out as tiles of one 32-bit pixel image, so that a
+   whole grid of sessions is a single texture: one upload and one draw
+   per frame. Each tile keeps the packed display rows it shows
+   (Chip8::get_display_rows()), and update() only rewrites the pixels
+   of rows that changed.
+   Everything rewritten since the last take_dirty() is tracked as one
+   bounding rectangle, the part of the texture to upload. Tiles are
+   separated by a gutter, which is drawn in a highlight color around
+   the focused tile. */
+class TileAtlas
+{
+public:
+    static const unsigned int GUTTER = 1;
+    static const unsigned int TILE_WIDTH = Chip8::VIDEO_WIDTH + 2 * GUTTER;
+    static const unsigned int TILE_HEIGHT = Chip8::VIDEO_HEIGHT + 2 * GUTTER;
+
+    struct Rect
+    {
+	unsigned int x, y, w, h;
+    };
+
+private:
+    unsigned int count;
+    unsigned int columns;
+    unsigned int rows;
+    std::vector<uint32_t> image;
+    std::vector<uint64_t> shown;  // count tiles of VIDEO_HEIGHT rows
+    std::vector<bool> valid;      // shown matches image
+    uint32_t colors[4];           // off, on, gutter, focus
+    int focused;
+
+    // dirty rectangle, empty when x0 >= x1
+    unsigned int x0, y0, x1, y1;
+
+    void mark(unsigned int x, unsigned int y, unsigned int w, unsigned int h);
+    void draw_gutter(unsigned int tile, uint32_t color);
+
+public:
+    /* count tiles, columns per row or 0 for a grid as square as
+       possible */
+    TileAtlas(unsigned int count, unsigned int columns = 0);
+
+    /* Colors of unlit and lit pixels, the gutter and the focus outline,
+       in the texture's pixel format. Redraws everything */
+    void set_palette(uint32_t off, uint32_t on, uint32_t gutter, uint32_t focus);
+
+    /* Copies a display, packed as Chip8::get_display_rows() returns it,
+       into tile. Returns true if it changed */
+    bool update(unsigned int tile, const uint64_t display[Chip8::VIDEO_HEIGHT]);
+
+    /* Outlines tile, or nothing for -1 */
+    void set_focus(int tile);
+    int get_focus() const { return focused; }
+
+    /* Tile under pixel x, y of the image, or -1 */
+    int tile_at(unsigned int x, unsigned int y) const;
+
+    /* Returns the rectangle changed since the previous call, w and h 0
+       if nothing did, and starts a new one */
+    Rect take_dirty();
+
+    unsigned int size() const { return count; }
+    unsigned int width() const { return columns * TILE_WIDTH; }
+    unsigned int height() const { return rows * TILE_HEIGHT; }
+
+    /* width() x height() pixels, pitch() bytes per row */
+    const uint32_t *pixels() const { return &image[0]; }
+    const uint32_t *pixels(const Rect &rect) const { return &image[rect.y * width() + rect.x]; }
+    unsigned int pitch() const { return width() * sizeof(uint32_t); }
+};
+
+#endif /* defined(__TileAtlas_H__) */
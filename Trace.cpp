@@ -0,0 +1,292 @@
+#include "Trace.hpp"
+
+#include <cstring>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+
+const unsigned char TraceBuffer::VERSION;
+const unsigned char TraceBuffer::SYNC;
+const unsigned char TraceBuffer::FRAMES;
+const unsigned char TraceBuffer::JUMP;
+const unsigned char TraceBuffer::REGS;
+const unsigned char TraceBuffer::INDEX;
+const unsigned char TraceBuffer::STACK;
+const unsigned char TraceBuffer::MEMORY;
+const unsigned int TraceBuffer::MAX_RECORD;
+
+static const unsigned int HEADER_SIZE = 9;
+
+TraceBuffer::TraceBuffer(unsigned int chunks, unsigned int chunk_size)
+    : ring((chunks < 2 ? 2 : chunks) * (chunk_size < 256 ? 256 : chunk_size)),
+      used(chunks < 2 ? 2 : chunks, 0),
+      chunk_size(chunk_size < 256 ? 256 : chunk_size)
+{
+    clear();
+}
+
+TraceBuffer::~TraceBuffer()
+{
+    if (writer.joinable())
+	writer.join();
+}
+
+void TraceBuffer::clear()
+{
+    for (unsigned int i = 0; i < used.size(); i++)
+	used[i] = 0;
+    current = 0;
+    filled = 1;
+    out = &ring[0];
+    end = out + chunk_size - MAX_RECORD;
+    synced = false;
+    frames = 0;
+}
+
+static void put_u32(unsigned char *p, unsigned int value)
+{
+    for (unsigned int i = 0; i < 4; i++)
+	p[i] = value >> (8 * i);
+}
+
+static void write_header(unsigned char *header, unsigned int chunks)
+{
+    memcpy(header, "C8TR", 4);
+    header[4] = TraceBuffer::VERSION;
+    put_u32(header + 5, chunks);
+}
+
+std::vector<unsigned char> TraceBuffer::serialize() const
+{
+    std::vector<unsigned char> data(HEADER_SIZE);
+    write_header(&data[0], filled);
+    unsigned int oldest = (current + used.size() - filled + 1) % used.size();
+    for (unsigned int n = 0; n < filled; n++)
+    {
+	unsigned int c = (oldest + n) % used.size();
+	size_t at = data.size();
+	data.resize(at + 4 + used[c]);
+	put_u32(&data[at], used[c]);
+	memcpy(&data[at + 4], &ring[c * chunk_size], used[c]);
+    }
+    return data;
+}
+
+static void write_all(int fd, const unsigned char *data, size_t size)
+{
+    while (size > 0)
+    {
+	ssize_t n = write(fd, data, size);
+	if (n <= 0)
+	    return;
+	data += n;
+	size -= n;
+    }
+}
+
+int TraceBuffer::save(const std::string &path)
+{
+    if (writer.joinable())
+	writer.join();
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+	return 1;
+    // copy now, write while the emulator carries on
+    std::vector<unsigned char> data = serialize();
+    writer = std::thread([fd, data]()
+    {
+	write_all(fd, &data[0], data.size());
+	::close(fd);
+    });
+    return 0;
+}
+
+// crash handler state, set up front so the handler only calls
+// async-signal-safe functions
+static TraceBuffer *crash_buffer;
+static char crash_path[4096];
+
+static void on_crash(int sig)
+{
+    crash_buffer->write_crash(crash_path);
+    // the handler was installed with SA_RESETHAND, this runs the default
+    raise(sig);
+}
+
+void TraceBuffer::write_crash(const char *path) const
+{
+    int fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+	return;
+    unsigned char header[HEADER_SIZE];
+    write_header(header, filled);
+    write_all(fd, header, sizeof(header));
+    unsigned int oldest = (current + used.size() - filled + 1) % used.size();
+    for (unsigned int n = 0; n < filled; n++)
+    {
+	unsigned int c = (oldest + n) % used.size();
+	unsigned char length[4];
+	put_u32(length, used[c]);
+	write_all(fd, length, sizeof(length));
+	write_all(fd, &ring[c * chunk_size], used[c]);
+    }
+    ::close(fd);
+}
+
+void TraceBuffer::install_crash_handler(TraceBuffer *buffer, const std::string &path)
+{
+    if (path.size() >= sizeof(crash_path))
+	return;
+    crash_buffer = buffer;
+    memcpy(crash_path, path.c_str(), path.size() + 1);
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = on_crash;
+    action.sa_flags = SA_RESETHAND;
+    sigemptyset(&action.sa_mask);
+    const int signals[] = {SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT};
+    for (int sig : signals)
+	sigaction(sig, &action, nullptr);
+}
+
+int TraceReader::open(const std::string &path)
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+	return 1;
+    data.clear();
+    unsigned char buf[65536];
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0)
+	data.insert(data.end(), buf, buf + n);
+    ::close(fd);
+
+    if (data.size() < HEADER_SIZE || memcmp(&data[0], "C8TR", 4) != 0 ||
+	data[4] != TraceBuffer::VERSION)
+	return 1;
+    pos = HEADER_SIZE;
+    chunk_end = HEADER_SIZE;
+    pending_sync = false;
+    in_sync = false;
+    return 0;
+}
+
+bool TraceReader::get_varint(unsigned int *value)
+{
+    *value = 0;
+    for (unsigned int shift = 0; pos < chunk_end && shift < 35; shift += 7)
+    {
+	unsigned char byte = data[pos++];
+	*value |= (unsigned int)(byte & 0x7F) << shift;
+	if (!(byte & 0x80))
+	    return true;
+    }
+    return false;
+}
+
+bool TraceReader::get_svarint(int *value)
+{
+    unsigned int raw;
+    if (!get_varint(&raw))
+	return false;
+    *value = (int)(raw >> 1) ^ -(int)(raw & 1);
+    return true;
+}
+
+bool TraceReader::next(TraceStep &step)
+{
+    step.sync = false;
+    for (;;)
+    {
+	if (pos >= chunk_end)
+	{
+	    // next chunk; decoding restarts at its sync record
+	    if (chunk_end + 4 > data.size())
+		return false;
+	    unsigned int length = data[chunk_end] | data[chunk_end + 1] << 8 |
+		data[chunk_end + 2] << 16 | (unsigned int)data[chunk_end + 3] << 24;
+	    pos = chunk_end + 4;
+	    chunk_end = pos + length;
+	    if (chunk_end > data.size())
+		chunk_end = data.size();
+	    in_sync = false;
+	    continue;
+	}
+	if (data[pos] != TraceBuffer::SYNC)
+	{
+	    if (in_sync)
+		break;
+	    // no state to decode against, skip to the next chunk
+	    pos = chunk_end;
+	    continue;
+	}
+	if (pos + 30 > chunk_end)
+	    return false;
+	const unsigned char *p = &data[pos + 1];
+	state.cycle = 0;
+	for (unsigned int i = 0; i < 8; i++)
+	    state.cycle |= (unsigned long long)p[i] << (8 * i);
+	state.pc = p[8] | p[9] << 8;
+	state.I = p[10] | p[11] << 8;
+	state.sp = p[12];
+	memcpy(state.V, p + 13, 16);
+	pos += 30;
+	pending_sync = true;
+	in_sync = true;
+    }
+
+    unsigned char flags = data[pos++];
+    if (pos + 2 > chunk_end)
+	return false;
+    step.sync = pending_sync;
+    pending_sync = false;
+    step.opcode = data[pos] | data[pos + 1] << 8;
+    pos += 2;
+    step.pc = state.pc;
+    step.frames = 0;
+    step.changed = 0;
+    step.mem_length = 0;
+    state.cycle++;
+    state.pc += 2;
+
+    if (flags & TraceBuffer::FRAMES)
+	get_varint(&step.frames);
+    if (flags & TraceBuffer::JUMP)
+    {
+	int delta = 0;
+	get_svarint(&delta);
+	state.pc += delta;
+    }
+    if ((flags & TraceBuffer::REGS) && pos + 2 <= chunk_end)
+    {
+	step.changed = data[pos] | data[pos + 1] << 8;
+	pos += 2;
+	for (unsigned int i = 0; i < 16 && pos < chunk_end; i++)
+	    if (step.changed & (1 << i))
+		state.V[i] = data[pos++];
+    }
+    if (flags & TraceBuffer::INDEX)
+    {
+	int delta = 0;
+	get_svarint(&delta);
+	state.I += delta;
+    }
+    if ((flags & TraceBuffer::STACK) && pos < chunk_end)
+	state.sp = data[pos++];
+    if (flags & TraceBuffer::MEMORY)
+    {
+	unsigned int addr = 0;
+	get_varint(&addr);
+	step.mem_addr = addr;
+	if (pos < chunk_end)
+	    step.mem_length = data[pos++];
+	if (step.mem_length > sizeof(step.mem) || pos + step.mem_length > chunk_end)
+	    return false;
+	memcpy(step.mem, &data[pos], step.mem_length);
+	pos += step.mem_length;
+    }
+    step.cycle = state.cycle;
+    step.after = state;
+    return true;
+}
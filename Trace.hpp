@@ -0,0 +1,254 @@
+#ifndef __Trace_H__
+#define __Trace_H__
+
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+/* Execution trace format (integers little endian; varints are LEB128,
+   svarints zigzag encoded LEB128):
+
+   file:    "C8TR" version:u8 chunk_count:u32 {length:u32 chunk}[chunk_count]
+   chunk:   sync {record}
+   sync:    SYNC:u8 cycle:u64 pc:u16 I:u16 sp:u8 V[16]
+   record:  flags:u8 opcode:u16
+	    [FRAMES: frames:varint]        timer ticks before the instruction
+	    [JUMP: delta:svarint]          pc after - (pc before + 2)
+	    [REGS: mask:u16 value:u8 ...]  V registers changed, lowest first
+	    [INDEX: delta:svarint]         I after - I before
+	    [STACK: sp:u8]                 sp after
+	    [MEMORY: addr:varint length:u8 bytes[length]]
+
+   A record holds one instruction, at the pc the previous one left, one
+   cycle after it. A sync record restarts decoding from full state; one
+   starts every chunk and one is written whenever the machine was moved
+   by anything but an instruction (a state load, a skipped key wait).
+   Chunks are written oldest first. */
+
+/* Machine state a trace record is encoded against */
+struct TraceState
+{
+    unsigned long long cycle;
+    unsigned short pc;
+    unsigned short I;
+    unsigned char sp;
+    unsigned char V[16];
+};
+
+/* Per-instance ring of trace chunks. The emulator records into it with
+   record() and frame(), which are inline and only encode into memory, so
+   the core does not depend on Trace.cpp. Once the ring is full the
+   oldest chunk is overwritten. save() writes the ring out on a
+   background thread, and install_crash_handler() makes a fatal signal
+   write it before the process dies. */
+class TraceBuffer
+{
+public:
+    static const unsigned char VERSION = 1;
+    static const unsigned char SYNC = 0xFF;
+    // record flags
+    static const unsigned char FRAMES = 0x01;
+    static const unsigned char JUMP = 0x02;
+    static const unsigned char REGS = 0x04;
+    static const unsigned char INDEX = 0x08;
+    static const unsigned char STACK = 0x10;
+    static const unsigned char MEMORY = 0x20;
+    // longest sync and instruction record together
+    static const unsigned int MAX_RECORD = 96;
+
+private:
+    std::vector<unsigned char> ring;
+    std::vector<unsigned int> used;  // bytes used in each chunk
+    unsigned int chunk_size;
+    unsigned int current = 0;
+    unsigned int filled = 0;         // chunks holding data
+    unsigned char *out;              // write position in the current chunk
+    unsigned char *end;              // end of the current chunk, less MAX_RECORD
+
+    // what the next record is expected to start from
+    unsigned long long next_cycle = 0;
+    unsigned short next_pc = 0;
+    bool synced = false;
+    unsigned int frames = 0;
+
+    std::thread writer;
+
+    void put_varint(unsigned int value)
+    {
+	while (value >= 0x80)
+	{
+	    *out++ = (value & 0x7F) | 0x80;
+	    value >>= 7;
+	}
+	*out++ = value;
+    }
+
+    void put_svarint(int value)
+    {
+	put_varint(((unsigned int)value << 1) ^ (unsigned int)(value >> 31));
+    }
+
+    void commit()
+    {
+	used[current] = out - &ring[current * chunk_size];
+    }
+
+    void next_chunk()
+    {
+	current = (current + 1) % used.size();
+	if (filled < used.size())
+	    filled++;
+	used[current] = 0;
+	out = &ring[current * chunk_size];
+	end = out + chunk_size - MAX_RECORD;
+	synced = false;
+    }
+
+    void write_sync(const TraceState &state)
+    {
+	*out++ = SYNC;
+	for (unsigned int i = 0; i < 8; i++)
+	    *out++ = state.cycle >> (8 * i);
+	*out++ = state.pc & 0xFF;
+	*out++ = state.pc >> 8;
+	*out++ = state.I & 0xFF;
+	*out++ = state.I >> 8;
+	*out++ = state.sp;
+	memcpy(out, state.V, 16);
+	out += 16;
+	commit();
+	synced = true;
+    }
+
+public:
+    /* chunks of chunk_size bytes, at least 2 and 256 bytes */
+    TraceBuffer(unsigned int chunks = 64, unsigned int chunk_size = 64 * 1024);
+    ~TraceBuffer();
+
+    /* Records the instruction that took the machine from before to
+       after. memory is the machine's memory after it ran */
+    void record(const TraceState &before, const TraceState &after,
+		unsigned short opcode, const unsigned char *memory)
+    {
+	if (out > end)
+	    next_chunk();
+	if (!synced || before.cycle != next_cycle || before.pc != next_pc)
+	    write_sync(before);
+
+	unsigned char *flags = out;
+	*out++ = 0;
+	*out++ = opcode & 0xFF;
+	*out++ = opcode >> 8;
+	if (frames > 0)
+	{
+	    *flags |= FRAMES;
+	    put_varint(frames);
+	    frames = 0;
+	}
+	if (after.pc != (unsigned short)(before.pc + 2))
+	{
+	    *flags |= JUMP;
+	    put_svarint(after.pc - (before.pc + 2));
+	}
+	unsigned int mask = 0;
+	for (unsigned int i = 0; i < 16; i++)
+	    if (after.V[i] != before.V[i])
+		mask |= 1 << i;
+	if (mask != 0)
+	{
+	    *flags |= REGS;
+	    *out++ = mask & 0xFF;
+	    *out++ = mask >> 8;
+	    for (unsigned int i = 0; i < 16; i++)
+		if (mask & (1 << i))
+		    *out++ = after.V[i];
+	}
+	if (after.I != before.I)
+	{
+	    *flags |= INDEX;
+	    put_svarint(after.I - before.I);
+	}
+	if (after.sp != before.sp)
+	{
+	    *flags |= STACK;
+	    *out++ = after.sp;
+	}
+	// FX33 and FX55 are the only instructions that write memory
+	unsigned int length = 0;
+	if ((opcode & 0xF0FF) == 0xF033)
+	    length = 3;
+	else if ((opcode & 0xF0FF) == 0xF055)
+	    length = ((opcode & 0x0F00) >> 8) + 1;
+	if (length > 0)
+	{
+	    *flags |= MEMORY;
+	    put_varint(before.I & 0xFFF);
+	    *out++ = length;
+	    for (unsigned int i = 0; i < length; i++)
+		*out++ = memory[(before.I + i) & 0xFFF];
+	}
+	commit();
+	next_cycle = after.cycle;
+	next_pc = after.pc;
+    }
+
+    /* The timers ticked */
+    void frame() { frames++; }
+
+    /* Forgets everything recorded */
+    void clear();
+
+    /* Writes the ring to path on a background thread, waiting for the
+       previous save to finish first. Returns 0 upon success or 1 if the
+       file cannot be created */
+    int save(const std::string &path);
+
+    /* Trace file contents for the ring as it is now */
+    std::vector<unsigned char> serialize() const;
+
+    /* Writes the ring to path using only async-signal-safe calls */
+    void write_crash(const char *path) const;
+
+    /* Makes SIGSEGV, SIGBUS, SIGILL, SIGFPE and SIGABRT write buffer to
+       path before the process dies. One buffer per process */
+    static void install_crash_handler(TraceBuffer *buffer, const std::string &path);
+};
+
+/* One decoded trace record */
+struct TraceStep
+{
+    bool sync;               // decoding (re)started here, state is complete
+    unsigned long long cycle;
+    unsigned short pc;       // address of the instruction
+    unsigned short opcode;
+    unsigned int frames;     // timer ticks before it
+    unsigned short changed;  // V registers it changed
+    TraceState after;
+    unsigned short mem_addr;
+    unsigned char mem_length;
+    unsigned char mem[16];
+};
+
+/* Decoder for trace files */
+class TraceReader
+{
+    std::vector<unsigned char> data;
+    size_t pos = 0;
+    size_t chunk_end = 0;
+    TraceState state;
+    bool in_sync = false;       // state is known in this chunk
+    bool pending_sync = false;  // the next step starts from a sync
+
+    bool get_varint(unsigned int *value);
+    bool get_svarint(int *value);
+
+public:
+    /* Reads the whole file. Returns 0 upon success or 1 otherwise */
+    int open(const std::string &path);
+
+    /* Decodes the next instruction. Returns false at the end */
+    bool next(TraceStep &step);
+};
+
+#endif /* defined(__Trace_H__) */
@@ -0,0 +1,55 @@
+#ifndef __TripleBuffer_H__
+#define __TripleBuffer_H__
+
+#include <atomic>
+
+/* Lock-free triple buffer handing complete values from one producer
+   thread to one consumer thread. The producer fills back() and calls
+   publish(); the consumer calls update() and reads front(). Neither
+   side ever waits for the other: the producer always has a free buffer
+   to write to and the consumer always sees the newest published one,
+   older unread ones are simply overwritten. */
+template <typename T>
+class TripleBuffer
+{
+    static const unsigned int INDEX_MASK = 0x3;
+    static const unsigned int FRESH = 0x4;
+
+    T buffers[3];
+    // index of the middle buffer, plus FRESH if the producer published
+    // into it since the consumer last took it
+    std::atomic<unsigned int> middle;
+    unsigned int back_index;  // producer only
+    unsigned int front_index; // consumer only
+
+public:
+    TripleBuffer() : buffers(), middle(1), back_index(0), front_index(2) {}
+
+    /* Producer side: buffer to fill for the next publish() */
+    T &back() { return buffers[back_index]; }
+
+    /* Producer side: makes back() the newest value */
+    void publish()
+    {
+	unsigned int old = middle.exchange(back_index | FRESH,
+					   std::memory_order_acq_rel);
+	back_index = old & INDEX_MASK;
+    }
+
+    /* Consumer side: takes the newest value if there is one.
+       Returns true if front() changed */
+    bool update()
+    {
+	if (!(middle.load(std::memory_order_relaxed) & FRESH))
+	    return false;
+	unsigned int old = middle.exchange(front_index,
+					   std::memory_order_acq_rel);
+	front_index = old & INDEX_MASK;
+	return true;
+    }
+
+    /* Consumer side: newest value taken by update() */
+    const T &front() const { return buffers[front_index]; }
+};
+
+#endif /* defined(__TripleBuffer_H__) */
@@ -0,0 +1,185 @@
+#include "Upscaler.hpp"
+
+const unsigned int Upscaler::MAX_SCALE;
+const unsigned int Upscaler::MAX_WIDTH;
+const unsigned int Upscaler::MAX_HEIGHT;
+const unsigned int Upscaler::WORDS;
+
+/* Moves bit i of the low 32 bits of v to bit 2i */
+static uint64_t spread(uint64_t v)
+{
+    v &= 0xFFFFFFFFULL;
+    v = (v | v << 16) & 0x0000FFFF0000FFFFULL;
+    v = (v | v << 8) & 0x00FF00FF00FF00FFULL;
+    v = (v | v << 4) & 0x0F0F0F0F0F0F0F0FULL;
+    v = (v | v << 2) & 0x3333333333333333ULL;
+    v = (v | v << 1) & 0x5555555555555555ULL;
+    return v;
+}
+
+/* Interleaves the pixels of even and odd into a row twice as wide */
+static void interleave(uint64_t even, uint64_t odd, uint64_t *out)
+{
+    out[0] = spread(even) | spread(odd) << 1;
+    out[1] = spread(even >> 32) | spread(odd >> 32) << 1;
+}
+
+/* Scale2x of one row of words words, given the rows above and below.
+   Writes the two output rows top and bottom. Pixels outside the image
+   are taken to be copies of the nearest edge pixel */
+static void scale2x_row(const uint64_t *up, const uint64_t *row,
+			const uint64_t *down, unsigned int words,
+			uint64_t *top, uint64_t *bottom)
+{
+    for (unsigned int w = 0; w < words; w++)
+    {
+	uint64_t e = row[w];
+	uint64_t b = up[w];
+	uint64_t h = down[w];
+	// left and right neighbours of every pixel in the word
+	uint64_t d = e << 1 | (w > 0 ? row[w - 1] >> 63 : e & 1);
+	uint64_t f = e >> 1 | (w + 1 < words ? row[w + 1] << 63 : e & 1ULL << 63);
+
+	uint64_t c0 = ~(d ^ b) & (b ^ f) & (d ^ h);
+	uint64_t c1 = ~(b ^ f) & (b ^ d) & (f ^ h);
+	uint64_t c2 = ~(d ^ h) & (d ^ b) & (h ^ f);
+	uint64_t c3 = ~(h ^ f) & (h ^ d) & (b ^ f);
+
+	interleave((c0 & d) | (~c0 & e), (c1 & f) | (~c1 & e), &top[w * 2]);
+	interleave((c2 & d) | (~c2 & e), (c3 & f) | (~c3 & e), &bottom[w * 2]);
+    }
+}
+
+/* Scale2x of the rows of in that are affected by a changed row.
+   changed has one entry per input row, scaled one per output row */
+template <unsigned int W>
+static void scale2x(const uint64_t (*in)[W], unsigned int rows,
+		    const bool *changed, uint64_t (*out)[W * 2], bool *scaled)
+{
+    for (unsigned int y = 0; y < rows; y++)
+    {
+	unsigned int up = y > 0 ? y - 1 : y;
+	unsigned int down = y + 1 < rows ? y + 1 : y;
+	bool dirty = changed[up] || changed[y] || changed[down];
+	scaled[y * 2] = scaled[y * 2 + 1] = dirty;
+	if (dirty)
+	    scale2x_row(in[up], in[y], in[down], W, out[y * 2], out[y * 2 + 1]);
+    }
+}
+
+Upscaler::Upscaler()
+    : filter(FILTER_NONE), invalid(true)
+{
+    colors[0] = 0xFF000000;
+    colors[1] = 0xFF808080;
+    colors[2] = 0xFFFFFFFF;
+}
+
+void Upscaler::set_filter(Filter filter)
+{
+    Upscaler::filter = filter;
+    invalid = true;
+}
+
+void Upscaler::set_palette(uint32_t off, uint32_t on)
+{
+    colors[0] = off;
+    colors[2] = on;
+    // half lit: the average of both, channel by channel
+    colors[1] = ((off >> 1) & 0x7F7F7F7F) + ((on >> 1) & 0x7F7F7F7F);
+    invalid = true;
+}
+
+unsigned int Upscaler::get_scale() const
+{
+    switch (filter)
+    {
+    case FILTER_SCALE2X:
+    case FILTER_SMOOTH2X:
+	return 2;
+    case FILTER_SCALE4X:
+	return 4;
+    default:
+	return 1;
+    }
+}
+
+bool Upscaler::update(const uint64_t display_rows[Chip8::VIDEO_HEIGHT])
+{
+    static_assert(WORDS == 1, "a packed display row is one word");
+    bool changed[Chip8::VIDEO_HEIGHT];
+    bool any = invalid;
+    for (unsigned int y = 0; y < Chip8::VIDEO_HEIGHT; y++)
+    {
+	changed[y] = invalid;
+	if (display_rows[y] != display[y][0])
+	{
+	    display[y][0] = display_rows[y];
+	    changed[y] = any = true;
+	}
+    }
+    if (!any)
+	return false;
+    invalid = false;
+
+    // run the filter, then convert the output rows it touched
+    bool scaled2_rows[Chip8::VIDEO_HEIGHT * 2];
+    bool scaled4_rows[Chip8::VIDEO_HEIGHT * 4];
+    const bool *rows = changed;
+    const uint64_t *bits = &display[0][0];
+    const uint64_t *nearest = nullptr;
+    unsigned int words = WORDS;
+
+    if (filter != FILTER_NONE)
+    {
+	scale2x<WORDS>(display, Chip8::VIDEO_HEIGHT, changed, scaled2, scaled2_rows);
+	rows = scaled2_rows;
+	bits = &scaled2[0][0];
+	words = WORDS * 2;
+    }
+    if (filter == FILTER_SCALE4X)
+    {
+	scale2x<WORDS * 2>(scaled2, Chip8::VIDEO_HEIGHT * 2, scaled2_rows,
+			   scaled4, scaled4_rows);
+	rows = scaled4_rows;
+	bits = &scaled4[0][0];
+	words = WORDS * 4;
+    }
+    if (filter == FILTER_SMOOTH2X)
+    {
+	for (unsigned int y = 0; y < Chip8::VIDEO_HEIGHT; y++)
+	{
+	    if (!scaled2_rows[y * 2])
+		continue;
+	    for (unsigned int w = 0; w < WORDS; w++)
+	    {
+		interleave(display[y][w], display[y][w], &nearest2[y * 2][w * 2]);
+		interleave(display[y][w], display[y][w], &nearest2[y * 2 + 1][w * 2]);
+	    }
+	}
+	nearest = &nearest2[0][0];
+    }
+
+    unsigned int out_width = width();
+    for (unsigned int y = 0; y < height(); y++)
+    {
+	if (!rows[y])
+	    continue;
+	uint32_t *out = &output[y * out_width];
+	const uint64_t *row = &bits[y * words];
+	if (nearest != nullptr)
+	{
+	    // lit in both: on, in one of them: half lit
+	    const uint64_t *plain = &nearest[y * words];
+	    for (unsigned int x = 0; x < out_width; x++)
+		out[x] = colors[((row[x / 64] >> (x % 64)) & 1) +
+				((plain[x / 64] >> (x % 64)) & 1)];
+	}
+	else
+	{
+	    for (unsigned int x = 0; x < out_width; x++)
+		out[x] = colors[((row[x / 64] >> (x % 64)) & 1) * 2];
+	}
+    }
+    return true;
+}
@@ -0,0 +1,70 @@
+#ifndef __Upscaler_H__
+#define __Upscaler_H__
+
+#include <stdint.h>
+
+#include "Chip8.hpp"
+
+/* Pixel-art upscaling of the display into 32-bit pixels ready for a
+   texture upload. The display comes packed one 64-bit word per row
+   (Chip8::get_display_rows()) and the filters work on whole words, 64
+   pixels per operation. Results
+   are cached: update() only recomputes the output rows that depend on
+   display rows that changed since the previous call. */
+class Upscaler
+{
+public:
+    enum Filter
+    {
+	FILTER_NONE,     // one texel per pixel, scaled by the renderer
+	FILTER_SCALE2X,  // Scale2x / EPX
+	FILTER_SCALE4X,  // Scale2x applied twice
+	FILTER_SMOOTH2X, // Scale2x with the corners it fills half lit,
+			 // an hqx-like antialiased look
+	FILTER_COUNT
+    };
+
+    static const unsigned int MAX_SCALE = 4;
+    static const unsigned int MAX_WIDTH = Chip8::VIDEO_WIDTH * MAX_SCALE;
+    static const unsigned int MAX_HEIGHT = Chip8::VIDEO_HEIGHT * MAX_SCALE;
+
+private:
+    static const unsigned int WORDS = Chip8::VIDEO_WIDTH / 64;
+
+    Filter filter;
+    uint32_t colors[3]; // off, half lit (FILTER_SMOOTH2X), on
+    bool invalid;       // everything must be recomputed
+
+    // bitmaps, bit x of a row is column x
+    uint64_t display[Chip8::VIDEO_HEIGHT][WORDS];
+    uint64_t scaled2[Chip8::VIDEO_HEIGHT * 2][WORDS * 2];
+    uint64_t scaled4[Chip8::VIDEO_HEIGHT * 4][WORDS * 4];
+    uint64_t nearest2[Chip8::VIDEO_HEIGHT * 2][WORDS * 2];
+
+    uint32_t output[MAX_WIDTH * MAX_HEIGHT];
+
+public:
+    Upscaler();
+
+    /* Selects the filter. The output size changes with it */
+    void set_filter(Filter filter);
+    Filter get_filter() const { return filter; }
+
+    /* Colors of unlit and lit pixels, in the texture's pixel format */
+    void set_palette(uint32_t off, uint32_t on);
+
+    unsigned int get_scale() const;
+    unsigned int width() const { return Chip8::VIDEO_WIDTH * get_scale(); }
+    unsigned int height() const { return Chip8::VIDEO_HEIGHT * get_scale(); }
+
+    /* Filters a display, packed as Chip8::get_display_rows() returns
+       it, into pixels(). Returns false if the output did not change and
+       need not be uploaded again */
+    bool update(const uint64_t display_rows[Chip8::VIDEO_HEIGHT]);
+
+    /* width() x height() pixels, pitch() bytes per row */
+    const uint32_t *pixels() const { return output; }
+    unsigned int pitch() const { return width() * sizeof(uint32_t); }
+};
+
+#endif /* defined(__Upscaler_H__) */
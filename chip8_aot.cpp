@@ -0,0 +1,295 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+
+#include "Analysis.hpp"
+#include "Chip8Aot.hpp"
+
+/* Ahead-of-time compiler: turns a ROM into C++ with one function per
+   basic block found by RomAnalysis, plus a dispatcher that runs them and
+   falls back to Chip8::run_instruction() for everything else. Link the
+   output with Chip8Aot.cpp into a frontend and chip8_aot_find() will
+   return it whenever the same ROM is loaded under the same profile. */
+
+const char *quirk_names[] = {"", "QuirksChip8", "QuirksCosmacVip",
+			     "QuirksSuperChip"};
+const char *profile_enums[] = {"", "Chip8::PROFILE_CHIP8",
+			       "Chip8::PROFILE_COSMAC_VIP",
+			       "Chip8::PROFILE_SUPER_CHIP"};
+
+void usage(const char *name)
+{
+    std::cout << "Usage: " << name << " [-q chip8|vip|schip] [-o output.cpp] ROM\n";
+}
+
+std::string hex(unsigned int value, int digits = 0)
+{
+    char buf[16];
+    snprintf(buf, sizeof(buf), "0x%0*X", digits, value);
+    return buf;
+}
+
+/* C++ for the instruction opcode at addr, in the same terms as
+   Chip8::execute(). Control transfers assign PC themselves and report
+   it through sets_pc */
+std::string emit_instruction(unsigned short opcode, unsigned int addr,
+			     bool *sets_pc)
+{
+    std::ostringstream out;
+    std::string x = hex((opcode & 0x0F00) >> 8);
+    std::string y = hex((opcode & 0x00F0) >> 4);
+    std::string nn = hex(opcode & 0x00FF, 2);
+    std::string nnn = hex(opcode & 0x0FFF, 3);
+    std::string vx = "V[" + x + "]";
+    std::string vy = "V[" + y + "]";
+    std::string skip = " ? " + hex(addr + 4, 3) + " : " + hex(addr + 2, 3) + ";";
+
+    *sets_pc = opcode_ends_block(opcode) && !opcode_stores(opcode);
+    switch (opcode & 0xF000)
+    {
+    case 0x0000:
+	if (opcode == 0x00E0)
+	    out << "c.clear_screen();";
+	else
+	    out << "SP--; PC = STACK[SP] + 2;";
+	break;
+    case 0x1000:
+	out << "PC = " << nnn << ";";
+	break;
+    case 0x2000:
+	out << "STACK[SP] = " << hex(addr, 3) << "; SP++; PC = " << nnn << ";";
+	break;
+    case 0x3000:
+	out << "PC = " << vx << " == " << nn << skip;
+	break;
+    case 0x4000:
+	out << "PC = " << vx << " != " << nn << skip;
+	break;
+    case 0x5000:
+	out << "PC = " << vx << " == " << vy << skip;
+	break;
+    case 0x6000:
+	out << vx << " = " << nn << ";";
+	break;
+    case 0x7000:
+	out << vx << " += " << nn << ";";
+	break;
+    case 0x8000:
+    {
+	std::string src = "(P::SHIFT_VY ? " + vy + " : " + vx + ")";
+	switch (opcode & 0x000F)
+	{
+	case 0x0: out << vx << " = " << vy << ";"; break;
+	case 0x1: out << vx << " = " << vx << " | " << vy << ";"; break;
+	case 0x2: out << vx << " = " << vx << " & " << vy << ";"; break;
+	case 0x3: out << vx << " = " << vx << " ^ " << vy << ";"; break;
+	case 0x4:
+	    out << "V[0xF] = " << vy << " > (0xFF - " << vx << ") ? 1 : 0; "
+		<< vx << " += " << vy << ";";
+	    break;
+	case 0x5:
+	    out << "V[0xF] = " << vx << " >= " << vy << " ? 1 : 0; "
+		<< vx << " -= " << vy << ";";
+	    break;
+	case 0x6:
+	    out << "V[0xF] = " << src << " & 0x01; " << vx << " = " << src << " >> 1;";
+	    break;
+	case 0x7:
+	    out << "V[0xF] = " << vy << " >= " << vx << " ? 1 : 0; "
+		<< vx << " = " << vy << " - " << vx << ";";
+	    break;
+	case 0xE:
+	    out << "V[0xF] = (" << src << " & 0x80) >> 7; " << vx << " = " << src << " << 1;";
+	    break;
+	}
+    }
+    break;
+    case 0x9000:
+	out << "PC = " << vx << " != " << vy << skip;
+	break;
+    case 0xA000:
+	out << "I = " << nnn << ";";
+	break;
+    case 0xB000:
+	out << "PC = " << nnn << " + (P::JUMP_VX ? " << vx << " : V[0x0]);";
+	break;
+    case 0xC000:
+	out << vx << " = A::random(c) & " << nnn << ";";
+	break;
+    case 0xD000:
+	out << "A::draw<P>(c, " << vx << ", " << vy << ", " << (opcode & 0x000F) << ");";
+	break;
+    case 0xE000:
+	out << "PC = c.key[" << vx << "] == "
+	    << ((opcode & 0x00FF) == 0x9E ? "1" : "0") << skip;
+	break;
+    case 0xF000:
+	switch (opcode & 0x00FF)
+	{
+	case 0x07: out << vx << " = c.delay_timer;"; break;
+	case 0x0A:
+	    out << "PC = " << hex(addr, 3) << "; "
+		<< "for (unsigned int i = 0; i < Chip8::KEYS_SIZE; i++) "
+		<< "if (c.key[i] == 1) { " << vx << " = i; PC += 2; }";
+	    break;
+	case 0x15: out << "c.delay_timer = " << vx << ";"; break;
+	case 0x18: out << "c.sound_timer = " << vx << ";"; break;
+	case 0x1E:
+	    out << "V[0xF] = I + " << vx << " > 0xFFF ? 1 : 0; I += " << vx << ";";
+	    break;
+	case 0x29: out << "I = " << vx << " * 5;"; break;
+	case 0x33:
+	    out << "{ unsigned char value = " << vx << "; WMEM[I] = value / 100; "
+		<< "WMEM[I + 1] = (value / 10) % 10; WMEM[I + 2] = (value % 100) % 10; }";
+	    break;
+	case 0x55:
+	    out << "for (unsigned int i = 0; i < " << x << " + 1; i++) WMEM[I + i] = V[i]; "
+		<< "if (P::LOAD_STORE_INC_I) I += " << x << " + 1;";
+	    break;
+	case 0x65:
+	    out << "for (unsigned int i = 0; i < " << x << " + 1; i++) V[i] = MEM[I + i]; "
+		<< "if (P::LOAD_STORE_INC_I) I += " << x << " + 1;";
+	    break;
+	}
+	break;
+    }
+    return out.str();
+}
+
+int main(int argc, char** argv)
+{
+    Chip8::Profile profile = Chip8::PROFILE_AUTO;
+    std::string output;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "q:o:")) != -1)
+    {
+	switch (opt)
+	{
+	case 'q':
+	    if (Chip8::profile_from_name(optarg, profile))
+	    {
+		std::cout << "Unknown profile " << optarg << '\n';
+		usage(argv[0]);
+		return 1;
+	    }
+	    break;
+	case 'o':
+	    output = optarg;
+	    break;
+	default:
+	    usage(argv[0]);
+	    return 1;
+	}
+    }
+    if (argc - optind < 1)
+    {
+	usage(argv[0]);
+	return 1;
+    }
+    std::string rom_path = argv[optind];
+
+    unsigned char memory[Chip8::MEMORY_SIZE] = {0};
+    std::ifstream file(rom_path, std::ios::in|std::ios::binary|std::ios::ate);
+    if (!file.is_open())
+    {
+	std::cout << "Unable to open " << rom_path << '\n';
+	return 1;
+    }
+    unsigned int size = file.tellg();
+    if (size > Chip8::MAX_ROM_SIZE)
+    {
+	std::cout << "Error: ROM too big\n";
+	return 1;
+    }
+    file.seekg(0, std::ios::beg);
+    file.read((char*)&memory[Chip8::PROGRAM_START], size);
+    unsigned char *rom = &memory[Chip8::PROGRAM_START];
+
+    if (profile == Chip8::PROFILE_AUTO)
+	profile = Chip8::detect_profile(memory, size);
+
+    RomAnalysis analysis;
+    analysis.analyze(memory);
+
+    std::ofstream out_file;
+    if (output != "")
+    {
+	out_file.open(output);
+	if (!out_file.is_open())
+	{
+	    std::cout << "Unable to open " << output << '\n';
+	    return 1;
+	}
+    }
+    std::ostream &out = output != "" ? out_file : std::cout;
+
+    out << "// Generated by chip8_aot from " << rom_path << " (" << size
+	<< " bytes, profile " << Chip8::profile_name(profile) << "). Do not edit.\n\n"
+	<< "#include <cstring>\n\n#include \"Chip8Aot.hpp\"\n\n"
+	<< "namespace\n{\n\n"
+	<< "typedef Chip8Aot A;\n"
+	<< "typedef Chip8Policy<" << quirk_names[profile] << ", false> P;\n\n"
+	<< "#define V A::V(c)\n#define I A::I(c)\n#define PC A::pc(c)\n"
+	<< "#define SP A::sp(c)\n#define STACK A::stack(c)\n#define MEM A::mem(c)\n"
+	<< "#define WMEM A::wmem(c)\n\n";
+
+    // one function per block, guarded at dispatch by a copy of its code
+    // so that self-modified blocks fall back to the interpreter
+    for (unsigned int b = 0; b < analysis.blocks.size(); b++)
+    {
+	unsigned int start = analysis.blocks[b];
+	unsigned int count;
+	unsigned int end = analysis.block_end(start, &count);
+	bool sets_pc = false;
+
+	out << "const unsigned char code_" << std::hex << start << std::dec << "[] = {";
+	for (unsigned int a = start; a < end; a++)
+	    out << (a > start ? ", " : "") << hex(memory[a], 2);
+	out << "};\n\n";
+
+	out << "void block_" << std::hex << start << std::dec << "(Chip8 &c)\n{\n"
+	    << "    A::cycle(c) += " << count << ";\n";
+	unsigned short opcode = 0;
+	for (unsigned int a = start; a < end; a += 2)
+	{
+	    opcode = memory[a] << 8 | memory[a + 1];
+	    out << "    " << emit_instruction(opcode, a, &sets_pc)
+		<< " // " << hex(a, 3) << ": " << hex(opcode, 4) << "\n";
+	}
+	if (!sets_pc)
+	    out << "    PC = " << hex(end, 3) << ";\n";
+	out << "    A::opcode(c) = " << hex(opcode, 4) << ";\n}\n\n";
+    }
+
+    out << "void run(Chip8 &c, unsigned int instructions)\n{\n"
+	<< "    while (instructions > 0)\n    {\n"
+	<< "\tswitch (PC)\n\t{\n";
+    for (unsigned int b = 0; b < analysis.blocks.size(); b++)
+    {
+	unsigned int start = analysis.blocks[b];
+	unsigned int count;
+	unsigned int end = analysis.block_end(start, &count);
+	out << std::hex << "\tcase " << hex(start, 3) << ":\n"
+	    << "\t    if (instructions >= " << std::dec << count
+	    << " && memcmp(&MEM[" << hex(start, 3) << "], code_" << std::hex << start
+	    << std::dec << ", " << end - start << ") == 0)\n\t    {\n"
+	    << "\t\tblock_" << std::hex << start << std::dec << "(c);\n"
+	    << "\t\tinstructions -= " << count << ";\n\t\tcontinue;\n\t    }\n"
+	    << "\t    break;\n";
+    }
+    out << "\t}\n"
+	<< "\t// not proven to be code, self-modified or too long for what\n"
+	<< "\t// is left of the budget\n"
+	<< "\tc.run_instruction();\n\tinstructions--;\n    }\n}\n\n";
+
+    out << "const Chip8AotEntry entry = {" << hex(rom_hash(rom, size), 8) << ", "
+	<< size << ", " << profile_enums[profile] << ", run};\n"
+	<< "const int registered = (chip8_aot_register(&entry), 0);\n\n"
+	<< "}\n";
+
+    return 0;
+}
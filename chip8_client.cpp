@@ -0,0 +1,122 @@
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "ServerProtocol.hpp"
+
+/* Example client for chip8_server: runs a ROM in a new session for a
+   number of frames and prints the display */
+
+int send_all(int fd, const void *buf, size_t len)
+{
+    const char *p = (const char*)buf;
+    while (len > 0)
+    {
+	ssize_t n = write(fd, p, len);
+	if (n <= 0)
+	    return 1;
+	p += n;
+	len -= n;
+    }
+    return 0;
+}
+
+int recv_all(int fd, void *buf, size_t len)
+{
+    char *p = (char*)buf;
+    while (len > 0)
+    {
+	ssize_t n = read(fd, p, len);
+	if (n <= 0)
+	    return 1;
+	p += n;
+	len -= n;
+    }
+    return 0;
+}
+
+/* Sends a request and waits for its reply. Returns the reply status, or
+   -1 if the connection failed */
+int request(int fd, MsgHeader &h, const void *payload,
+	    std::vector<unsigned char> *reply = nullptr)
+{
+    if (send_all(fd, &h, sizeof(h)) || send_all(fd, payload, h.length))
+	return -1;
+    if (recv_all(fd, &h, sizeof(h)))
+	return -1;
+    std::vector<unsigned char> data(h.length);
+    if (h.length > 0 && recv_all(fd, &data[0], h.length))
+	return -1;
+    if (reply != nullptr)
+	reply->swap(data);
+    return h.status;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 3)
+    {
+	std::cout << "Usage: " << argv[0] << " SOCKET ROM [frames]\n";
+	return 1;
+    }
+    uint32_t frames = argc > 3 ? atoi(argv[3]) : 60;
+
+    std::ifstream file(argv[2], std::ios::in|std::ios::binary);
+    std::vector<char> rom((std::istreambuf_iterator<char>(file)),
+			  std::istreambuf_iterator<char>());
+    if (!file.is_open() || rom.empty())
+    {
+	std::cout << "Unable to open " << argv[2] << '\n';
+	return 1;
+    }
+
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, argv[1], sizeof(addr.sun_path) - 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1 || connect(fd, (sockaddr*)&addr, sizeof(addr)) == -1)
+    {
+	std::cout << "Unable to connect to " << argv[1] << '\n';
+	return 1;
+    }
+
+    MsgHeader h = {(uint32_t)rom.size(), MSG_CREATE, 0, 0, 0};
+    if (request(fd, h, &rom[0]) != STATUS_OK)
+    {
+	std::cout << "Unable to create a session\n";
+	return 1;
+    }
+    uint32_t session = h.session;
+
+    h = {sizeof(frames), MSG_STEP, 0, 0, session};
+    request(fd, h, &frames);
+
+    std::vector<unsigned char> frame;
+    h = {0, MSG_FRAME, 0, 0, session};
+    if (request(fd, h, nullptr, &frame) != STATUS_OK)
+	return 1;
+    uint64_t n;
+    memcpy(&n, &frame[0], sizeof(n));
+    printf("session %u frame %llu\n", session, (unsigned long long)n);
+    for (unsigned int y = 0; y < Chip8::VIDEO_HEIGHT; y++)
+    {
+	for (unsigned int x = 0; x < Chip8::VIDEO_WIDTH; x++)
+	{
+	    unsigned char byte = frame[9 + y * Chip8::VIDEO_WIDTH / 8 + x / 8];
+	    putchar(byte & (0x80 >> (x % 8)) ? '#' : ' ');
+	}
+	putchar('\n');
+    }
+
+    h = {0, MSG_DESTROY, 0, 0, session};
+    request(fd, h, nullptr);
+    close(fd);
+    return 0;
+}
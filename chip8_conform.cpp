@@ -0,0 +1,189 @@
+#include <iostream>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+
+#include "Conformance.hpp"
+#include "FramePacer.hpp"
+
+/* Runs a manifest of ROMs and compares their per-frame hashes with the
+   golden ones, reporting the first frame where each diverges. With -u
+   the golden files are written instead */
+
+enum Status
+{
+    STATUS_PASS,
+    STATUS_FAIL,
+    STATUS_NO_GOLDEN,
+    STATUS_UPDATED,
+    STATUS_ERROR
+};
+
+struct Outcome
+{
+    Status status;
+    unsigned int frame;     // first diverging frame
+    unsigned short expected_pc;
+    unsigned short pc;
+    unsigned int golden_frames;
+};
+
+void usage(const char *name)
+{
+    std::cout << "Usage: " << name << " [-u] [-t] [-c] [-j jobs] [-g golden_dir] MANIFEST\n\n"
+	      << "  -u  write the golden files instead of checking them\n"
+	      << "  -t  run on the direct threaded interpreter\n"
+	      << "  -c  run the checked variants of the profiles\n";
+}
+
+Outcome check_case(const ConformanceCase &test, const std::string &golden_path,
+		   Chip8::Engine engine, bool checked, bool update)
+{
+    Outcome outcome = {STATUS_PASS, 0, 0, 0, 0};
+    std::vector<GoldenFrame> frames;
+    if (run_case(test, engine, checked, frames))
+    {
+	outcome.status = STATUS_ERROR;
+	return outcome;
+    }
+    if (update)
+    {
+	outcome.status = save_golden(golden_path, frames) ? STATUS_ERROR : STATUS_UPDATED;
+	return outcome;
+    }
+
+    std::vector<GoldenFrame> golden;
+    if (load_golden(golden_path, golden))
+    {
+	outcome.status = STATUS_NO_GOLDEN;
+	return outcome;
+    }
+    outcome.golden_frames = golden.size();
+    for (unsigned int i = 0; i < frames.size(); i++)
+    {
+	if (i >= golden.size() || frames[i].hash != golden[i].hash)
+	{
+	    outcome.status = STATUS_FAIL;
+	    outcome.frame = i;
+	    outcome.expected_pc = i < golden.size() ? golden[i].pc : 0;
+	    outcome.pc = frames[i].pc;
+	    return outcome;
+	}
+    }
+    if (golden.size() != frames.size())
+	outcome.status = STATUS_FAIL;
+    outcome.frame = frames.size();
+    return outcome;
+}
+
+int main(int argc, char** argv)
+{
+    std::string golden_dir = ".";
+    Chip8::Engine engine = Chip8::ENGINE_SWITCH;
+    bool checked = false;
+    bool update = false;
+    unsigned int jobs = std::thread::hardware_concurrency();
+    int opt;
+
+    while ((opt = getopt(argc, argv, "utcj:g:")) != -1)
+    {
+	switch (opt)
+	{
+	case 'u':
+	    update = true;
+	    break;
+	case 't':
+	    engine = Chip8::ENGINE_THREADED;
+	    break;
+	case 'c':
+	    checked = true;
+	    break;
+	case 'j':
+	    jobs = atoi(optarg);
+	    break;
+	case 'g':
+	    golden_dir = optarg;
+	    break;
+	default:
+	    usage(argv[0]);
+	    return 1;
+	}
+    }
+    if (argc - optind < 1)
+    {
+	usage(argv[0]);
+	return 1;
+    }
+
+    std::vector<ConformanceCase> cases;
+    std::string error;
+    if (parse_manifest(argv[optind], cases, error))
+    {
+	std::cout << "Invalid manifest: " << error << '\n';
+	return 1;
+    }
+    if (jobs < 1)
+	jobs = 1;
+    if (jobs > cases.size())
+	jobs = cases.size();
+
+    // cases are independent, workers take the next one until none is left
+    std::vector<Outcome> outcomes(cases.size());
+    std::atomic<unsigned int> next(0);
+    long long start = FramePacer::now_ns();
+    std::vector<std::thread> workers;
+    for (unsigned int j = 0; j < jobs; j++)
+	workers.push_back(std::thread([&]()
+	{
+	    unsigned int i;
+	    while ((i = next.fetch_add(1)) < cases.size())
+		outcomes[i] = check_case(cases[i], golden_dir + "/" + cases[i].name + ".c8gh",
+					 engine, checked, update);
+	}));
+    for (std::thread &worker : workers)
+	worker.join();
+    double seconds = (FramePacer::now_ns() - start) / 1e9;
+
+    unsigned int failed = 0;
+    unsigned long long frames = 0;
+    for (unsigned int i = 0; i < cases.size(); i++)
+    {
+	const Outcome &o = outcomes[i];
+	const char *name = cases[i].name.c_str();
+	frames += cases[i].frames;
+	switch (o.status)
+	{
+	case STATUS_PASS:
+	    printf("PASS %s\n", name);
+	    break;
+	case STATUS_UPDATED:
+	    printf("SAVED %s\n", name);
+	    break;
+	case STATUS_FAIL:
+	    failed++;
+	    if (o.frame < o.golden_frames && o.frame < cases[i].frames)
+		printf("FAIL %s: diverges at frame %u, pc %03X (golden %03X)\n",
+		       name, o.frame, o.pc, o.expected_pc);
+	    else
+		printf("FAIL %s: %u frames, golden has %u\n", name,
+		       cases[i].frames, o.golden_frames);
+	    break;
+	case STATUS_NO_GOLDEN:
+	    failed++;
+	    printf("FAIL %s: no golden file, run with -u\n", name);
+	    break;
+	case STATUS_ERROR:
+	    failed++;
+	    printf("FAIL %s: unable to %s\n", name,
+		   update ? "load the ROM or write the golden file" : "load the ROM");
+	    break;
+	}
+    }
+    printf("%u of %u failed, %llu frames in %.2f s\n", failed,
+	   (unsigned int)cases.size(), frames, seconds);
+    return failed > 0 ? 1 : 0;
+}
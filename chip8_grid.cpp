@@ -0,0 +1,240 @@
+#include "SDL2/SDL.h"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <unistd.h>
+
+#include "Chip8.hpp"
+#include "FramePacer.hpp"
+#include "TileAtlas.hpp"
+
+/* Runs many sessions side by side in one window, for monitoring walls
+   and A/B comparisons. All of them are tiles of one TileAtlas texture;
+   the keyboard goes to the session clicked last */
+
+const Uint32 fps = 60;
+
+
+// Chip8 keypad, as in main.cpp
+const Uint32 keymap[Chip8::KEYS_SIZE] =
+    {SDL_SCANCODE_KP_0, SDL_SCANCODE_KP_1, SDL_SCANCODE_KP_2, SDL_SCANCODE_KP_3,
+     SDL_SCANCODE_KP_4, SDL_SCANCODE_KP_5, SDL_SCANCODE_KP_6, SDL_SCANCODE_KP_7,
+     SDL_SCANCODE_KP_8, SDL_SCANCODE_KP_9, SDL_SCANCODE_Q, SDL_SCANCODE_A,
+     SDL_SCANCODE_Z, SDL_SCANCODE_W, SDL_SCANCODE_S, SDL_SCANCODE_X};
+
+// Function keys
+const Uint32 KEY_NEXT = SDLK_TAB;
+const Uint32 KEY_PAUSE = SDLK_RETURN;
+const Uint32 KEY_RESET = SDLK_BACKSPACE;
+const Uint32 KEY_EXIT = SDLK_ESCAPE;
+
+struct Session
+{
+    std::string name;
+    Chip8 chip8;
+};
+
+SDL_Window *window = nullptr;
+SDL_Renderer *renderer = nullptr;
+SDL_Texture *texture = nullptr;
+
+void usage(const char *name)
+{
+    std::cout << "Usage: " << name << " [-c columns] [-n copies] [-x scale] [-q chip8|vip|schip]\n"
+	      << "       [-f frequency] ROM...\n\n"
+	      << "  -n  sessions per ROM, each with its own random seed\n";
+}
+
+int init_SDL(unsigned int width, unsigned int height, int scale)
+{
+    if (SDL_Init(SDL_INIT_EVERYTHING) == -1)
+    {
+	std::cout << SDL_GetError() << '\n';
+	return 1;
+    }
+    window = SDL_CreateWindow("Chip8 grid", 100, 100, width * scale,
+			      height * scale, SDL_WINDOW_SHOWN);
+    if (window == nullptr)
+    {
+	std::cout << SDL_GetError() << '\n';
+	return 1;
+    }
+    renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
+    if (renderer == nullptr)
+    {
+	std::cout << SDL_GetError() << '\n';
+	return 1;
+    }
+    texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
+				SDL_TEXTUREACCESS_STREAMING, width, height);
+    if (texture == nullptr)
+    {
+	std::cout << SDL_GetError() << '\n';
+	return 1;
+    }
+    return 0;
+}
+
+void stop_SDL()
+{
+    SDL_DestroyTexture(texture);
+    SDL_DestroyRenderer(renderer);
+    SDL_DestroyWindow(window);
+    SDL_Quit();
+}
+
+/* Keys go to the focused session only */
+void focus(TileAtlas &atlas, std::vector<Session> &sessions, int tile)
+{
+    if (tile < 0 || tile == atlas.get_focus())
+	return;
+    if (atlas.get_focus() >= 0)
+	for (unsigned int i = 0; i < Chip8::KEYS_SIZE; i++)
+	    sessions[atlas.get_focus()].chip8.key[i] = 0;
+    atlas.set_focus(tile);
+    std::string title = "Chip8 grid: " + sessions[tile].name;
+    SDL_SetWindowTitle(window, title.c_str());
+}
+
+int main(int argc, char** argv)
+{
+    Chip8::Profile profile = Chip8::PROFILE_AUTO;
+    unsigned int columns = 0;
+    unsigned int copies = 1;
+    unsigned int freq = 400;
+    int scale = 4;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "c:n:x:q:f:")) != -1)
+    {
+	switch (opt)
+	{
+	case 'c':
+	    columns = atoi(optarg);
+	    break;
+	case 'n':
+	    copies = atoi(optarg);
+	    break;
+	case 'x':
+	    scale = atoi(optarg);
+	    break;
+	case 'q':
+	    if (Chip8::profile_from_name(optarg, profile))
+	    {
+		std::cout << "Unknown profile " << optarg << '\n';
+		usage(argv[0]);
+		return 1;
+	    }
+	    break;
+	case 'f':
+	    freq = atoi(optarg);
+	    break;
+	default:
+	    usage(argv[0]);
+	    return 1;
+	}
+    }
+    if (argc - optind < 1 || copies < 1 || scale < 1)
+    {
+	usage(argv[0]);
+	return 1;
+    }
+
+    std::vector<Session> sessions;
+    for (int arg = optind; arg < argc; arg++)
+    {
+	Session first;
+	first.name = argv[arg];
+	if (first.chip8.initialize(0, argv[arg]))
+	{
+	    std::cout << "Unable to load " << argv[arg] << '\n';
+	    return 1;
+	}
+	first.chip8.set_profile(profile, true);
+	first.chip8.set_speed(freq, fps);
+	first.chip8.set_stop_events(Chip8::EVENT_KEY_WAIT);
+	for (unsigned int copy = 0; copy < copies; copy++)
+	{
+	    // copies share the ROM's memory until they write to it
+	    Session s;
+	    s.name = first.name;
+	    s.chip8 = first.chip8.fork();
+	    s.chip8.set_seed(copy);
+	    sessions.push_back(s);
+	}
+    }
+
+    TileAtlas atlas(sessions.size(), columns);
+    if (init_SDL(atlas.width(), atlas.height(), scale))
+	return 1;
+    focus(atlas, sessions, 0);
+
+    bool paused = false;
+    bool quit = false;
+    FramePacer pacer(fps);
+    pacer.start();
+    while (!quit)
+    {
+	SDL_Event e;
+	while (SDL_PollEvent(&e))
+	{
+	    if (e.type == SDL_QUIT)
+		quit = true;
+	    else if (e.type == SDL_MOUSEBUTTONDOWN && e.button.button == SDL_BUTTON_LEFT)
+		focus(atlas, sessions, atlas.tile_at(e.button.x / scale, e.button.y / scale));
+	    else if (e.type == SDL_KEYDOWN && !e.key.repeat)
+	    {
+		switch (e.key.keysym.sym)
+		{
+		case KEY_NEXT:
+		    focus(atlas, sessions, (atlas.get_focus() + 1) % sessions.size());
+		    break;
+		case KEY_PAUSE:
+		    paused = !paused;
+		    break;
+		case KEY_RESET:
+		    sessions[atlas.get_focus()].chip8.restart();
+		    break;
+		case KEY_EXIT:
+		    quit = true;
+		    break;
+		default:
+		    break;
+		}
+	    }
+	}
+
+	const Uint8 *keystates = SDL_GetKeyboardState(NULL);
+	Chip8 &focused = sessions[atlas.get_focus()].chip8;
+	for (unsigned int i = 0; i < Chip8::KEYS_SIZE; i++)
+	    focused.key[i] = keystates[keymap[i]] ? 1 : 0;
+
+	for (unsigned int i = 0; i < sessions.size(); i++)
+	{
+	    if (!paused)
+	    {
+		Chip8::RunResult result;
+		do
+		    result = sessions[i].chip8.run_frame();
+		while (!result.frame_end);
+	    }
+	    atlas.update(i, sessions[i].chip8.get_display_rows());
+	}
+
+	// one upload of everything that changed, one draw of the grid
+	TileAtlas::Rect dirty = atlas.take_dirty();
+	if (dirty.w > 0)
+	{
+	    SDL_Rect rect = {(int)dirty.x, (int)dirty.y, (int)dirty.w, (int)dirty.h};
+	    SDL_UpdateTexture(texture, &rect, atlas.pixels(dirty), atlas.pitch());
+	}
+	SDL_RenderClear(renderer);
+	SDL_RenderCopy(renderer, texture, nullptr, nullptr);
+	SDL_RenderPresent(renderer);
+	pacer.wait();
+    }
+
+    stop_SDL();
+    return 0;
+}
@@ -0,0 +1,207 @@
+#include <iostream>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+#include "InputSearch.hpp"
+
+/* Searches for the inputs that take a ROM to a goal: a condition on a
+   byte of memory, the highest or lowest value of one, or a picture on
+   the display */
+
+
+void usage(const char *name)
+{
+    std::cout << "Usage: " << name << " [-q chip8|vip|schip] [-s seed] [-f frequency]\n"
+	      << "       [-i interval] [-d depth] [-k keys] [-t threads] [-n max_states]\n"
+	      << "       (-a ADDR=VALUE|-a max:ADDR|-p PATTERN.pbm[@X,Y]) ROM\n\n"
+	      << "  -a ADDR OP VALUE  memory[ADDR] compared with VALUE, OP one of = ! < >\n"
+	      << "  -a max:ADDR       highest value of memory[ADDR] (min: for lowest)\n"
+	      << "  -p PATTERN.pbm    P1 image that must appear on the display at X,Y\n"
+	      << "  -k keys           hex digits of the keys to try, . for no key\n";
+}
+
+/* Parses "0x2F0>5", "max:0x2F0" or "min:0x2F0" */
+RamGoal *parse_ram_goal(const std::string &spec)
+{
+    if (spec.compare(0, 4, "max:") == 0 || spec.compare(0, 4, "min:") == 0)
+	return new RamGoal(strtoul(spec.c_str() + 4, nullptr, 0),
+			   spec[1] == 'a' ? RamGoal::MAXIMIZE : RamGoal::MINIMIZE);
+
+    size_t op = spec.find_first_of("=!<>");
+    if (op == std::string::npos || op == 0)
+	return nullptr;
+    RamGoal::Compare compare;
+    switch (spec[op])
+    {
+    case '=': compare = RamGoal::EQUAL; break;
+    case '!': compare = RamGoal::NOT_EQUAL; break;
+    case '<': compare = RamGoal::LESS; break;
+    default: compare = RamGoal::GREATER; break;
+    }
+    return new RamGoal(strtoul(spec.c_str(), nullptr, 0), compare,
+		       strtoul(spec.c_str() + op + 1, nullptr, 0));
+}
+
+/* Next header field of a PBM file, skipping comments */
+std::string pbm_token(std::istream &in)
+{
+    std::string token;
+    while (in >> token && token[0] == '#')
+	in.ignore(1 << 16, '\n');
+    return token;
+}
+
+/* Reads a P1 image, such as recorder_convert writes. Full screen images
+   scaled up by an integer factor are scaled back down. nullptr if the
+   image cannot be read or does not overlap the display at x, y */
+FrameGoal *parse_frame_goal(const std::string &spec)
+{
+    std::string path = spec;
+    unsigned int x = 0, y = 0;
+    size_t at = spec.rfind('@');
+    if (at != std::string::npos)
+    {
+	path = spec.substr(0, at);
+	if (sscanf(spec.c_str() + at + 1, "%u,%u", &x, &y) != 2)
+	    return nullptr;
+    }
+    if (x >= Chip8::VIDEO_WIDTH || y >= Chip8::VIDEO_HEIGHT)
+	return nullptr;
+
+    std::ifstream file(path);
+    std::string magic = pbm_token(file);
+    unsigned int width = atoi(pbm_token(file).c_str());
+    unsigned int height = atoi(pbm_token(file).c_str());
+    if (magic != "P1" || width == 0 || height == 0)
+	return nullptr;
+    std::vector<unsigned char> image;
+    char c;
+    while (image.size() < width * height && file >> c)
+    {
+	if (c == '#')
+	    file.ignore(1 << 16, '\n');
+	else
+	    image.push_back(c == '1');
+    }
+    if (image.size() < width * height)
+	return nullptr;
+
+    unsigned int scale = width / Chip8::VIDEO_WIDTH;
+    if (scale > 1 && width == Chip8::VIDEO_WIDTH * scale &&
+	height == Chip8::VIDEO_HEIGHT * scale)
+    {
+	std::vector<unsigned char> small;
+	for (unsigned int row = 0; row < Chip8::VIDEO_HEIGHT; row++)
+	    for (unsigned int col = 0; col < Chip8::VIDEO_WIDTH; col++)
+		small.push_back(image[row * scale * width + col * scale]);
+	image.swap(small);
+	width = Chip8::VIDEO_WIDTH;
+	height = Chip8::VIDEO_HEIGHT;
+    }
+    return new FrameGoal(image, width, height, x, y);
+}
+
+int main(int argc, char** argv)
+{
+    Chip8::Profile profile = Chip8::PROFILE_AUTO;
+    unsigned int seed = 0;
+    unsigned int freq = 400;
+    InputSearch::Options options;
+    std::unique_ptr<SearchGoal> goal;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "q:s:f:i:d:k:t:n:a:p:")) != -1)
+    {
+	switch (opt)
+	{
+	case 'q':
+	    if (Chip8::profile_from_name(optarg, profile))
+	    {
+		std::cout << "Unknown profile " << optarg << '\n';
+		usage(argv[0]);
+		return 1;
+	    }
+	    break;
+	case 's':
+	    seed = strtoul(optarg, nullptr, 0);
+	    break;
+	case 'f':
+	    freq = atoi(optarg);
+	    break;
+	case 'i':
+	    options.interval = atoi(optarg);
+	    break;
+	case 'd':
+	    options.depth = atoi(optarg);
+	    break;
+	case 'k':
+	    for (const char *k = optarg; *k != '\0'; k++)
+	    {
+		if (*k == '.')
+		    options.choices.push_back(InputSearch::NO_KEY);
+		else if (isxdigit(*k))
+		    options.choices.push_back(strtoul(std::string(1, *k).c_str(), nullptr, 16));
+	    }
+	    break;
+	case 't':
+	    options.threads = atoi(optarg);
+	    break;
+	case 'n':
+	    options.max_states = strtoull(optarg, nullptr, 0);
+	    break;
+	case 'a':
+	    goal.reset(parse_ram_goal(optarg));
+	    if (!goal)
+	    {
+		std::cout << "Invalid memory goal " << optarg << '\n';
+		return 1;
+	    }
+	    break;
+	case 'p':
+	    goal.reset(parse_frame_goal(optarg));
+	    if (!goal)
+	    {
+		std::cout << "Invalid pattern " << optarg
+			  << ": unreadable or off the display\n";
+		return 1;
+	    }
+	    break;
+	default:
+	    usage(argv[0]);
+	    return 1;
+	}
+    }
+    if (argc - optind < 1 || !goal)
+    {
+	usage(argv[0]);
+	return 1;
+    }
+
+    Chip8 start;
+    if (start.initialize(0, argv[optind]))
+	return 1;
+    start.set_seed(seed);
+    start.set_profile(profile);
+    start.set_speed(freq, 60);
+    start.set_stop_events(Chip8::EVENT_KEY_WAIT);
+
+    InputSearch search(*goal);
+    InputSearch::Result result = search.run(start, options);
+
+    std::cout << (result.reached ? "reached" : "not reached")
+	      << ", score " << result.score
+	      << ", " << result.states << " states run, "
+	      << result.duplicates << " duplicates\n";
+    // one character per decision, held for interval frames
+    std::cout << "inputs ";
+    for (signed char choice : result.inputs)
+	std::cout << (choice == InputSearch::NO_KEY ? '.' : "0123456789ABCDEF"[choice]);
+    std::cout << " (interval " << options.interval << ", seed " << seed << ")\n";
+    return result.reached ? 0 : 2;
+}
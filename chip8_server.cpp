@@ -0,0 +1,81 @@
+#include <iostream>
+#include <csignal>
+#include <cstdlib>
+#include <memory>
+#include <thread>
+#include <unistd.h>
+
+#include "SessionServer.hpp"
+
+/* Headless server for many CHIP-8 sessions, see ServerProtocol.hpp */
+
+SessionServer server;
+
+void on_signal(int)
+{
+    server.stop();
+}
+
+int main(int argc, char** argv)
+{
+    unsigned int workers = std::thread::hardware_concurrency();
+    unsigned int max_sessions = 4096;
+    std::string metrics_file;
+    std::string metrics_socket;
+    MetricsExporter exporter;
+    std::unique_ptr<RomCache> rom_cache;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "w:m:x:X:C:")) != -1)
+    {
+	switch (opt)
+	{
+	case 'x':
+	    metrics_file = optarg;
+	    break;
+	case 'X':
+	    metrics_socket = optarg;
+	    break;
+	case 'w':
+	    workers = atoi(optarg);
+	    break;
+	case 'm':
+	    max_sessions = atoi(optarg);
+	    break;
+	case 'C':
+	    rom_cache.reset(new RomCache(optarg));
+	    server.set_rom_cache(rom_cache.get());
+	    break;
+	default:
+	    break;
+	}
+    }
+    if (argc - optind < 1)
+    {
+	std::cout << "Usage: " << argv[0] << " [-w workers] [-m max_sessions] [-x metrics_file] [-X metrics_socket] [-C cache_dir] SOCKET\n";
+	return 1;
+    }
+
+    if (server.open(argv[optind], workers, max_sessions))
+    {
+	std::cout << "Unable to listen on " << argv[optind] << '\n';
+	server.close();
+	return 1;
+    }
+    if (exporter.open(server.get_metrics(), metrics_file, metrics_socket))
+    {
+	std::cout << "Unable to export metrics\n";
+	server.close();
+	return 1;
+    }
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    server.run();
+    exporter.close();
+    if (server.get_metrics().frames_late > 0)
+	std::cout << server.get_metrics().frames_late
+		  << " ticks skipped: the workers could not keep up\n";
+    server.close();
+    return 0;
+}
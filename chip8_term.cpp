@@ -0,0 +1,202 @@
+#include <iostream>
+#include <string>
+#include <cctype>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <termios.h>
+#include <unistd.h>
+
+#include "Chip8.hpp"
+#include "FramePacer.hpp"
+#include "TermRenderer.hpp"
+
+/* Terminal frontend, for machines without a display or watching over
+   SSH: draws with TermRenderer and reads keys from stdin */
+
+const unsigned int fps = 60;
+
+
+// Chip8 keys by character, as on the SDL frontend: 0 to 9, then QAZWSX
+// for A to F
+const char *key_chars = "0123456789qazwsx";
+
+volatile sig_atomic_t quit = 0;
+volatile sig_atomic_t resized = 0;
+
+struct termios saved_termios;
+
+void on_quit(int)
+{
+    quit = 1;
+}
+
+void on_resize(int)
+{
+    resized = 1;
+}
+
+void usage(const char *name)
+{
+    std::cout << "Usage: " << name << " [-b] [-r bytes_per_second] [-q chip8|vip|schip]\n"
+	      << "       [-f frequency] [-k hold_ms] ROM\n\n"
+	      << "  -b  braille cells (2x4 pixels) instead of half blocks (1x2)\n"
+	      << "  -r  cap the output to this many bytes per second\n"
+	      << "  -k  how long a key stays down after its last character\n";
+}
+
+/* Characters are read as they come, without echo; ^C still quits */
+int enter_raw_mode()
+{
+    if (tcgetattr(STDIN_FILENO, &saved_termios))
+	return 1;
+    struct termios raw = saved_termios;
+    raw.c_lflag &= ~(ICANON | ECHO);
+    raw.c_cc[VMIN] = 0;
+    raw.c_cc[VTIME] = 0;
+    return tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+}
+
+void write_all(const std::string &data)
+{
+    const char *p = data.data();
+    size_t size = data.size();
+    while (size > 0 && !quit)
+    {
+	ssize_t n = write(STDOUT_FILENO, p, size);
+	if (n <= 0)
+	    return;
+	p += n;
+	size -= n;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    Chip8::Profile profile = Chip8::PROFILE_AUTO;
+    TermRenderer::Mode mode = TermRenderer::MODE_HALF_BLOCK;
+    unsigned int rate = 0;
+    unsigned int freq = 400;
+    unsigned int hold_ms = 150;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "br:q:f:k:")) != -1)
+    {
+	switch (opt)
+	{
+	case 'b':
+	    mode = TermRenderer::MODE_BRAILLE;
+	    break;
+	case 'r':
+	    rate = atoi(optarg);
+	    break;
+	case 'q':
+	    if (Chip8::profile_from_name(optarg, profile))
+	    {
+		std::cout << "Unknown profile " << optarg << '\n';
+		usage(argv[0]);
+		return 1;
+	    }
+	    break;
+	case 'f':
+	    freq = atoi(optarg);
+	    break;
+	case 'k':
+	    hold_ms = atoi(optarg);
+	    break;
+	default:
+	    usage(argv[0]);
+	    return 1;
+	}
+    }
+    if (argc - optind < 1)
+    {
+	usage(argv[0]);
+	return 1;
+    }
+
+    Chip8 myChip8;
+    if (myChip8.initialize(time(nullptr), argv[optind]))
+    {
+	std::cout << "Unable to load " << argv[optind] << '\n';
+	return 1;
+    }
+    myChip8.set_profile(profile);
+    myChip8.set_speed(freq, fps);
+    myChip8.set_stop_events(Chip8::EVENT_KEY_WAIT);
+
+    if (enter_raw_mode())
+    {
+	std::cout << "stdin is not a terminal\n";
+	return 1;
+    }
+    signal(SIGINT, on_quit);
+    signal(SIGTERM, on_quit);
+    signal(SIGHUP, on_quit);
+    signal(SIGWINCH, on_resize);
+
+    TermRenderer renderer(mode, rate);
+    // terminals send no key releases: a key is held for hold_frames
+    // after its last character, long enough to bridge auto-repeat
+    unsigned int hold_frames = (hold_ms * fps + 999) / 1000;
+    unsigned int held[Chip8::KEYS_SIZE] = {0};
+    bool paused = false;
+    unsigned char last_sound_timer = 0;
+    std::string out = TermRenderer::begin();
+    FramePacer pacer(fps);
+    pacer.start();
+    while (!quit)
+    {
+	char input[64];
+	ssize_t n = read(STDIN_FILENO, input, sizeof(input));
+	// a lone escape quits, longer sequences are function keys
+	if (n == 1 && input[0] == '\x1b')
+	    break;
+	for (ssize_t i = 0; i < n && input[0] != '\x1b'; i++)
+	{
+	    const char *k = strchr(key_chars, tolower(input[i]));
+	    if (k != nullptr && input[i] != '\0')
+		held[k - key_chars] = hold_frames;
+	    else if (input[i] == '\r' || input[i] == '\n')
+		paused = !paused;
+	    else if (input[i] == '\x7f' || input[i] == '\b')
+		myChip8.restart();
+	}
+
+	if (resized)
+	{
+	    resized = 0;
+	    renderer.invalidate();
+	}
+
+	if (!paused)
+	{
+	    for (unsigned int i = 0; i < Chip8::KEYS_SIZE; i++)
+	    {
+		myChip8.key[i] = held[i] > 0;
+		if (held[i] > 0)
+		    held[i]--;
+	    }
+	    Chip8::RunResult result;
+	    do
+		result = myChip8.run_frame();
+	    while (!result.frame_end);
+
+	    unsigned char sound_timer = myChip8.get_registers().sound_timer;
+	    if (sound_timer > 0 && last_sound_timer == 0)
+		out += '\a';
+	    last_sound_timer = sound_timer;
+	}
+
+	renderer.update(myChip8.gfx, FramePacer::now_ns(), out);
+	write_all(out);
+	out.clear();
+	pacer.wait();
+    }
+
+    quit = 0;
+    write_all(renderer.end());
+    tcsetattr(STDIN_FILENO, TCSANOW, &saved_termios);
+    return 0;
+}
@@ -0,0 +1,157 @@
+#include <iostream>
+#include <deque>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "Trace.hpp"
+
+/* Prints execution traces written by TraceBuffer, or compares two and
+   shows where they first diverge */
+
+void usage(const char *name)
+{
+    std::cout << "Usage: " << name << " print TRACE [first_cycle [count]]\n"
+	      << "       " << name << " diff TRACE_A TRACE_B [context]\n";
+}
+
+/* One line per instruction: cycle, pc, opcode and what it changed */
+std::string format_step(const TraceStep &step)
+{
+    char buf[160];
+    int n = snprintf(buf, sizeof(buf), "%10llu %03X %04X", step.cycle, step.pc,
+		     step.opcode);
+    std::string line(buf, n);
+    if (step.sync)
+	line += " [sync]";
+    if (step.frames > 0)
+    {
+	snprintf(buf, sizeof(buf), " +%uf", step.frames);
+	line += buf;
+    }
+    if (step.after.pc != (unsigned short)(step.pc + 2))
+    {
+	snprintf(buf, sizeof(buf), " pc=%03X", step.after.pc);
+	line += buf;
+    }
+    for (unsigned int i = 0; i < 16; i++)
+	if (step.changed & (1 << i))
+	{
+	    snprintf(buf, sizeof(buf), " V%X=%02X", i, step.after.V[i]);
+	    line += buf;
+	}
+    if (step.mem_length > 0)
+    {
+	snprintf(buf, sizeof(buf), " [%03X]=", step.mem_addr);
+	line += buf;
+	for (unsigned int i = 0; i < step.mem_length; i++)
+	{
+	    snprintf(buf, sizeof(buf), "%s%02X", i > 0 ? " " : "", step.mem[i]);
+	    line += buf;
+	}
+    }
+    snprintf(buf, sizeof(buf), " I=%03X sp=%u", step.after.I, step.after.sp);
+    return line + buf;
+}
+
+int print_trace(const char *path, unsigned long long first, unsigned long long count)
+{
+    TraceReader reader;
+    if (reader.open(path))
+    {
+	std::cout << "Unable to read " << path << '\n';
+	return 1;
+    }
+    TraceStep step;
+    unsigned long long printed = 0;
+    while (printed < count && reader.next(step))
+    {
+	if (step.cycle < first)
+	    continue;
+	std::cout << format_step(step) << '\n';
+	printed++;
+    }
+    return 0;
+}
+
+/* Everything two traces record for the same cycle */
+bool same_step(const TraceStep &a, const TraceStep &b)
+{
+    return a.pc == b.pc && a.opcode == b.opcode && a.after.pc == b.after.pc &&
+	a.after.I == b.after.I && a.after.sp == b.after.sp &&
+	memcmp(a.after.V, b.after.V, sizeof(a.after.V)) == 0 &&
+	a.mem_length == b.mem_length &&
+	(a.mem_length == 0 || (a.mem_addr == b.mem_addr &&
+			       memcmp(a.mem, b.mem, a.mem_length) == 0));
+}
+
+int diff_traces(const char *path_a, const char *path_b, unsigned int context)
+{
+    TraceReader a, b;
+    if (a.open(path_a) || b.open(path_b))
+    {
+	std::cout << "Unable to read " << path_a << " or " << path_b << '\n';
+	return 1;
+    }
+
+    TraceStep step_a, step_b;
+    bool more_a = a.next(step_a);
+    bool more_b = b.next(step_b);
+    std::deque<std::pair<std::string, std::string> > history;
+    unsigned long long compared = 0;
+    while (more_a && more_b)
+    {
+	// the rings may have dropped different amounts of history
+	if (step_a.cycle < step_b.cycle)
+	{
+	    more_a = a.next(step_a);
+	    continue;
+	}
+	if (step_b.cycle < step_a.cycle)
+	{
+	    more_b = b.next(step_b);
+	    continue;
+	}
+
+	std::string line_a = format_step(step_a);
+	std::string line_b = format_step(step_b);
+	if (!same_step(step_a, step_b))
+	{
+	    std::cout << "First divergence at cycle " << step_a.cycle
+		      << " after " << compared << " matching instructions\n";
+	    for (const std::pair<std::string, std::string> &h : history)
+		printf("  %-60s | %s\n", h.first.c_str(), h.second.c_str());
+	    printf("> %-60s | %s\n", line_a.c_str(), line_b.c_str());
+	    return 2;
+	}
+	history.push_back(std::make_pair(line_a, line_b));
+	if (history.size() > context)
+	    history.pop_front();
+	compared++;
+	more_a = a.next(step_a);
+	more_b = b.next(step_b);
+    }
+
+    if (compared == 0)
+    {
+	std::cout << "No cycles in common\n";
+	return 2;
+    }
+    std::cout << compared << " instructions match";
+    if (more_a || more_b)
+	std::cout << ", " << (more_a ? path_a : path_b) << " goes on";
+    std::cout << '\n';
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc >= 3 && std::string(argv[1]) == "print")
+	return print_trace(argv[2], argc > 3 ? strtoull(argv[3], nullptr, 0) : 0,
+			   argc > 4 ? strtoull(argv[4], nullptr, 0) : ~0ULL);
+    if (argc >= 4 && std::string(argv[1]) == "diff")
+	return diff_traces(argv[2], argv[3], argc > 4 ? atoi(argv[4]) : 8);
+    usage(argv[0]);
+    return 1;
+}
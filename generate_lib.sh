@@ -0,0 +1 @@
+g++ -c -O2 -fPIC -fvisibility=hidden -fvisibility-inlines-hidden -std=c++11 Analysis.cpp Chip8.cpp libchip8.cpp && ar rcs libchip8.a Analysis.o Chip8.o libchip8.o && g++ -shared -o libchip8.so Analysis.o Chip8.o libchip8.o -pthread
@@ -0,0 +1,159 @@
+#include "libchip8.h"
+#include "Chip8.hpp"
+
+#include <cstring>
+#include <new>
+
+/* C interface over Chip8, see libchip8.h */
+
+struct chip8
+{
+    Chip8 machine;
+};
+
+static_assert(sizeof(chip8_state) == sizeof(Chip8::Registers),
+	      "chip8_state must match Chip8::Registers");
+static_assert(CHIP8_MEMORY_SIZE == Chip8::MEMORY_SIZE &&
+	      CHIP8_VIDEO_WIDTH == Chip8::VIDEO_WIDTH &&
+	      CHIP8_VIDEO_HEIGHT == Chip8::VIDEO_HEIGHT &&
+	      CHIP8_KEYS == Chip8::KEYS_SIZE, "libchip8.h sizes out of date");
+
+/* Every entry point that can allocate catches std::bad_alloc: it must
+   not unwind into C callers */
+
+chip8 *chip8_create(const unsigned char *rom, size_t size,
+		    enum chip8_profile profile, unsigned int seed)
+{
+    if (size > Chip8::MAX_ROM_SIZE)
+	return nullptr;
+    chip8 *c = nullptr;
+    try
+    {
+	c = new chip8;
+	c->machine.set_seed(seed);
+	if (c->machine.load_rom(rom, size))
+	{
+	    delete c;
+	    return nullptr;
+	}
+	// checked: stack faults in a ROM from anywhere must not write
+	// outside the instance
+	c->machine.set_profile((Chip8::Profile)profile, true);
+	return c;
+    }
+    catch (const std::bad_alloc &)
+    {
+	delete c;
+	return nullptr;
+    }
+}
+
+chip8 *chip8_fork(const chip8 *c)
+{
+    chip8 *child = nullptr;
+    try
+    {
+	child = new chip8;
+	child->machine = c->machine.fork();
+	return child;
+    }
+    catch (const std::bad_alloc &)
+    {
+	delete child;
+	return nullptr;
+    }
+}
+
+void chip8_destroy(chip8 *c)
+{
+    delete c;
+}
+
+int chip8_restart(chip8 *c)
+{
+    try
+    {
+	c->machine.restart();
+	return 0;
+    }
+    catch (const std::bad_alloc &)
+    {
+	return -1;
+    }
+}
+
+unsigned int chip8_step(chip8 *c, unsigned int n)
+{
+    try
+    {
+	return c->machine.run_instructions(n);
+    }
+    catch (const std::bad_alloc &)
+    {
+	return 0;
+    }
+}
+
+int chip8_run_frame(chip8 *c)
+{
+    try
+    {
+	Chip8::RunResult result;
+	do
+	    result = c->machine.run_frame();
+	while (!result.frame_end);
+	return 0;
+    }
+    catch (const std::bad_alloc &)
+    {
+	return -1;
+    }
+}
+
+void chip8_set_speed(chip8 *c, unsigned int instructions_per_second,
+		     unsigned int frames_per_second)
+{
+    c->machine.set_speed(instructions_per_second, frames_per_second);
+}
+
+void chip8_set_key(chip8 *c, unsigned int key, int down)
+{
+    if (key < Chip8::KEYS_SIZE)
+	c->machine.key[key] = down ? 1 : 0;
+}
+
+void chip8_get_state(const chip8 *c, struct chip8_state *state)
+{
+    Chip8::Registers regs = c->machine.get_registers();
+    memcpy(state, &regs, sizeof(regs));
+}
+
+void chip8_set_state(chip8 *c, const struct chip8_state *state)
+{
+    Chip8::Registers regs;
+    memcpy(&regs, state, sizeof(regs));
+    c->machine.set_registers(regs);
+}
+
+const unsigned char *chip8_memory(const chip8 *c)
+{
+    return c->machine.get_memory();
+}
+
+int chip8_set_memory(chip8 *c, const unsigned char *image)
+{
+    try
+    {
+	c->machine.load_memory(image);
+	return 0;
+    }
+    catch (const std::bad_alloc &)
+    {
+	return -1;
+    }
+}
+
+const unsigned char *chip8_framebuffer(const chip8 *c)
+{
+    return &c->machine.gfx[0][0];
+}
@@ -0,0 +1,114 @@
+#ifndef __libchip8_H__
+#define __libchip8_H__
+
+/* C interface to the emulator core, for embedding. Built into libchip8.a
+   and libchip8.so by generate_lib.sh from Chip8.cpp and libchip8.cpp
+   only: the core does no file or console I/O and has no static
+   constructors, so creating an instance never touches the filesystem.
+   An instance may be used from any thread, but from one at a time.
+
+   Instances allocate when they are created, forked or restarted and
+   when they first write to memory or the display they share. If memory
+   runs out the call fails as documented below; an instance that failed
+   while running may be left mid-instruction and should be destroyed. */
+
+#include <stddef.h>
+
+#if defined(__GNUC__)
+#define CHIP8_API __attribute__((visibility("default")))
+#else
+#define CHIP8_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct chip8 chip8;
+
+enum
+{
+    CHIP8_MEMORY_SIZE = 4096,
+    CHIP8_VIDEO_WIDTH = 64,
+    CHIP8_VIDEO_HEIGHT = 32,
+    CHIP8_KEYS = 16
+};
+
+/* Same values as Chip8::Profile */
+enum chip8_profile
+{
+    CHIP8_PROFILE_AUTO,
+    CHIP8_PROFILE_CHIP8,
+    CHIP8_PROFILE_COSMAC_VIP,
+    CHIP8_PROFILE_SUPER_CHIP
+};
+
+/* Same layout as Chip8::Registers */
+struct chip8_state
+{
+    unsigned char V[16];
+    unsigned short I;
+    unsigned short pc;
+    unsigned short stack[16];
+    unsigned char sp;
+    unsigned char delay_timer;
+    unsigned char sound_timer;
+    unsigned short opcode;
+    unsigned long long cycle;
+    unsigned int rand_state;
+};
+
+/* New instance running size bytes of rom, or NULL if the ROM does not
+   fit or memory runs out. It runs the checked variant of profile, so
+   no ROM can make it write outside its own state. Instances created
+   from the same ROM share its memory image until they write to it */
+CHIP8_API chip8 *chip8_create(const unsigned char *rom, size_t size,
+			      enum chip8_profile profile, unsigned int seed);
+
+/* Copy of an instance, sharing memory and display copy-on-write, or
+   NULL if memory runs out */
+CHIP8_API chip8 *chip8_fork(const chip8 *c);
+
+CHIP8_API void chip8_destroy(chip8 *c);
+
+/* Back to the state chip8_create() left it in. Returns 0, or -1 if
+   memory runs out */
+CHIP8_API int chip8_restart(chip8 *c);
+
+/* Runs n instructions without ticking the timers. Returns the number
+   of cycles spent, 0 if memory runs out */
+CHIP8_API unsigned int chip8_step(chip8 *c, unsigned int n);
+
+/* Runs one 60 Hz frame: ticks the timers and runs the instructions the
+   frame gets at the speed set with chip8_set_speed() (400 per second by
+   default). Returns 0, or -1 if memory runs out */
+CHIP8_API int chip8_run_frame(chip8 *c);
+
+CHIP8_API void chip8_set_speed(chip8 *c, unsigned int instructions_per_second,
+			       unsigned int frames_per_second);
+
+/* Sets key (0 to 15) down or up */
+CHIP8_API void chip8_set_key(chip8 *c, unsigned int key, int down);
+
+/* Registers and timers. A stack pointer past the end of the stack is
+   clamped to it, so a made up state cannot take the instance outside
+   its own state either */
+CHIP8_API void chip8_get_state(const chip8 *c, struct chip8_state *state);
+CHIP8_API void chip8_set_state(chip8 *c, const struct chip8_state *state);
+
+/* CHIP8_MEMORY_SIZE bytes, valid until the instance next runs */
+CHIP8_API const unsigned char *chip8_memory(const chip8 *c);
+
+/* Replaces memory with CHIP8_MEMORY_SIZE bytes from image. Returns 0,
+   or -1 if memory runs out */
+CHIP8_API int chip8_set_memory(chip8 *c, const unsigned char *image);
+
+/* Display, one byte per pixel, 1 if on, column by column: pixel x, y is
+   at x * CHIP8_VIDEO_HEIGHT + y. Valid until the instance next runs */
+CHIP8_API const unsigned char *chip8_framebuffer(const chip8 *c);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* defined(__libchip8_H__) */
@@ -2,18 +2,36 @@
 #include <SDL2/SDL_mixer.h>
 #include <iostream>
 #include <fstream>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
 
 #include "Chip8.hpp"
+#include "Chip8Aot.hpp"
+#include "Diagnostics.hpp"
+#include "FramePacer.hpp"
+#include "Metrics.hpp"
+#include "Recorder.hpp"
+#include "Rewind.hpp"
+#include "ShmFrameRing.hpp"
+#include "SPSCQueue.hpp"
+#include "Trace.hpp"
+#include "TripleBuffer.hpp"
+#include "Upscaler.hpp"
 
 
 const Uint32 width = 64;
 const Uint32 height = 32;
 int scale = 8;
-const unsigned char NCOLORS = 2;
 
 const Uint32 fps = 60;
 const Uint32 freq = 400;
-const Uint32 minframetime = 1000 / fps;
+// longest the render thread sleeps while the emulation is idle
+const Uint32 idle_wait_ms = 1000;
 
 // Key mapping
 
@@ -40,26 +58,83 @@ const Uint32 KEY_DUMP_RAM = SDLK_d;
 const Uint32 KEY_DUMP_REGS = SDLK_r;
 const Uint32 KEY_PAUSE = SDLK_RETURN;
 const Uint32 KEY_RESET = SDLK_BACKSPACE;
+const Uint32 KEY_REWIND = SDLK_LEFT;
 const Uint32 KEY_SCALE_1 = SDLK_1;
 const Uint32 KEY_SCALE_2 = SDLK_2;
+const Uint32 KEY_FILTER = SDLK_f;
+const Uint32 KEY_METRICS = SDLK_m;
+const Uint32 KEY_SAVE_TRACE = SDLK_t;
 const Uint32 KEY_EXIT = SDLK_ESCAPE;
 
-Uint32 palette[NCOLORS];
+const char *filter_names[Upscaler::FILTER_COUNT] =
+    {"none", "scale2x", "scale4x", "smooth2x"};
 
 SDL_Window *window = nullptr;
-SDL_Surface *screen = nullptr;
+SDL_Renderer *renderer = nullptr;
+SDL_Texture *texture = nullptr;
+Upscaler upscaler;
 Mix_Music *beep_sound = nullptr;
 
-bool pause = false;
+// Emulation runs on its own thread. The render thread sends it input
+// over input_queue and presents the frames it publishes in frames.
+// Frames are only published when they differ from the last one, and
+// while nothing can change (paused, or FX0A waiting for a key with the
+// timers stopped) the emulation thread sleeps until input arrives and
+// the render thread until an SDL event does.
+
+enum InputType
+{
+    INPUT_KEYS,
+    INPUT_DUMP_RAM,
+    INPUT_DUMP_REGS,
+    INPUT_RESET,
+    INPUT_PAUSE,
+    INPUT_REWIND,
+    INPUT_SAVE_TRACE
+};
+
+struct InputEvent
+{
+    unsigned char type;
+    unsigned short keys; // INPUT_KEYS: bit i set if Chip8 key i is down
+			 // INPUT_REWIND: 1 while the rewind key is held
+};
+
+struct Frame
+{
+    uint64_t display[Chip8::VIDEO_HEIGHT]; // Chip8::get_display_rows()
+    unsigned char sound_timer;
+    unsigned long long number;
+    unsigned long long beeps; // times the sound timer was started so far
+};
+
+SPSCQueue<InputEvent, 64> input_queue;
+TripleBuffer<Frame> frames;
+std::atomic<bool> quit(false);
+std::atomic<bool> emulation_idle(false);
+std::mutex idle_lock;
+std::condition_variable idle_wake;
+
+FramePacer emulation_pacer(fps);
+
+Recorder recorder;
+RewindBuffer rewind_buffer;
+ShmFrameRing frame_ring;
+Diagnostics diagnostics;
+Metrics metrics(fps);
+MetricsExporter metrics_exporter;
+TraceBuffer *trace_buffer = nullptr;
+std::string trace_path;
+bool show_metrics = false;
 
 int init_SDL() 
 {
-    std::cout << "Initializing SDL..." << std::endl;
+    std::cout << "Initializing SDL..." << '\n';
 
     //Initialize all SDL subsystems
     if (SDL_Init(SDL_INIT_EVERYTHING) == -1)
     {
-	std::cout << SDL_GetError() << std::endl;
+	std::cout << SDL_GetError() << '\n';
 	return 1;
     }
   
@@ -68,16 +143,21 @@ int init_SDL()
 			      SDL_WINDOW_SHOWN);
     if (window == nullptr)
     {
-	std::cout << SDL_GetError() << std::endl;
+	std::cout << SDL_GetError() << '\n';
 	return 1;
     }
 
-    screen = SDL_GetWindowSurface(window);
+    renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
+    if (renderer == nullptr)
+    {
+	std::cout << SDL_GetError() << '\n';
+	return 1;
+    }
 
     //Initialize SDL_mixer
     if(Mix_OpenAudio(44100, MIX_DEFAULT_FORMAT, 1, 4096 ) == -1)
     {
-	std::cout << SDL_GetError() << std::endl;
+	std::cout << SDL_GetError() << '\n';
 	return 1;
     }
     
@@ -85,7 +165,7 @@ int init_SDL()
     beep_sound= Mix_LoadMUS("beep.wav");
     if(beep_sound == nullptr)
     {
-	std::cout << SDL_GetError() << std::endl;
+	std::cout << SDL_GetError() << '\n';
 	return 1;
     }
    
@@ -94,9 +174,11 @@ int init_SDL()
 
 void stop_SDL()
 {
-    std::cout << "Stopping SDL..." << std::endl;
+    std::cout << "Stopping SDL..." << '\n';
     Mix_FreeMusic(beep_sound);
     Mix_CloseAudio();
+    SDL_DestroyTexture(texture);
+    SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
     SDL_Quit();
 }
@@ -105,23 +187,90 @@ void change_scale(unsigned int s)
 {
     scale = s;
     SDL_SetWindowSize(window, width * scale, height * scale);
-    screen = SDL_GetWindowSurface(window);
 }
 
-void render_SDL(unsigned char gfx[][Chip8::VIDEO_HEIGHT])
+/* Selects the upscaling filter and creates a texture of its output
+   size. Returns 0 upon success or 1 otherwise */
+int set_filter(Upscaler::Filter filter)
 {
-    SDL_Rect pixel = {0, 0, scale, scale};
-  
-    for (int i = 0; i < width; i++)
+    upscaler.set_filter(filter);
+    if (texture != nullptr)
+	SDL_DestroyTexture(texture);
+    texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
+				SDL_TEXTUREACCESS_STREAMING,
+				upscaler.width(), upscaler.height());
+    if (texture == nullptr)
     {
-	pixel.x = i * scale;
-	for (int j = 0; j < height; j++)
-	{
-	    pixel.y = j * scale;
-	    SDL_FillRect(screen, &pixel, palette[gfx[i][j]]);
-	}
+	std::cout << SDL_GetError() << '\n';
+	return 1;
     }
-    SDL_UpdateWindowSurface(window);
+    return 0;
+}
+
+// 3x5 digits for the metrics overlay, bit 2 is the leftmost column
+const unsigned char overlay_digits[10][5] =
+{
+    {7, 5, 5, 5, 7}, {2, 6, 2, 2, 7}, {7, 1, 7, 4, 7}, {7, 1, 7, 1, 7},
+    {5, 5, 7, 1, 1}, {7, 4, 7, 1, 7}, {7, 4, 7, 5, 7}, {7, 1, 1, 1, 1},
+    {7, 5, 7, 5, 7}, {7, 5, 7, 1, 7}
+};
+
+void draw_number(unsigned long long value, int x, int y, int size)
+{
+    char digits[24];
+    int n = snprintf(digits, sizeof(digits), "%llu", value);
+    for (int i = 0; i < n; i++)
+	for (int row = 0; row < 5; row++)
+	    for (int col = 0; col < 3; col++)
+		if (overlay_digits[digits[i] - '0'][row] & (4 >> col))
+		{
+		    SDL_Rect dot = {x + (i * 4 + col) * size, y + row * size,
+				    size, size};
+		    SDL_RenderFillRect(renderer, &dot);
+		}
+}
+
+/* Metrics overlay, one line per value after a colored marker: speed in
+   percent (green), frame build and present p99 in microseconds (yellow,
+   cyan), dropped and late frames (red, magenta) */
+void draw_metrics()
+{
+    const unsigned char colors[5][3] =
+	{{0, 255, 0}, {255, 255, 0}, {0, 255, 255}, {255, 0, 0}, {255, 0, 255}};
+    unsigned long long values[5] =
+	{(unsigned long long)(metrics.speed * 100),
+	 (unsigned long long)metrics.frame_build.quantile(0.99),
+	 (unsigned long long)metrics.frame_present.quantile(0.99),
+	 metrics.frames_dropped.load(),
+	 metrics.frames_late.load()};
+    int size = scale / 4 > 0 ? scale / 4 : 1;
+
+    SDL_Rect panel = {0, 0, 28 * 4 * size, (5 * 6 + 1) * size};
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+    SDL_RenderFillRect(renderer, &panel);
+    for (int i = 0; i < 5; i++)
+    {
+	int y = (i * 6 + 1) * size;
+	SDL_Rect marker = {size, y, 3 * size, 5 * size};
+	SDL_SetRenderDrawColor(renderer, colors[i][0], colors[i][1], colors[i][2], 255);
+	SDL_RenderFillRect(renderer, &marker);
+	SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+	draw_number(values[i], 6 * size, y, size);
+    }
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+}
+
+void render_SDL(const uint64_t display[Chip8::VIDEO_HEIGHT])
+{
+    // the filter only redoes the rows the game changed, and the whole
+    // frame goes to the GPU in one upload, skipped if nothing changed
+    if (upscaler.update(display))
+	SDL_UpdateTexture(texture, nullptr, upscaler.pixels(), upscaler.pitch());
+    SDL_RenderClear(renderer);
+    SDL_RenderCopy(renderer, texture, nullptr, nullptr);
+    if (show_metrics)
+	draw_metrics();
+    SDL_RenderPresent(renderer);
 }
 
 void play_audio(unsigned char sound_timer)
@@ -138,43 +287,69 @@ void play_audio(unsigned char sound_timer)
     }
 }
 
-void setup_palette()
-{
-    palette[0] = SDL_MapRGB(screen->format, 0x00, 0x00, 0x00);
-    palette[1] = SDL_MapRGB(screen->format, 0xFF, 0xFF, 0xFF);
-}
-
-int setup_graphics()
+int setup_graphics(Upscaler::Filter filter)
 {
     if (init_SDL())
 	return 1;
-    setup_palette();
+    // ARGB8888 black and white
+    upscaler.set_palette(0xFF000000, 0xFFFFFFFF);
+    if (set_filter(filter))
+	return 1;
    
     return 0;
 }
 
-void update_key_reg(unsigned char key[])
+unsigned short read_keys()
 {
     const Uint8 *keystates = SDL_GetKeyboardState( NULL );
-    key[0x0] = keystates[KEY_0];
-    key[0x1] = keystates[KEY_1];
-    key[0x2] = keystates[KEY_2];
-    key[0x3] = keystates[KEY_3];
-    key[0x4] = keystates[KEY_4];
-    key[0x5] = keystates[KEY_5];
-    key[0x6] = keystates[KEY_6];
-    key[0x7] = keystates[KEY_7];
-    key[0x8] = keystates[KEY_8];
-    key[0x9] = keystates[KEY_9];
-    key[0xA] = keystates[KEY_A];
-    key[0xB] = keystates[KEY_B];
-    key[0xC] = keystates[KEY_C];
-    key[0xD] = keystates[KEY_D];
-    key[0xE] = keystates[KEY_E];
-    key[0xF] = keystates[KEY_F];
+    const Uint32 keymap[Chip8::KEYS_SIZE] =
+	{KEY_0, KEY_1, KEY_2, KEY_3, KEY_4, KEY_5, KEY_6, KEY_7,
+	 KEY_8, KEY_9, KEY_A, KEY_B, KEY_C, KEY_D, KEY_E, KEY_F};
+    unsigned short keys = 0;
+
+    for (unsigned int i = 0; i < Chip8::KEYS_SIZE; i++)
+	if (keystates[keymap[i]])
+	    keys |= 1 << i;
+    return keys;
+}
+
+/* Wakes the emulation thread if it sleeps in suspend_emulation().
+   Called after queueing input or setting quit */
+void wake_emulation()
+{
+    // taking the lock orders this with the sleeper checking the queue
+    {
+	std::lock_guard<std::mutex> guard(idle_lock);
+    }
+    idle_wake.notify_one();
+}
+
+/* Emulation thread: sleeps until there is input or quit is set, then
+   posts an event to wake the render thread out of SDL_WaitEventTimeout */
+void suspend_emulation()
+{
+    {
+	std::unique_lock<std::mutex> guard(idle_lock);
+	emulation_idle.store(true, std::memory_order_release);
+	idle_wake.wait(guard, [] { return quit || !input_queue.empty(); });
+	emulation_idle.store(false, std::memory_order_release);
+    }
+    SDL_Event wake;
+    memset(&wake, 0, sizeof(wake));
+    wake.type = SDL_USEREVENT;
+    SDL_PushEvent(&wake);
+}
+
+void send_input(unsigned char type, unsigned short keys = 0)
+{
+    InputEvent input = {type, keys};
+    // the emulation thread drains the queue every frame, a full queue
+    // means it is stuck and the event would be stale anyway
+    if (input_queue.push(input))
+	wake_emulation();
 }
 
-int process_event(SDL_Event *e, Chip8* myChip8)
+int process_event(SDL_Event *e, unsigned short *keys)
 {
     if (e->type == SDL_QUIT)
 	return 1;
@@ -184,23 +359,23 @@ int process_event(SDL_Event *e, Chip8* myChip8)
 	{
 	    switch (e->key.keysym.sym)
 	    {
-/*
-	    case KEY_A:
-		std::cout << "key Z pressed" << std::endl;
-		break;
-*/
 	    case KEY_DUMP_RAM:
-		myChip8->debug_dump_mem();
+		send_input(INPUT_DUMP_RAM);
 		break;
 	    case KEY_DUMP_REGS:
-		myChip8->debug_dump_reg();
+		send_input(INPUT_DUMP_REGS);
 		break;
 	    case KEY_RESET:
-		myChip8->reset();
-		myChip8->load_rom();
+		send_input(INPUT_RESET);
 		break;
 	    case KEY_PAUSE:
-		pause = pause ^ true;
+		send_input(INPUT_PAUSE);
+		break;
+	    case KEY_REWIND:
+		send_input(INPUT_REWIND, 1);
+		break;
+	    case KEY_SAVE_TRACE:
+		send_input(INPUT_SAVE_TRACE);
 		break;
 	    case KEY_SCALE_1:
 		if (scale != 8)
@@ -210,6 +385,13 @@ int process_event(SDL_Event *e, Chip8* myChip8)
 		if (scale != 16)
 		    change_scale(16);
 		break;
+	    case KEY_METRICS:
+		show_metrics = !show_metrics;
+		break;
+	    case KEY_FILTER:
+		set_filter((Upscaler::Filter)((upscaler.get_filter() + 1)
+					      % Upscaler::FILTER_COUNT));
+		break;
 	    case KEY_EXIT:
 		return 1;
 		break;
@@ -217,80 +399,384 @@ int process_event(SDL_Event *e, Chip8* myChip8)
 		break;
 	    }
 	}
-/*      
-	if (e->type == SDL_KEYUP)
+	if (e->type == SDL_KEYUP && e->key.keysym.sym == KEY_REWIND)
+	    send_input(INPUT_REWIND, 0);
+	if (e->type == SDL_KEYUP || e->type == SDL_KEYDOWN)
+	    *keys = read_keys();
+    }
+    return 0;
+}
+
+void apply_input(const InputEvent &input, Chip8 *myChip8, bool *paused,
+		 bool *rewinding)
+{
+    switch (input.type)
+    {
+    case INPUT_KEYS:
+	for (unsigned int i = 0; i < Chip8::KEYS_SIZE; i++)
+	    myChip8->key[i] = (input.keys >> i) & 1;
+	break;
+    case INPUT_DUMP_RAM:
+	myChip8->debug_dump_mem();
+	break;
+    case INPUT_DUMP_REGS:
+	myChip8->debug_dump_reg();
+	break;
+    case INPUT_RESET:
+	myChip8->restart();
+	break;
+    case INPUT_PAUSE:
+	*paused = *paused ^ true;
+	break;
+    case INPUT_REWIND:
+	*rewinding = input.keys != 0;
+	break;
+    case INPUT_SAVE_TRACE:
+	if (trace_buffer == nullptr)
+	    break;
+	if (trace_buffer->save(trace_path))
+	    std::cout << "Unable to write " << trace_path << '\n';
+	else
+	    std::cout << "Trace saved to " << trace_path << '\n';
+	break;
+    }
+}
+
+void publish_frame(const Chip8 *myChip8, unsigned char sound_timer)
+{
+    static unsigned long long number = 0;
+    static unsigned long long beeps = 0;
+    static unsigned char last_sound_timer = 0;
+    static uint64_t last_display[Chip8::VIDEO_HEIGHT];
+    bool sound_changed = (sound_timer > 0) != (last_sound_timer > 0);
+    if (sound_timer > 0 && last_sound_timer == 0)
+	beeps++;
+    last_sound_timer = sound_timer;
+    // the render thread has nothing to present or play for a frame that
+    // looks and sounds like the last one
+    if (number > 0 && !sound_changed &&
+	memcmp(last_display, myChip8->get_display_rows(), sizeof(last_display)) == 0)
+	return;
+    memcpy(last_display, myChip8->get_display_rows(), sizeof(last_display));
+
+    Frame &frame = frames.back();
+    memcpy(frame.display, myChip8->get_display_rows(), sizeof(frame.display));
+    frame.sound_timer = sound_timer;
+    frame.number = ++number;
+    frame.beeps = beeps;
+    frames.publish();
+}
+
+void emulation_thread(Chip8 *myChip8)
+{
+    InputEvent input;
+    bool paused = false;
+    bool rewinding = false;
+    bool key_wait = false;   // the last frame ended blocked in FX0A
+    // instructions owed by the compiled code, in units of 1 / fps
+    // instructions; the interpreter keeps its own in run_frame()
+    Uint32 cycle_budget = 0;
+    // native code for this ROM, if it was compiled with chip8_aot
+    // (compiled code records no trace)
+    const Chip8AotEntry *aot = trace_buffer == nullptr ? chip8_aot_find(*myChip8)
+	: nullptr;
+
+    myChip8->set_speed(freq, fps);
+    myChip8->set_stop_events(Chip8::EVENT_KEY_WAIT);
+    emulation_pacer.start();
+    while (!quit)
+    {
+	// with the timers stopped, a machine blocked in FX0A only changes
+	// when a key does. A recording keeps its frames coming regardless
+	bool frozen = key_wait && myChip8->delay_timer == 0 &&
+	    myChip8->sound_timer == 0 && !recorder.is_open();
+	if (input_queue.empty() && !rewinding && (paused || frozen))
 	{
-	    switch (e->key.keysym.sym)
+	    suspend_emulation();
+	    emulation_pacer.start();
+	}
+
+	metrics.input_queue_depth.store(input_queue.size(), std::memory_order_relaxed);
+	while (input_queue.pop(input))
+	{
+	    apply_input(input, myChip8, &paused, &rewinding);
+	    key_wait = false;
+	}
+
+	if (rewinding)
+	{
+	    // step back one frame per frame while the key is held
+	    if (rewind_buffer.rewind(*myChip8, 1) > 0)
+		publish_frame(myChip8, 0);
+	}
+	else if (!paused)
+	{
+	    long long build_start = FramePacer::now_ns();
+	    unsigned long long cycle = myChip8->get_cycle();
+	    if (aot != nullptr)
 	    {
-	    case KEY_A:
-		std::cout << "key Z unpressed" << std::endl;
-		break;
-	    default:
-		break;
+		myChip8->emulate_hardware();
+		cycle_budget += freq;
+		aot->run(*myChip8, cycle_budget / fps);
+		cycle_budget %= fps;
+	    }
+	    else
+	    {
+		Chip8::RunResult result;
+		do
+		    result = myChip8->run_frame();
+		while (!result.frame_end);
+		key_wait = result.reason == Chip8::STOP_KEY_WAIT;
 	    }
+
+	    if (recorder.is_open())
+		recorder.record_frame(myChip8->gfx, myChip8->sound_timer);
+	    if (frame_ring.is_open())
+		frame_ring.publish(*myChip8);
+	    rewind_buffer.push(*myChip8);
+	    publish_frame(myChip8, myChip8->sound_timer);
+
+	    metrics.instructions.fetch_add(myChip8->get_cycle() - cycle,
+					   std::memory_order_relaxed);
+	    metrics.frames.fetch_add(1, std::memory_order_relaxed);
+	    metrics.frame_build.observe((FramePacer::now_ns() - build_start) / 1000);
 	}
-*/	
-	if (e->type == SDL_KEYUP || e->type == SDL_KEYDOWN)
-	    update_key_reg(myChip8->key);
+
+	if (!emulation_pacer.wait() && !paused)
+	    metrics.frames_late.fetch_add(1, std::memory_order_relaxed);
     }
-    return 0;
 }
 
 int main(int argc, char** argv)
 {
-    if (argc < 2)
+    std::string record_path;
+    std::string shm_name;
+    bool shm_replace = false;
+    bool display_sync = false;
+    Chip8::Profile profile = Chip8::PROFILE_AUTO;
+    bool checked = false;
+    Chip8::Engine engine = Chip8::ENGINE_SWITCH;
+    Upscaler::Filter filter = Upscaler::FILTER_NONE;
+    std::string metrics_file;
+    std::string metrics_socket;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "r:s:S:vq:ctf:x:X:T:")) != -1)
     {
-	std::cout << "Usage: " << argv[0] << " ROM" << std::endl;
+	switch (opt)
+	{
+	case 'x':
+	    metrics_file = optarg;
+	    break;
+	case 'X':
+	    metrics_socket = optarg;
+	    break;
+	case 'f':
+	    for (int i = 0; i < Upscaler::FILTER_COUNT; i++)
+		if (std::string(optarg) == filter_names[i])
+		    filter = (Upscaler::Filter)i;
+	    break;
+	case 't':
+	    engine = Chip8::ENGINE_THREADED;
+	    break;
+	case 'q':
+	    if (Chip8::profile_from_name(optarg, profile))
+	    {
+		std::cout << "Unknown profile " << optarg << '\n';
+		return 1;
+	    }
+	    break;
+	case 'c':
+	    checked = true;
+	    break;
+	case 'v':
+	    display_sync = true;
+	    break;
+	case 'r':
+	    record_path = optarg;
+	    break;
+	case 's':
+	case 'S':
+	    shm_name = optarg;
+	    shm_replace = opt == 'S';
+	    break;
+	case 'T':
+	    trace_path = optarg;
+	    break;
+	default:
+	    break;
+	}
+    }
+    if (argc - optind < 1)
+    {
+	std::cout << "Usage: " << argv[0] << " [-v] [-c] [-t] [-q chip8|vip|schip] [-f none|scale2x|scale4x|smooth2x] [-r recording] [-s|-S shm_name] [-x metrics_file] [-X metrics_socket] [-T trace_file] ROM" << '\n';
 	return 1;
     }
-    std::string rom_path = argv[1];
+    std::string rom_path = argv[optind];
 
-    if (setup_graphics())
+    if (setup_graphics(filter))
 	return 1;
 
     SDL_Event e;
-    bool quit = false;
-    Uint32 start_time;
-    Uint32 last_time;
-    Uint32 elapsed_time;
     Chip8 myChip8;
 
-    std::cout << "Initializing Chip8..." << std::endl;
-    if (myChip8.initialize(SDL_GetTicks(), rom_path))
+    std::cout << "Initializing Chip8...\n";
+    diagnostics.start();
+    myChip8.set_diagnostics(&diagnostics);
+    std::cout << "Loading rom: " << rom_path << '\n';
+    if (myChip8.initialize(SDL_GetTicks(), rom_path.c_str()))
+    {
+	diagnostics.stop();
+	std::cout << "Unable to load " << rom_path << '\n';
 	return 1;
-        
-    float cycles = 0;
-    last_time = SDL_GetTicks();
+    }
+    myChip8.set_profile(profile, checked);
+    myChip8.set_engine(engine);
+
+    if (record_path != "" && recorder.open(record_path))
+    {
+	std::cout << "Unable to open " << record_path << '\n';
+	return 1;
+    }
+
+    TraceBuffer tracer;
+    if (trace_path != "")
+    {
+	trace_buffer = &tracer;
+	myChip8.set_tracer(trace_buffer);
+	TraceBuffer::install_crash_handler(trace_buffer, trace_path);
+    }
+
+    if (shm_name != "" && frame_ring.create(shm_name, 8, shm_replace))
+    {
+	if (errno == EEXIST)
+	    std::cout << "Shared memory ring " << shm_name << " already exists: "
+		      << "another emulator is publishing to it, or use -S to "
+		      << "replace one left by a crash\n";
+	else
+	    std::cout << "Unable to create shared memory ring " << shm_name << '\n';
+	return 1;
+    }
+
+    // Present at the display refresh rate, or at the emulated one if
+    // the display does not report it
+    FramePacer present_pacer(fps);
+    SDL_DisplayMode mode;
+    if (SDL_GetCurrentDisplayMode(SDL_GetWindowDisplayIndex(window), &mode) == 0
+	&& mode.refresh_rate > 0)
+    {
+	present_pacer.set_rate(mode.refresh_rate);
+	// Run the emulation in step with the display when it is close
+	// enough to 60 Hz, so that every frame is shown exactly once
+	if (display_sync && mode.refresh_rate >= 55 && mode.refresh_rate <= 65)
+	    emulation_pacer.set_rate(mode.refresh_rate);
+    }
+
+    metrics.sessions = 1;
+    if (metrics_exporter.open(metrics, metrics_file, metrics_socket))
+    {
+	std::cout << "Unable to export metrics\n";
+	return 1;
+    }
+
+    std::thread emulator(emulation_thread, &myChip8);
+
+    unsigned short keys = 0;
+    unsigned short keys_sent = 0;
+    unsigned long long last_number = 0;
+    unsigned long long last_beeps = 0;
+    long long speed_sampled = FramePacer::now_ns();
+    present_pacer.start();
     while (!quit)
     {
-	start_time = SDL_GetTicks();
-	elapsed_time = start_time - last_time;
-		
+	bool redraw = false;
 	while (SDL_PollEvent(&e))
 	{
-	    if (process_event(&e, &myChip8))
+	    if (process_event(&e, &keys))
 		quit = true;
+	    // the window was uncovered, or the overlay, filter or scale
+	    // may have changed: present again even without a new frame
+	    if (e.type == SDL_WINDOWEVENT || e.type == SDL_KEYDOWN)
+		redraw = true;
+	}
+	if (keys != keys_sent)
+	{
+	    InputEvent input = {INPUT_KEYS, keys};
+	    // retried on the next iteration if the queue is full
+	    if (input_queue.push(input))
+	    {
+		keys_sent = keys;
+		wake_emulation();
+	    }
 	}
 
-	if (!pause)
+	if (FramePacer::now_ns() - speed_sampled >= 1000000000)
 	{
-	    myChip8.emulate_hardware();
+	    metrics.update_speed();
+	    speed_sampled = FramePacer::now_ns();
+	    redraw = redraw || show_metrics;
+	}
 
-	    cycles += (float)elapsed_time * freq / 1000;
-	    while (cycles > 1)
-		cycles -= myChip8.run_instruction();
+	// read before the frame: one published just before the emulation
+	// went idle is still taken below
+	bool idle = emulation_idle.load(std::memory_order_acquire);
+	if (frames.update())
+	{
+	    const Frame &frame = frames.front();
+	    long long present_start = FramePacer::now_ns();
+	    render_SDL(frame.display);
+	    play_audio(frame.sound_timer);
+	    metrics.frame_present.observe((FramePacer::now_ns() - present_start) / 1000);
+	    metrics.frames_presented.fetch_add(1, std::memory_order_relaxed);
+
+	    if (frame.number > last_number + 1)
+		metrics.frames_dropped.fetch_add(frame.number - last_number - 1,
+						 std::memory_order_relaxed);
+	    last_number = frame.number;
+	    // beeps that started and ended between two presented frames
+	    // were never heard
+	    unsigned long long started = frame.beeps - last_beeps;
+	    unsigned long long heard = frame.sound_timer > 0 ? 1 : 0;
+	    if (started > heard)
+		metrics.audio_underruns.fetch_add(started - heard,
+						  std::memory_order_relaxed);
+	    last_beeps = frame.beeps;
+	}
+	else if (redraw)
+	    render_SDL(frames.front().display);
 
-	    play_audio(myChip8.sound_timer);
+	if (idle)
+	{
+	    // no frame comes until input does, and the emulation thread
+	    // posts an event when it resumes
+	    SDL_WaitEventTimeout(nullptr, idle_wait_ms);
+	    present_pacer.start();
 	}
-	render_SDL(myChip8.gfx);
+	else
+	    present_pacer.wait();
+    }
 
-	// Limit frame rate
-	if (SDL_GetTicks() - start_time < minframetime)
-	    SDL_Delay(minframetime - (SDL_GetTicks() - start_time));
-	
-	last_time = start_time;
+    wake_emulation();
+    emulator.join();
+    metrics_exporter.close();
+
+    FramePacer::Stats stats = emulation_pacer.get_stats();
+    std::cout << "Emulated " << stats.frames << " frames at "
+	      << emulation_pacer.get_rate() << " Hz: frame time mean "
+	      << stats.mean_ms << " ms, p99 " << stats.p99_ms << " ms, max "
+	      << stats.max_ms << " ms, " << stats.missed
+	      << " missed deadlines\n";
+
+    if (recorder.is_open())
+    {
+	recorder.close();
+	if (recorder.frames_dropped())
+	    std::cout << recorder.frames_dropped()
+		      << " frames dropped from the recording" << '\n';
     }
 
+    frame_ring.close();
+    diagnostics.stop();
     stop_SDL();
 
     return 0;
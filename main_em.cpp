@@ -10,6 +10,7 @@
 #endif
 
 #include "Chip8.hpp"
+#include "Diagnostics.hpp"
 
 
 
@@ -80,22 +81,20 @@ SDL_Surface *screen = nullptr;
 Mix_Music *beep_sound = nullptr;
 
 Chip8 myChip8;
+Diagnostics diagnostics;
 bool quit = false;
 bool paused = false;
-Uint32 last_time;
-Uint32 elapsed_time;
 SDL_Event e;
 Uint32 start_time;
-float cycles = 0;
 
 int init_SDL() 
 {
-    std::cout << "Initializing SDL..." << std::endl;
+    std::cout << "Initializing SDL..." << '\n';
 
     //Initialize all SDL subsystems
     if (SDL_Init(SDL_INIT_EVERYTHING) == -1)
     {
-	std::cout << SDL_GetError() << std::endl;
+	std::cout << SDL_GetError() << '\n';
 	return 1;
     }
 /*  // SDL2
@@ -104,7 +103,7 @@ int init_SDL()
 			      SDL_WINDOW_SHOWN);
     if (window == nullptr)
     {
-	std::cout << SDL_GetError() << std::endl;
+	std::cout << SDL_GetError() << '\n';
 	return 1;
     }
 
@@ -115,7 +114,7 @@ int init_SDL()
     screen = SDL_SetVideoMode(width * scale, height * scale, 32, SDL_HWSURFACE | SDL_DOUBLEBUF);
     if (screen == nullptr)
     {
-	std::cout << SDL_GetError() << std::endl;
+	std::cout << SDL_GetError() << '\n';
 	return 1;
     }
     SDL_WM_SetCaption("Chip8 Emulator by Dhole", NULL);
@@ -124,7 +123,7 @@ int init_SDL()
     //Initialize SDL_mixer
     if(Mix_OpenAudio(44100, MIX_DEFAULT_FORMAT, 1, 4096 ) == -1)
     {
-	std::cout << SDL_GetError() << std::endl;
+	std::cout << SDL_GetError() << '\n';
 	return 1;
     }
     
@@ -132,7 +131,7 @@ int init_SDL()
     beep_sound= Mix_LoadMUS("beep.wav");
     if(beep_sound == nullptr)
     {
-	std::cout << SDL_GetError() << std::endl;
+	std::cout << SDL_GetError() << '\n';
 	return 1;
     }
    
@@ -141,7 +140,7 @@ int init_SDL()
 
 void stop_SDL()
 {
-    std::cout << "Stopping SDL..." << std::endl;
+    std::cout << "Stopping SDL..." << '\n';
     Mix_FreeMusic(beep_sound);
     Mix_CloseAudio();
     // SDL1.2
@@ -165,7 +164,7 @@ void change_scale(unsigned int s)
     // end SDL1.2
 }
 
-void render_SDL(unsigned char gfx[][Chip8::VIDEO_HEIGHT])
+void render_SDL(const unsigned char gfx[][Chip8::VIDEO_HEIGHT])
 {
     SDL_Rect pixel = {0, 0, scale, scale};
   
@@ -263,7 +262,7 @@ int process_event(SDL_Event *e, Chip8* myChip8)
 	    {
 /*
 	    case KEY_A:
-		std::cout << "key Z pressed" << std::endl;
+		std::cout << "key Z pressed" << '\n';
 		break;
 */
 	    case KEY_DUMP_RAM:
@@ -273,8 +272,7 @@ int process_event(SDL_Event *e, Chip8* myChip8)
 		myChip8->debug_dump_reg();
 		break;
 	    case KEY_RESET:
-		myChip8->reset();
-		myChip8->load_rom();
+		myChip8->restart();
 		break;
 	    case KEY_PAUSE:
 		paused = paused ^ true;
@@ -300,7 +298,7 @@ int process_event(SDL_Event *e, Chip8* myChip8)
 	    switch (e->key.keysym.sym)
 	    {
 	    case KEY_A:
-		std::cout << "key Z unpressed" << std::endl;
+		std::cout << "key Z unpressed" << '\n';
 		break;
 	    default:
 		break;
@@ -319,8 +317,6 @@ int process_event(SDL_Event *e, Chip8* myChip8)
 void main_loop()
 {
     start_time = SDL_GetTicks();
-    elapsed_time = start_time - last_time;
-    last_time = start_time;
 		
     while (SDL_PollEvent(&e))
     {
@@ -330,15 +326,17 @@ void main_loop()
 
     if (!paused)
     {
-	myChip8.emulate_hardware();
-
-	cycles += (float)elapsed_time * freq / 1000;
-	while (cycles > 1)
-	    cycles -= myChip8.run_instruction();
+	Chip8::RunResult result;
+	do
+	    result = myChip8.run_frame();
+	while (!result.frame_end);
 
 	play_audio(myChip8.sound_timer);
     }
     render_SDL(myChip8.gfx);
+
+    // no threads here, deliver diagnostics from the main loop
+    diagnostics.drain();
 }
 
 int main(int argc, char** argv)
@@ -374,7 +372,7 @@ PONG2 SCTEST TANK TICTAC VBRIX WIPEOFF';
 #else
     if (argc < 2)
     {
-	std::cout << "Usage: " << argv[0] << " ROM" << std::endl;
+	std::cout << "Usage: " << argv[0] << " ROM" << '\n';
 	return 1;
     }
     rom_path = argv[1];
@@ -383,11 +381,15 @@ PONG2 SCTEST TANK TICTAC VBRIX WIPEOFF';
     if (setup_graphics())
 	return 1;
        
-    std::cout << "Initializing Chip8..." << std::endl;
-    if (myChip8.initialize(SDL_GetTicks(), rom_path))
+    std::cout << "Initializing Chip8..." << '\n';
+    myChip8.set_diagnostics(&diagnostics);
+    if (myChip8.initialize(SDL_GetTicks(), rom_path.c_str()))
+    {
+	diagnostics.drain();
 	return 1;
-    
-    last_time = SDL_GetTicks();
+    }
+    myChip8.set_speed(freq, fps);
+    myChip8.set_stop_events(Chip8::EVENT_KEY_WAIT);
 
 #ifdef EMSCRIPTEN
     emscripten_set_main_loop(main_loop, 60, 1);
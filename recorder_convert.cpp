@@ -0,0 +1,168 @@
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+
+#include "Recorder.hpp"
+
+const unsigned int fps = 60;
+const unsigned int sample_rate = 44100;
+const unsigned int tone_freq = 440;
+
+void usage(const char *name)
+{
+    std::cout << "Usage: " << name << " [-s start] [-n count] [-x scale]"
+	      << " RECORDING pbm|y4m|wav OUTPUT\n\n"
+	      << "  pbm  one OUTPUT_NNNNNN.pbm image per frame\n"
+	      << "  y4m  YUV4MPEG2 video, readable by ffmpeg and most players\n"
+	      << "  wav  8 bit mono audio of the sound timer beep\n";
+}
+
+int export_pbm(RecordingReader &reader, unsigned int count,
+	       unsigned int start, unsigned int scale, const std::string &prefix)
+{
+    unsigned char sound_timer;
+    char name[32];
+
+    for (unsigned int n = 0; n < count && !reader.next(sound_timer); n++)
+    {
+	snprintf(name, sizeof(name), "_%06u.pbm", start + n);
+	std::ofstream out(prefix + name, std::ios::out|std::ios::binary);
+	if (!out.is_open())
+	{
+	    std::cout << "Unable to open " << prefix + name << '\n';
+	    return 1;
+	}
+	out << "P1\n" << Chip8::VIDEO_WIDTH * scale << ' '
+	    << Chip8::VIDEO_HEIGHT * scale << '\n';
+	for (unsigned int y = 0; y < Chip8::VIDEO_HEIGHT * scale; y++)
+	{
+	    for (unsigned int x = 0; x < Chip8::VIDEO_WIDTH * scale; x++)
+		out << (reader.pixel(x / scale, y / scale) ? '1' : '0');
+	    out << '\n';
+	}
+    }
+    return 0;
+}
+
+int export_y4m(RecordingReader &reader, unsigned int count,
+	       unsigned int scale, const std::string &path)
+{
+    unsigned char sound_timer;
+    unsigned int w = Chip8::VIDEO_WIDTH * scale;
+    unsigned int h = Chip8::VIDEO_HEIGHT * scale;
+    std::string luma(w * h, 0);
+    std::string chroma(w * h / 2, (char)128);
+
+    std::ofstream out(path, std::ios::out|std::ios::binary);
+    if (!out.is_open())
+    {
+	std::cout << "Unable to open " << path << '\n';
+	return 1;
+    }
+    out << "YUV4MPEG2 W" << w << " H" << h << " F" << fps
+	<< ":1 Ip A1:1 C420jpeg\n";
+    for (unsigned int n = 0; n < count && !reader.next(sound_timer); n++)
+    {
+	for (unsigned int y = 0; y < h; y++)
+	    for (unsigned int x = 0; x < w; x++)
+		luma[y * w + x] = reader.pixel(x / scale, y / scale) ? 235 : 16;
+	out << "FRAME\n" << luma << chroma;
+    }
+    return 0;
+}
+
+int export_wav(RecordingReader &reader, unsigned int count,
+	       const std::string &path)
+{
+    unsigned char sound_timer;
+    std::string samples;
+    unsigned int phase = 0;
+
+    for (unsigned int n = 0; n < count && !reader.next(sound_timer); n++)
+    {
+	for (unsigned int i = 0; i < sample_rate / fps; i++, phase++)
+	{
+	    bool high = (phase * tone_freq * 2 / sample_rate) & 1;
+	    samples += (char)(sound_timer > 0 ? (high ? 192 : 64) : 128);
+	}
+    }
+
+    std::ofstream out(path, std::ios::out|std::ios::binary);
+    if (!out.is_open())
+    {
+	std::cout << "Unable to open " << path << '\n';
+	return 1;
+    }
+    unsigned char header[44] = {'R', 'I', 'F', 'F', 0, 0, 0, 0,
+				'W', 'A', 'V', 'E', 'f', 'm', 't', ' ',
+				16, 0, 0, 0, 1, 0, 1, 0,
+				0, 0, 0, 0, 0, 0, 0, 0,
+				1, 0, 8, 0, 'd', 'a', 't', 'a'};
+    unsigned int fields[4][2] = {{4, 36 + (unsigned int)samples.size()},
+				 {24, sample_rate}, {28, sample_rate},
+				 {40, (unsigned int)samples.size()}};
+    for (unsigned int f = 0; f < 4; f++)
+	for (unsigned int b = 0; b < 4; b++)
+	    header[fields[f][0] + b] = (fields[f][1] >> (8 * b)) & 0xFF;
+    out.write((const char*)header, sizeof(header));
+    out << samples;
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    unsigned int start = 0;
+    unsigned int count = -1;
+    unsigned int scale = 4;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:n:x:")) != -1)
+    {
+	switch (opt)
+	{
+	case 's':
+	    start = atoi(optarg);
+	    break;
+	case 'n':
+	    count = atoi(optarg);
+	    break;
+	case 'x':
+	    scale = atoi(optarg);
+	    break;
+	default:
+	    usage(argv[0]);
+	    return 1;
+	}
+    }
+    if (argc - optind < 3 || scale == 0)
+    {
+	usage(argv[0]);
+	return 1;
+    }
+    std::string format = argv[optind + 1];
+    std::string output = argv[optind + 2];
+
+    RecordingReader reader;
+    if (reader.open(argv[optind]))
+    {
+	std::cout << "Unable to read recording " << argv[optind] << '\n';
+	return 1;
+    }
+    if (start > 0 && reader.seek(start))
+    {
+	std::cout << "Frame " << start << " is not in the recording\n";
+	return 1;
+    }
+
+    if (format == "pbm")
+	return export_pbm(reader, count, start, scale, output);
+    if (format == "y4m")
+	return export_y4m(reader, count, scale, output);
+    if (format == "wav")
+	return export_wav(reader, count, output);
+
+    usage(argv[0]);
+    return 1;
+}
@@ -0,0 +1,48 @@
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+
+#include "ShmFrameRing.hpp"
+
+/* Example reader for the shared-memory frame ring: periodically prints
+   the newest frame of a running emulator */
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+	std::cout << "Usage: " << argv[0] << " NAME [interval_ms]\n";
+	return 1;
+    }
+    unsigned int interval = argc > 2 ? atoi(argv[2]) : 500;
+
+    ShmFrameReader reader;
+    if (reader.open(argv[1]))
+    {
+	std::cout << "Unable to open shared memory ring " << argv[1] << '\n';
+	return 1;
+    }
+
+    ShmFrame f;
+    while (true)
+    {
+	// copied first: the frame is only printed once it is known whole
+	if (reader.read_latest_copy(f))
+	{
+	    printf("\x1b[H\x1b[2J");
+	    printf("frame %llu  pc %04x  I %04x  sp %02x  DT %02x  ST %02x\n",
+		   (unsigned long long)f.frame, f.pc, f.I, f.sp,
+		   f.delay_timer, f.sound_timer);
+	    for (unsigned int y = 0; y < Chip8::VIDEO_HEIGHT; y++)
+	    {
+		for (unsigned int x = 0; x < Chip8::VIDEO_WIDTH; x++)
+		    putchar(f.gfx[x][y] ? '#' : ' ');
+		putchar('\n');
+	    }
+	    fflush(stdout);
+	}
+	usleep(interval * 1000);
+    }
+    return 0;
+}